@@ -12,19 +12,32 @@
 #define AKWAN_H
 
 #include "akwan/array.h"
+#include "akwan/batch.h"
 #include "akwan/buffer.h"
+#include "akwan/cache.h"
+#include "akwan/channel.h"
 #include "akwan/chunk.h"
 #include "akwan/common.h"
 #include "akwan/compiler.h"
 #include "akwan/dump.h"
 #include "akwan/error.h"
+#include "akwan/frozen.h"
+#include "akwan/image.h"
 #include "akwan/lexer.h"
 #include "akwan/memory.h"
+#include "akwan/number.h"
+#include "akwan/parallel.h"
 #include "akwan/range.h"
+#include "akwan/scan.h"
+#include "akwan/source.h"
 #include "akwan/stack.h"
+#include "akwan/stream.h"
 #include "akwan/string.h"
+#include "akwan/symbol.h"
+#include "akwan/thread.h"
 #include "akwan/value.h"
 #include "akwan/vector.h"
 #include "akwan/vm.h"
+#include "akwan/writer.h"
 
 #endif // AKWAN_H
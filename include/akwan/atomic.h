@@ -0,0 +1,33 @@
+//
+// atomic.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_ATOMIC_H
+#define AKW_ATOMIC_H
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+  #define akw_atomic_load(p)         ((int) _InterlockedOr((volatile long *) (p), 0))
+  #define akw_atomic_store(p, v)     ((void) _InterlockedExchange((volatile long *) (p), (v)))
+  #define akw_atomic_fetch_add(p, v) ((int) _InterlockedExchangeAdd((volatile long *) (p), (v)))
+  #define akw_atomic_fetch_or(p, v)  ((int) _InterlockedOr((volatile long *) (p), (v)))
+  #define akw_atomic_compare_exchange(p, e, d) \
+    (_InterlockedCompareExchange((volatile long *) (p), (d), (e)) == (e))
+#else
+  #include <stdbool.h>
+  #define akw_atomic_load(p)         __atomic_load_n((p), __ATOMIC_ACQUIRE)
+  #define akw_atomic_store(p, v)     __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+  #define akw_atomic_fetch_add(p, v) __atomic_fetch_add((p), (v), __ATOMIC_ACQ_REL)
+  #define akw_atomic_fetch_or(p, v)  __atomic_fetch_or((p), (v), __ATOMIC_ACQ_REL)
+  #define akw_atomic_compare_exchange(p, e, d) \
+    __atomic_compare_exchange_n((p), &(int) { (e) }, (d), false, \
+      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+#endif
+
+#endif // AKW_ATOMIC_H
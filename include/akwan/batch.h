@@ -0,0 +1,57 @@
+//
+// batch.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_BATCH_H
+#define AKW_BATCH_H
+
+#include "cache.h"
+#include "error.h"
+#include "value.h"
+
+// A job made with akw_batch_job_init_file is read by the worker that takes
+// it, and its source is only set while the worker is running it.
+typedef struct
+{
+  int        index;
+  const char *path;
+  char       *source;
+  int        rc;
+  AkwError   err;
+  int        worker;
+} AkwBatchJob;
+
+typedef void (*AkwBatchResultFn)(AkwBatchJob *, AkwValue, void *);
+
+// With checkOnly, jobs are compiled without generating code and are not
+// run, so neither the cache nor onResult is used.
+typedef struct
+{
+  bool             checkOnly;
+  int              numWorkers;
+  int              stackSize;
+  size_t           memLimit;
+  AkwCache         *cache;
+  AkwBatchResultFn onResult;
+  void             *userData;
+} AkwBatchOptions;
+
+typedef struct
+{
+  int numJobs;
+  int numStolen;
+} AkwBatchWorkerStats;
+
+void akw_batch_options_init(AkwBatchOptions *opts);
+void akw_batch_job_init(AkwBatchJob *job, int index, char *source);
+void akw_batch_job_init_file(AkwBatchJob *job, int index, const char *path);
+void akw_batch_run(AkwBatchOptions *opts, int numJobs, AkwBatchJob *jobs,
+  AkwBatchWorkerStats *stats, int *rc);
+
+#endif // AKW_BATCH_H
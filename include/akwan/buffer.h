@@ -12,6 +12,7 @@
 #define AKW_BUFFER_H
 
 #include <stdint.h>
+#include "memory.h"
 
 #define akw_buffer_is_empty(b) (!(b)->count)
 
@@ -28,9 +29,13 @@ typedef struct
 } AkwBuffer;
 
 void akw_buffer_init(AkwBuffer *buf);
+void akw_buffer_init_in(AkwBuffer *buf, AkwMemoryStats *stats);
 void akw_buffer_init_with_capacity(AkwBuffer *buf, int capacity, int *rc);
 void akw_buffer_deinit(AkwBuffer *buf);
+void akw_buffer_deinit_in(AkwBuffer *buf, AkwMemoryStats *stats);
 void akw_buffer_ensure_capacity(AkwBuffer *buf, int capacity, int *rc);
+void akw_buffer_ensure_capacity_in(AkwBuffer *buf, int capacity,
+  AkwMemoryStats *stats, int *rc);
 void akw_buffer_write(AkwBuffer *buf, int count, void *ptr, int *rc);
 
 #endif // AKW_BUFFER_H
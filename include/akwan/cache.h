@@ -0,0 +1,71 @@
+//
+// cache.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_CACHE_H
+#define AKW_CACHE_H
+
+#include <stdint.h>
+#include "image.h"
+#include "thread.h"
+
+#define AKW_CACHE_DEFAULT_MEMORY_LIMIT (64 << 20)
+#define AKW_CACHE_DEFAULT_DISK_LIMIT   (256 << 20)
+
+typedef struct AkwCacheEntry
+{
+  struct AkwCacheEntry *prev;
+  struct AkwCacheEntry *next;
+  struct AkwCacheEntry *chain;
+  uint64_t             key;
+  const char           *source;
+  size_t               sourceLength;
+  size_t               size;
+  int                  refCount;
+  bool                 isEvicted;
+  AkwBuffer            buf;
+  AkwImage             image;
+} AkwCacheEntry;
+
+typedef struct
+{
+  long long hits;
+  long long diskHits;
+  long long misses;
+  long long evictions;
+  long long diskEvictions;
+} AkwCacheStats;
+
+// Compiled chunks keyed by a hash of the source, the compiler version and
+// the compile flags. Each entry keeps its source, which must match on a hit. Recently used chunks are kept in memory, and, when a
+// directory is given, every chunk is also stored there as an image so that
+// later processes can skip compiling it.
+typedef struct
+{
+  char          *dir;
+  size_t        memLimit;
+  size_t        diskLimit;
+  size_t        bytes;
+  int           capacity;
+  int           count;
+  AkwCacheEntry **buckets;
+  AkwCacheEntry *head;
+  AkwCacheEntry *tail;
+  AkwMutex      mutex;
+  AkwCacheStats stats;
+} AkwCache;
+
+void akw_cache_init(AkwCache *cache, const char *dir, int *rc);
+void akw_cache_deinit(AkwCache *cache);
+AkwCacheEntry *akw_cache_compile(AkwCache *cache, int flags, char *source,
+  AkwError err, int *rc);
+void akw_cache_release(AkwCache *cache, AkwCacheEntry *entry);
+void akw_cache_get_stats(AkwCache *cache, AkwCacheStats *stats);
+
+#endif // AKW_CACHE_H
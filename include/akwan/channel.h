@@ -0,0 +1,41 @@
+//
+// channel.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_CHANNEL_H
+#define AKW_CHANNEL_H
+
+#include "value.h"
+
+typedef struct
+{
+  int      sequence;
+  AkwValue value;
+} AkwChannelSlot;
+
+typedef struct
+{
+  int            capacity;
+  AkwChannelSlot *slots;
+  int            tail;
+  int            head;
+} AkwChannel;
+
+// A sent value shares nothing with the sender except frozen values, which
+// are passed as they are, so they must outlive the receiver's use of them:
+// a frozen region until akw_value_free_frozen, and an image constant until
+// akw_image_deinit. Chunk constants are copied.
+void akw_channel_init(AkwChannel *chan, int capacity, int *rc);
+void akw_channel_deinit(AkwChannel *chan);
+bool akw_channel_try_send(AkwChannel *chan, AkwValue *val, int *rc);
+void akw_channel_send(AkwChannel *chan, AkwValue val, int *rc);
+bool akw_channel_try_receive(AkwChannel *chan, AkwValue *val);
+AkwValue akw_channel_receive(AkwChannel *chan);
+
+#endif // AKW_CHANNEL_H
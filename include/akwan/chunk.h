@@ -22,18 +22,25 @@ typedef enum
   AKW_OP_CONST,            AKW_OP_RANGE,
   AKW_OP_ARRAY,            AKW_OP_LOCAL_REF,
   AKW_OP_POP,              AKW_OP_GET_LOCAL,
-  AKW_OP_SET_LOCAL,        AKW_OP_GET_LOCAL_BY_REF,
-  AKW_OP_SET_LOCAL_BY_REF, AKW_OP_GET_ELEMENT,
-  AKW_OP_ADD,              AKW_OP_SUB,
-  AKW_OP_MUL,              AKW_OP_DIV,
-  AKW_OP_MOD,              AKW_OP_NEG,
-  AKW_OP_RETURN
+  AKW_OP_MOVE_LOCAL,       AKW_OP_SET_LOCAL,
+  AKW_OP_GET_LOCAL_BY_REF, AKW_OP_SET_LOCAL_BY_REF,
+  AKW_OP_GET_ELEMENT,      AKW_OP_ADD,
+  AKW_OP_SUB,              AKW_OP_MUL,
+  AKW_OP_DIV,              AKW_OP_MOD,
+  AKW_OP_NEG,              AKW_OP_RETURN
 } AkwOpcode;
 
+// Constants are indexed by value in slots, so that equal numbers and
+// strings share an entry. A chunk loaded from an image has no slots, but
+// knows the deepest its code takes the stack; for other chunks maxDepth is
+// 0, and every push is checked as it happens.
 typedef struct
 {
   AkwBuffer           code;
   AkwVector(AkwValue) consts;
+  int                 numSlots;
+  int                 *slots;
+  int                 maxDepth;
 } AkwChunk;
 
 const char *akw_opcode_name(AkwOpcode op);
@@ -17,10 +17,17 @@
 #define AKW_SEMANTIC_ERROR (3)
 #define AKW_TYPE_ERROR     (4)
 #define AKW_RANGE_ERROR    (5)
+#define AKW_SYSTEM_ERROR   (6)
 
 #define AKW_MIN_CAPACITY (1 << 3)
 #define AKW_MAX_CAPACITY (1 << 30)
 
 #define akw_is_ok(rc) ((rc) == AKW_OK)
 
+#ifdef _MSC_VER
+  #define AKW_THREAD_LOCAL __declspec(thread)
+#else
+  #define AKW_THREAD_LOCAL _Thread_local
+#endif
+
 #endif // AKW_COMMON_H
@@ -13,8 +13,15 @@
 
 #include "chunk.h"
 #include "lexer.h"
+#include "stream.h"
+#include "symbol.h"
+
+// Bumped whenever the compiler starts generating different code for the
+// same source, so that cached chunks are not reused across versions.
+#define AKW_COMPILER_VERSION (2)
 
 #define AKW_COMPILER_FLAG_CHECK_ONLY (1 << 0)
+#define AKW_COMPILER_FLAG_PIPELINED  (1 << 1)
 
 #define akw_compiler_is_ok(c) (akw_is_ok((c)->rc))
 
@@ -27,26 +34,46 @@ typedef struct
 
 typedef struct
 {
-  AkwToken    name;
+  int         symbol;
+  int         shadowed;
   int         depth;
   AkwTypeInfo typeInfo;
   uint8_t     index;
+  int         lastRead;
+  bool        isEscaped;
 } AkwVariable;
 
+// An operator waiting for its right operand, or an open bracket, of the
+// expression being compiled.
+typedef struct
+{
+  uint8_t kind;
+  uint8_t prec;
+  uint8_t op;
+  uint8_t count;
+} AkwExprFrame;
+
 typedef struct
 {
-  int                    flags;
-  int                    rc;
-  AkwError               err;
-  AkwLexer               lex;
-  int                    scopeDepth;
-  AkwVector(AkwVariable) variables;
-  AkwTypeInfo            typeInfo;
-  AkwChunk               chunk;
+  int                     flags;
+  int                     rc;
+  AkwError                err;
+  AkwLexer                lex;
+  AkwTokenStream          stream;
+  int                     scopeDepth;
+  AkwVector(AkwVariable)  variables;
+  AkwSymbolTable          symbols;
+  AkwVector(int)          bindings;
+  AkwVector(AkwExprFrame) frames;
+  AkwTypeInfo             typeInfo;
+  AkwChunk                chunk;
 } AkwCompiler;
 
 void akw_compiler_init(AkwCompiler *comp, int flags, char *source);
+void akw_compiler_init_stream(AkwCompiler *comp, int flags, AkwReadFn read,
+  void *userData);
 void akw_compiler_deinit(AkwCompiler *comp);
+void akw_compiler_define_param(AkwCompiler *comp, const char *name);
 void akw_compiler_compile(AkwCompiler *comp);
 
 #endif // AKW_COMPILER_H
@@ -0,0 +1,19 @@
+//
+// frozen.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_FROZEN_H
+#define AKW_FROZEN_H
+
+#include "value.h"
+
+AkwValue akw_value_freeze(AkwValue val, int *rc);
+void akw_value_free_frozen(AkwValue val);
+
+#endif // AKW_FROZEN_H
@@ -0,0 +1,46 @@
+//
+// image.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_IMAGE_H
+#define AKW_IMAGE_H
+
+#include <stddef.h>
+#include "chunk.h"
+#include "error.h"
+#include "string.h"
+
+// Bumped whenever the layout of an image or the instruction set changes.
+// Images of any other version are rejected on load.
+#define AKW_IMAGE_VERSION (2)
+
+#define akw_image_is_ok(i) (akw_is_ok((i)->rc))
+
+// A chunk loaded from an image. The code and the characters of string
+// constants are used in place, from the mapped file or from the caller's
+// bytes; only the constant pool and the string headers are allocated.
+typedef struct
+{
+  int       rc;
+  AkwError  err;
+  bool      isMapped;
+  void      *base;
+  size_t    size;
+  int       numStrings;
+  AkwString *strings;
+  AkwChunk  chunk;
+} AkwImage;
+
+void akw_image_write(const AkwChunk *chunk, AkwBuffer *buf, int *rc);
+void akw_image_save(const AkwChunk *chunk, const char *path, int *rc);
+void akw_image_init(AkwImage *img, const char *path);
+void akw_image_init_from_bytes(AkwImage *img, size_t size, void *bytes);
+void akw_image_deinit(AkwImage *img);
+
+#endif // AKW_IMAGE_H
@@ -12,6 +12,9 @@
 #define AKW_LEXER_H
 
 #include "error.h"
+#include "vector.h"
+
+#define akw_token_chars(l, t) (&(l)->source[(t)->offset - (l)->base])
 
 typedef enum
 {
@@ -24,26 +27,45 @@ typedef enum
   AKW_TOKEN_KIND_RETURN_KW, AKW_TOKEN_KIND_TRUE_KW,  AKW_TOKEN_KIND_NAME
 } AkwTokenKind;
 
+// The position of a token is its offset into the source. Lines and columns
+// are worked out only when needed, by akw_lexer_position.
 typedef struct
 {
   AkwTokenKind kind;
-  int          ln;
-  int          col;
+  int          offset;
   int          length;
-  char         *chars;
 } AkwToken;
 
+// Returns the number of bytes read into chars, 0 at the end of the input,
+// or -1 on failure.
+typedef int (*AkwReadFn)(void *userData, int size, char *chars);
+
+// A lexer reading through an AkwReadFn keeps only a window of the input in
+// source, starting at offset base. The window ends on a line boundary, where
+// end points, so that only strings can run past it.
 typedef struct
 {
-  char     *source;
-  char     *curr;
-  int      ln;
-  int      col;
-  AkwToken token;
+  char           *source;
+  char           *curr;
+  AkwToken       token;
+  int            indexed;
+  AkwVector(int) lineStarts;
+  AkwReadFn      read;
+  void           *userData;
+  int            base;
+  int            length;
+  int            capacity;
+  char           *end;
+  char           hidden;
 } AkwLexer;
 
 const char *akw_token_kind_name(AkwTokenKind kind);
 void akw_lexer_init(AkwLexer *lex, char *source, int *rc, AkwError err);
+void akw_lexer_init_source(AkwLexer *lex, char *source);
+void akw_lexer_init_stream(AkwLexer *lex, AkwReadFn read, void *userData,
+  int *rc, AkwError err);
+void akw_lexer_deinit(AkwLexer *lex);
 void akw_lexer_next(AkwLexer *lex, int *rc, AkwError err);
+void akw_lexer_position(AkwLexer *lex, int offset, int *ln, int *col);
 
 #endif // AKW_LEXER_H
@@ -13,8 +13,35 @@
 
 #include <stddef.h>
 
+// Blocks of at least this size are mapped directly from the OS (where
+// supported), so that growing them remaps pages instead of copying bytes.
+#define AKW_MEMORY_MAP_THRESHOLD (1 << 20)
+
+#define AKW_MEMORY_MAX_OBJECT_TYPES (8)
+
+typedef struct
+{
+  size_t    limit;
+  size_t    bytes;
+  size_t    peakBytes;
+  long long objects[AKW_MEMORY_MAX_OBJECT_TYPES];
+} AkwMemoryStats;
+
+void akw_memory_stats_init(AkwMemoryStats *stats);
+AkwMemoryStats *akw_memory_swap_stats(AkwMemoryStats *stats);
+AkwMemoryStats *akw_memory_current_stats(void);
+void akw_memory_count_object(AkwMemoryStats *stats, int type, int delta);
+void akw_memory_move_object(AkwMemoryStats *from, AkwMemoryStats *to, int type,
+  size_t size);
 void *akw_memory_alloc(size_t size);
-void *akw_memory_realloc(void *ptr, size_t newSize);
-void akw_memory_dealloc(void *ptr);
+void *akw_memory_realloc(void *ptr, size_t size, size_t newSize);
+void akw_memory_dealloc(void *ptr, size_t size);
+void *akw_memory_alloc_in(AkwMemoryStats *stats, size_t size);
+void *akw_memory_realloc_in(AkwMemoryStats *stats, void *ptr, size_t size,
+  size_t newSize);
+void akw_memory_dealloc_in(AkwMemoryStats *stats, void *ptr, size_t size);
+void *akw_memory_alloc_pages(size_t size);
+void akw_memory_seal_pages(void *ptr, size_t size);
+void akw_memory_dealloc_pages(void *ptr, size_t size);
 
 #endif // AKW_MEMORY_H
@@ -0,0 +1,25 @@
+//
+// number.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_NUMBER_H
+#define AKW_NUMBER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Both functions take the characters of a literal as matched by the lexer,
+// which need not be followed by a NUL, only by a character that cannot be
+// part of the literal. akw_parse_int fails when the digits do not fit in
+// 64 bits. akw_parse_number takes digits, an optional
+// fraction and an optional exponent, and rounds to the nearest double.
+bool akw_parse_int(int length, const char *chars, uint64_t *num);
+double akw_parse_number(int length, const char *chars);
+
+#endif // AKW_NUMBER_H
@@ -0,0 +1,59 @@
+//
+// parallel.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_PARALLEL_H
+#define AKW_PARALLEL_H
+
+#include "chunk.h"
+#include "error.h"
+#include "thread.h"
+
+// Elements are handed to workers in blocks of this size. Block boundaries
+// do not depend on the number of workers, so neither do the results.
+#define AKW_PARALLEL_BLOCK_SIZE (1 << 12)
+
+#define akw_parallel_is_ok(p) (akw_is_ok((p)->rc))
+
+// The worker threads are started by the first call, with numWorkers read
+// then, and wait for the next call until akw_parallel_deinit. One thread at
+// a time may call into a pool.
+typedef struct
+{
+  int       numWorkers;
+  int       stackSize;
+  int       rc;
+  AkwError  err;
+  int       capacity;
+  int       numThreads;
+  AkwThread *threads;
+  AkwMutex  mutex;
+  AkwCond   wake;
+  AkwCond   done;
+  void      *job;
+  int       generation;
+  int       numBusy;
+  bool      isStopping;
+} AkwParallel;
+
+void akw_parallel_init(AkwParallel *par);
+void akw_parallel_deinit(AkwParallel *par);
+AkwValue akw_parallel_map(AkwParallel *par, AkwChunk *chunk, AkwValue input);
+// Each block is folded from init with chunk, which takes the accumulator
+// and then the element, and the partial results are joined in block order
+// with combine, which takes two accumulators. So that the result is the
+// one a sequential fold from init gives, combine must be associative, init
+// must be an identity of it, and folding a block onto an accumulator must
+// equal combining that accumulator with the block folded from init. For a
+// sum of squares, chunk is acc + x * x and combine is a + b. A number init
+// that combine does not keep is rejected.
+AkwValue akw_parallel_reduce(AkwParallel *par, AkwChunk *chunk,
+  AkwChunk *combine, AkwValue init, AkwValue input);
+
+#endif // AKW_PARALLEL_H
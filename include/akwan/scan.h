@@ -0,0 +1,23 @@
+//
+// scan.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_SCAN_H
+#define AKW_SCAN_H
+
+// Each function takes a NUL-terminated string and returns a pointer to the
+// first character that ends the run: anything other than a blank (newlines
+// excluded), anything that cannot be part of a name, the first '"' or NUL,
+// or the first newline or NUL.
+char *akw_scan_blanks(char *chars);
+char *akw_scan_name(char *chars);
+char *akw_scan_string(char *chars);
+char *akw_scan_line(char *chars);
+
+#endif // AKW_SCAN_H
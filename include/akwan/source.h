@@ -0,0 +1,39 @@
+//
+// source.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_SOURCE_H
+#define AKW_SOURCE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "buffer.h"
+
+// Source code ready for the lexer, always followed by a NUL. Regular files
+// are mapped read-only and lexed in place; anything else is read in large
+// blocks into a buffer. A source opened with akw_source_open is not read
+// up front when it cannot be mapped: chars is NULL, and the input is left
+// open for akw_source_read.
+typedef struct
+{
+  bool      isMapped;
+  size_t    length;
+  size_t    mapSize;
+  AkwBuffer buf;
+  char      *chars;
+  int       fd;
+  bool      ownsFd;
+} AkwSource;
+
+void akw_source_init(AkwSource *src, const char *path, int *rc);
+void akw_source_open(AkwSource *src, const char *path, int *rc);
+void akw_source_deinit(AkwSource *src);
+int akw_source_read(void *src, int size, char *chars);
+
+#endif // AKW_SOURCE_H
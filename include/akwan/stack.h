@@ -33,7 +33,8 @@
 
 #define akw_stack_deinit(stk) \
   do { \
-    akw_memory_dealloc((stk)->elements); \
+    size_t size = sizeof(*(stk)->elements) * (stk)->size; \
+    akw_memory_dealloc((stk)->elements, size); \
   } while (0)
 
 #define akw_stack_is_empty(stk) ((stk)->top < (stk)->elements)
@@ -0,0 +1,45 @@
+//
+// stream.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_STREAM_H
+#define AKW_STREAM_H
+
+#include "lexer.h"
+#include "thread.h"
+
+#define AKW_TOKEN_STREAM_DEFAULT_CAPACITY (1 << 14)
+
+// Tokens read ahead by a lexer thread into a ring, for a single consumer.
+// The lexer thread waits while the ring is full. A lexical error ends the
+// stream, and is reported by akw_token_stream_next once every token read
+// before it has been taken.
+typedef struct
+{
+  AkwLexer  lex;
+  int       rc;
+  AkwError  err;
+  int       capacity;
+  AkwToken  *tokens;
+  int       head;
+  int       tail;
+  int       isDone;
+  int       isCancelled;
+  int       readPos;
+  int       readLimit;
+  AkwThread thread;
+} AkwTokenStream;
+
+void akw_token_stream_init(AkwTokenStream *stream, char *source, int capacity,
+  int *rc);
+void akw_token_stream_deinit(AkwTokenStream *stream);
+void akw_token_stream_next(AkwTokenStream *stream, AkwToken *token, int *rc,
+  AkwError err);
+
+#endif // AKW_STREAM_H
@@ -28,7 +28,7 @@ typedef struct
   char      *chars;
 } AkwString;
 
-void akw_string_init(AkwString *str);
+void akw_string_init(AkwString *str, int *rc);
 void akw_string_init_with_capacity(AkwString *str, int capacity, int *rc);
 void akw_string_init_from(AkwString *str, int length, char *chars, int *rc);
 void akw_string_deinit(AkwString *str);
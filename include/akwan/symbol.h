@@ -0,0 +1,50 @@
+//
+// symbol.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_SYMBOL_H
+#define AKW_SYMBOL_H
+
+#include <stdint.h>
+#include "vector.h"
+
+#define akw_symbol_table_get(t, i) (&(t)->symbols.elements[(i)])
+
+typedef struct
+{
+  int      length;
+  char     *chars;
+  uint32_t hash;
+} AkwSymbol;
+
+// Characters of interned names, which never move once copied.
+typedef struct AkwSymbolBlock
+{
+  struct AkwSymbolBlock *next;
+  int                   size;
+  int                   used;
+} AkwSymbolBlock;
+
+// Interns names, giving each distinct name a small index. The characters
+// are copied, so the names may be freed once interned.
+typedef struct
+{
+  int                  capacity;
+  int                  *slots;
+  AkwVector(AkwSymbol) symbols;
+  AkwSymbolBlock       *blocks;
+} AkwSymbolTable;
+
+void akw_symbol_table_init(AkwSymbolTable *table);
+void akw_symbol_table_deinit(AkwSymbolTable *table);
+int akw_symbol_table_intern(AkwSymbolTable *table, int length, char *chars,
+  int *rc);
+int akw_symbol_table_find(AkwSymbolTable *table, int length, char *chars);
+
+#endif // AKW_SYMBOL_H
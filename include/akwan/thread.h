@@ -0,0 +1,69 @@
+//
+// thread.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_THREAD_H
+#define AKW_THREAD_H
+
+#ifdef _WIN32
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#else
+  #include <pthread.h>
+#endif
+
+typedef void (*AkwThreadFn)(void *);
+
+typedef struct
+{
+  AkwThreadFn fn;
+  void        *arg;
+#ifdef _WIN32
+  HANDLE      handle;
+#else
+  pthread_t   handle;
+#endif
+} AkwThread;
+
+typedef struct
+{
+#ifdef _WIN32
+  SRWLOCK         lock;
+#else
+  pthread_mutex_t lock;
+#endif
+} AkwMutex;
+
+typedef struct
+{
+#ifdef _WIN32
+  CONDITION_VARIABLE cond;
+#else
+  pthread_cond_t     cond;
+#endif
+} AkwCond;
+
+void akw_thread_start(AkwThread *thread, AkwThreadFn fn, void *arg, int *rc);
+void akw_thread_join(AkwThread *thread);
+int akw_thread_count_cores(void);
+int akw_thread_id(void);
+void akw_thread_yield(void);
+void akw_mutex_init(AkwMutex *mutex);
+void akw_mutex_deinit(AkwMutex *mutex);
+void akw_mutex_lock(AkwMutex *mutex);
+void akw_mutex_unlock(AkwMutex *mutex);
+void akw_cond_init(AkwCond *cond);
+void akw_cond_deinit(AkwCond *cond);
+void akw_cond_wait(AkwCond *cond, AkwMutex *mutex);
+void akw_cond_signal(AkwCond *cond);
+void akw_cond_broadcast(AkwCond *cond);
+
+#endif // AKW_THREAD_H
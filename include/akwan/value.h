@@ -12,10 +12,24 @@
 #define AKW_VALUE_H
 
 #include <stdbool.h>
+#include "atomic.h"
+#include "vector.h"
+
+#ifdef AKW_BIASED_RC
+  #include "thread.h"
+#endif
 
 #define AKW_FALG_FALSY  (1 << 0)
 #define AKW_FLAG_OBJECT (1 << 1)
 
+#define AKW_OBJECT_FLAG_ZERO_COUNT (1 << 0)
+#define AKW_OBJECT_FLAG_MARKED     (1 << 1)
+#define AKW_OBJECT_FLAG_IMMORTAL   (1 << 2)
+#define AKW_OBJECT_FLAG_FROZEN     (1 << 3)
+#define AKW_OBJECT_FLAG_REGION     (1 << 4)
+
+#define AKW_RELEASE_QUEUE_MIN_RECONCILE (1 << 10)
+
 #define AKW_NUMBER_EPSILON (1e-6)
 #define AKW_INT_MAX        (9007199254740992LL)
 #define AKW_INT_MIN        (-9007199254740992LL)
@@ -51,14 +65,54 @@
 #define akw_is_falsy(v)  ((v).flags & AKW_FALG_FALSY)
 #define akw_is_object(v) ((v).flags & AKW_FLAG_OBJECT)
 
+// In atomic mode every count update is atomic. In biased mode the thread
+// that created an object counts its own references with plain arithmetic,
+// and other threads use an atomic shared count. The owner merges the two
+// when its own count drops to zero.
+#if defined(AKW_ATOMIC_RC)
+  #define akw_object_init_count(o) \
+    do { \
+      (o)->refCount = 0; \
+    } while (0)
+  #define akw_object_incref(o)    ((void) akw_atomic_fetch_add(&(o)->refCount, 1))
+  #define akw_object_decref(o)    (akw_atomic_fetch_add(&(o)->refCount, -1) == 1)
+  #define akw_object_ref_count(o) (akw_atomic_load(&(o)->refCount))
+#elif defined(AKW_BIASED_RC)
+  #define akw_object_init_count(o) \
+    do { \
+      (o)->refCount = 0; \
+      (o)->ownerId = akw_thread_id(); \
+      (o)->sharedCount = 0; \
+    } while (0)
+  #define akw_object_incref(o)    akw_object_biased_incref(o)
+  #define akw_object_decref(o)    akw_object_biased_decref(o)
+  #define akw_object_ref_count(o) akw_object_biased_ref_count(o)
+#else
+  #define akw_object_init_count(o) \
+    do { \
+      (o)->refCount = 0; \
+    } while (0)
+  #define akw_object_incref(o)    ((void) ++(o)->refCount)
+  #define akw_object_decref(o)    (!--(o)->refCount)
+  #define akw_object_ref_count(o) ((o)->refCount)
+#endif
+
+// An object is charged to the stats current when it is created, and its
+// storage grows, shrinks and is freed against those same stats.
 #define akw_object_init(o) \
   do { \
-    (o)->refCount = 0; \
+    akw_object_init_count(o); \
+    (o)->flags = 0; \
+    (o)->stats = akw_memory_current_stats(); \
   } while (0);
 
+#define akw_object_is_immortal(o) ((o)->flags & AKW_OBJECT_FLAG_IMMORTAL)
+#define akw_object_is_frozen(o)   ((o)->flags & AKW_OBJECT_FLAG_FROZEN)
+
 #define akw_object_retain(o) \
   do { \
-    ++(o)->refCount; \
+    if (akw_object_is_immortal(o)) break; \
+    akw_object_incref(o); \
   } while (0);
 
 #define akw_value_retain(v) \
@@ -92,14 +146,53 @@ typedef struct
 
 typedef struct
 {
-  int refCount;
+  int            refCount;
+  int            flags;
+#ifdef AKW_BIASED_RC
+  int            ownerId;
+  int            sharedCount;
+#endif
+  AkwMemoryStats *stats;
 } AkwObject;
 
+typedef struct
+{
+  int                 budget;
+  bool                draining;
+  AkwVector(AkwValue) pending;
+#ifdef AKW_DEFERRED_RC
+  bool                isDeferred;
+  int                 reconcileAt;
+  AkwVector(AkwValue) zeroCount;
+#endif
+} AkwReleaseQueue;
+
+#ifdef AKW_BIASED_RC
+void akw_object_biased_incref(AkwObject *obj);
+bool akw_object_biased_decref(AkwObject *obj);
+int akw_object_biased_ref_count(AkwObject *obj);
+#endif
+const char *akw_type_name(AkwType type);
 const char *akw_value_type_name(AkwValue val);
 void akw_value_free(AkwValue val);
 void akw_value_release(AkwValue val);
+void akw_value_dispose(AkwValue val);
+AkwValue akw_value_copy(AkwValue val, int *rc);
+void akw_value_detach(AkwValue *val, int *rc);
+void akw_value_share(AkwValue val);
+void akw_value_transfer(AkwValue val, AkwMemoryStats *from, AkwMemoryStats *to,
+  int *rc);
+void akw_value_transfer_unshared(AkwValue val, AkwMemoryStats *to, int *rc);
 void akw_value_print(AkwValue val, bool quoted);
 bool akw_number_equal(double num1, double num2);
 int akw_number_compare(double num1, double num2);
+void akw_release_queue_init(AkwReleaseQueue *queue, int budget);
+void akw_release_queue_deinit(AkwReleaseQueue *queue);
+AkwReleaseQueue *akw_release_queue_swap(AkwReleaseQueue *queue);
+bool akw_release_queue_drain(AkwReleaseQueue *queue, int budget);
+#ifdef AKW_DEFERRED_RC
+void akw_release_queue_track(AkwReleaseQueue *queue, AkwValue val);
+void akw_release_queue_reconcile(AkwReleaseQueue *queue, int n, AkwValue *roots);
+#endif
 
 #endif // AKW_VALUE_H
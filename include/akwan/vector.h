@@ -21,17 +21,25 @@
     T   *elements; \
   }
 
+// The plain forms charge the current stats; the _in forms charge the given
+// ones, which may be NULL for memory that is not accounted.
 #define akw_vector_init(v) \
+  akw_vector_init_in((v), akw_memory_current_stats())
+
+#define akw_vector_init_in(v, s) \
   do { \
     int capacity = AKW_MIN_CAPACITY; \
     size_t size = sizeof(*(v)->elements) * capacity; \
-    void *elements = akw_memory_alloc(size); \
+    void *elements = akw_memory_alloc_in((s), size); \
     (v)->capacity = capacity; \
     (v)->count = 0; \
     (v)->elements = elements; \
   } while (0)
 
 #define akw_vector_init_with_capacity(v, c, rc) \
+  akw_vector_init_with_capacity_in((v), (c), akw_memory_current_stats(), (rc))
+
+#define akw_vector_init_with_capacity_in(v, c, s, rc) \
   do { \
     if ((c) > AKW_MAX_CAPACITY) { \
       *(rc) = AKW_RANGE_ERROR; \
@@ -41,18 +49,29 @@
     while (realCapacity < (c)) \
       realCapacity <<= 1; \
     size_t size = sizeof(*(v)->elements) * realCapacity; \
-    void *elements = akw_memory_alloc(size); \
+    void *elements = akw_memory_alloc_in((s), size); \
+    if (!elements) { \
+      *(rc) = AKW_RANGE_ERROR; \
+      break; \
+    } \
     (v)->capacity = realCapacity; \
     (v)->count = 0; \
     (v)->elements = elements; \
   } while (0)
 
 #define akw_vector_deinit(v) \
+  akw_vector_deinit_in((v), akw_memory_current_stats())
+
+#define akw_vector_deinit_in(v, s) \
   do { \
-    akw_memory_dealloc((v)->elements); \
+    size_t size = sizeof(*(v)->elements) * (v)->capacity; \
+    akw_memory_dealloc_in((s), (v)->elements, size); \
   } while (0)
 
 #define akw_vector_ensure_capacity(v, c, rc) \
+  akw_vector_ensure_capacity_in((v), (c), akw_memory_current_stats(), (rc))
+
+#define akw_vector_ensure_capacity_in(v, c, s, rc) \
   do { \
     if ((c) <= (v)->capacity) break; \
     if ((c) > AKW_MAX_CAPACITY) { \
@@ -62,8 +81,14 @@
     int newCapacity = (v)->capacity; \
     while (newCapacity < (c)) \
       newCapacity <<= 1; \
+    size_t size = sizeof(*(v)->elements) * (v)->capacity; \
     size_t newSize = sizeof(*(v)->elements) * newCapacity; \
-    void *newElements = akw_memory_realloc((v)->elements, newSize); \
+    void *newElements = akw_memory_realloc_in((s), (v)->elements, size, \
+      newSize); \
+    if (!newElements) { \
+      *(rc) = AKW_RANGE_ERROR; \
+      break; \
+    } \
     (v)->capacity = newCapacity; \
     (v)->elements = newElements; \
   } while (0)
@@ -73,8 +98,11 @@
 #define akw_vector_get(v, i) ((v)->elements[(i)])
 
 #define akw_vector_append(v, e, rc) \
+  akw_vector_append_in((v), (e), akw_memory_current_stats(), (rc))
+
+#define akw_vector_append_in(v, e, s, rc) \
   do { \
-    akw_vector_ensure_capacity((v), (v)->count + 1, (rc)); \
+    akw_vector_ensure_capacity_in((v), (v)->count + 1, (s), (rc)); \
     if (!akw_is_ok(*rc)) break; \
     (v)->elements[(v)->count] = (e); \
     ++(v)->count; \
@@ -13,6 +13,7 @@
 
 #include "chunk.h"
 #include "error.h"
+#include "memory.h"
 #include "stack.h"
 
 #define AKW_VM_DEFAULT_STACK_SIZE (1024)
@@ -23,11 +24,17 @@ typedef struct
 {
   int                rc;
   AkwError           err;
+  AkwMemoryStats     memStats;
+  AkwReleaseQueue    releaseQueue;
   AkwStack(AkwValue) stack;
 } AkwVM;
 
 void akw_vm_init(AkwVM *vm, int stackSize);
 void akw_vm_deinit(AkwVM *vm);
+void akw_vm_reset(AkwVM *vm);
+void akw_vm_set_memory_limit(AkwVM *vm, size_t limit, int *rc);
+void akw_vm_set_release_budget(AkwVM *vm, int budget);
+bool akw_vm_collect(AkwVM *vm, int budget);
 void akw_vm_run(AkwVM *vm, AkwChunk *chunk);
 void akw_vm_push(AkwVM *vm, AkwValue val);
 AkwValue akw_vm_peek(AkwVM *vm);
@@ -0,0 +1,44 @@
+//
+// writer.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef AKW_WRITER_H
+#define AKW_WRITER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include "buffer.h"
+#include "value.h"
+
+#define AKW_WRITER_FLUSH_SIZE (1 << 16)
+
+#define akw_writer_is_ok(w) (akw_is_ok((w)->rc))
+
+// Output gathered in a buffer and handed to the stream in blocks of up to
+// AKW_WRITER_FLUSH_SIZE bytes. The buffer is bookkeeping, not script memory,
+// so it is charged to no stats unless akw_writer_init_in is given some.
+// When it cannot grow, output goes straight to the stream, in order.
+typedef struct
+{
+  int            rc;
+  FILE           *stream;
+  AkwMemoryStats *memStats;
+  AkwBuffer      buf;
+} AkwWriter;
+
+void akw_writer_init(AkwWriter *w, FILE *stream);
+void akw_writer_init_in(AkwWriter *w, FILE *stream, AkwMemoryStats *stats);
+void akw_writer_deinit(AkwWriter *w);
+void akw_writer_flush(AkwWriter *w);
+void akw_writer_write(AkwWriter *w, int length, const char *chars);
+void akw_writer_write_int(AkwWriter *w, int64_t num);
+void akw_writer_write_number(AkwWriter *w, double num);
+void akw_writer_write_value(AkwWriter *w, AkwValue val, bool quoted);
+
+#endif // AKW_WRITER_H
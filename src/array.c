@@ -10,18 +10,17 @@
 
 #include "akwan/array.h"
 #include <assert.h>
-#include <stdio.h>
 
 void akw_array_init(AkwArray *arr)
 {
   akw_object_init(&arr->obj);
-  akw_vector_init(&arr->vec);
+  akw_vector_init_in(&arr->vec, arr->obj.stats);
 }
 
 void akw_array_init_with_capacity(AkwArray *arr, int capacity, int *rc)
 {
   akw_object_init(&arr->obj);
-  akw_vector_init_with_capacity(&arr->vec, capacity, rc);
+  akw_vector_init_with_capacity_in(&arr->vec, capacity, arr->obj.stats, rc);
 }
 
 void akw_array_deinit(AkwArray *arr)
@@ -32,69 +31,73 @@ void akw_array_deinit(AkwArray *arr)
     AkwValue val = akw_array_get(arr, i);
     akw_value_release(val);
   }
-  akw_vector_deinit(&arr->vec);
+  akw_vector_deinit_in(&arr->vec, arr->obj.stats);
 }
 
 AkwArray *akw_array_new(void)
 {
   AkwArray *arr = akw_memory_alloc(sizeof(*arr));
+  if (!arr) return NULL;
   akw_array_init(arr);
+  akw_memory_count_object(arr->obj.stats, AKW_TYPE_ARRAY, 1);
   return arr;
 }
 
 AkwArray *akw_array_new_with_capacity(int capacity, int *rc)
 {
   AkwArray *arr = akw_memory_alloc(sizeof(*arr));
+  if (!arr)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return NULL;
+  }
   akw_array_init_with_capacity(arr, capacity, rc);
   if (!akw_is_ok(*rc))
   {
-    akw_memory_dealloc(arr);
+    akw_memory_dealloc(arr, sizeof(*arr));
     return NULL;
   }
+  akw_memory_count_object(arr->obj.stats, AKW_TYPE_ARRAY, 1);
   return arr;
 }
 
 void akw_array_free(AkwArray *arr)
 {
+  AkwMemoryStats *stats = arr->obj.stats;
   akw_array_deinit(arr);
-  akw_memory_dealloc(arr);
+  akw_memory_dealloc_in(stats, arr, sizeof(*arr));
+  akw_memory_count_object(stats, AKW_TYPE_ARRAY, -1);
 }
 
 void akw_array_release(AkwArray *arr)
 {
   AkwObject *obj = &arr->obj;
-  --obj->refCount;
-  if (obj->refCount) return;
-  akw_array_free(arr);
+  if (akw_object_is_immortal(obj)) return;
+  if (!akw_object_decref(obj)) return;
+  akw_value_dispose(akw_array_value(arr));
 }
 
 void akw_array_ensure_capacity(AkwArray *arr, int capacity, int *rc)
 {
-  akw_vector_ensure_capacity(&arr->vec, capacity, rc);
+  akw_vector_ensure_capacity_in(&arr->vec, capacity, arr->obj.stats, rc);
 }
 
 void akw_array_print(AkwArray *arr)
 {
-  printf("[");
-  int n = akw_array_count(arr);
-  for (int i = 0; i < n; ++i)
-  {
-    AkwValue val = akw_array_get(arr, i);
-    akw_value_print(val, true);
-    if (i < n - 1) printf(", ");
-  }
-  printf("]");
+  akw_value_print(akw_array_value(arr), false);
 }
 
 void akw_array_inplace_append(AkwArray *arr, AkwValue elem, int *rc)
 {
-  akw_vector_append(&arr->vec, elem, rc);
+  assert(!akw_object_is_frozen(&arr->obj));
+  akw_vector_append_in(&arr->vec, elem, arr->obj.stats, rc);
   if (!akw_is_ok(*rc)) return;
   akw_value_retain(elem);
 }
 
 void akw_array_inplace_set(AkwArray *arr, int index, AkwValue elem)
 {
+  assert(!akw_object_is_frozen(&arr->obj));
   akw_value_retain(elem);
   akw_value_release(akw_array_get(arr, index));
   akw_vector_set(&arr->vec, index, elem);
@@ -102,6 +105,7 @@ void akw_array_inplace_set(AkwArray *arr, int index, AkwValue elem)
 
 void akw_array_inplace_remove_at(AkwArray *arr, int index)
 {
+  assert(!akw_object_is_frozen(&arr->obj));
   AkwValue val = akw_array_get(arr, index);
   akw_vector_remove_at(&arr->vec, index);
   akw_value_release(val);
@@ -109,10 +113,11 @@ void akw_array_inplace_remove_at(AkwArray *arr, int index)
 
 void akw_array_inplace_concat(AkwArray *arr, AkwArray *other, int *rc)
 {
+  assert(!akw_object_is_frozen(&arr->obj));
   if (akw_array_is_empty(other)) return;
   int n = akw_array_count(arr);
   int m = akw_array_count(other);
-  akw_vector_ensure_capacity(&arr->vec, n + m, rc);
+  akw_vector_ensure_capacity_in(&arr->vec, n + m, arr->obj.stats, rc);
   if (!akw_is_ok(*rc)) return;
   for (int i = 0; i < m; ++i)
   {
@@ -124,6 +129,7 @@ void akw_array_inplace_concat(AkwArray *arr, AkwArray *other, int *rc)
 
 void akw_array_clear(AkwArray *arr)
 {
+  assert(!akw_object_is_frozen(&arr->obj));
   int n = akw_array_count(arr);
   for (int i = 0; i < n; ++i)
   {
@@ -0,0 +1,273 @@
+//
+// batch.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/batch.h"
+#include <string.h>
+#include "akwan/compiler.h"
+#include "akwan/memory.h"
+#include "akwan/source.h"
+#include "akwan/thread.h"
+#include "akwan/vm.h"
+
+// Each worker owns a contiguous run of job indices [head, tail). The owner
+// takes jobs from the head and thieves take them from the tail, so both ends
+// only meet when the run is almost drained.
+typedef struct
+{
+  AkwMutex mutex;
+  int      head;
+  int      tail;
+} Deque;
+
+typedef struct Worker
+{
+  struct Batch        *batch;
+  int                 id;
+  Deque               deque;
+  AkwThread           thread;
+  AkwBatchWorkerStats stats;
+} Worker;
+
+typedef struct Batch
+{
+  AkwBatchOptions *opts;
+  AkwBatchJob     *jobs;
+  int             numWorkers;
+  Worker          *workers;
+} Batch;
+
+static inline bool take(Worker *worker, int *index);
+static inline bool steal(Worker *worker, int *index);
+static inline void run_chunk(AkwBatchOptions *opts, AkwVM *vm,
+  AkwBatchJob *job, AkwChunk *chunk);
+static inline void run_source(AkwBatchOptions *opts, AkwVM *vm,
+  AkwBatchJob *job, AkwSource *src);
+static inline void run_job(AkwBatchOptions *opts, AkwVM *vm, AkwBatchJob *job);
+static void worker_main(void *arg);
+
+static inline bool take(Worker *worker, int *index)
+{
+  Deque *deque = &worker->deque;
+  akw_mutex_lock(&deque->mutex);
+  bool found = deque->head < deque->tail;
+  if (found)
+    *index = deque->head++;
+  akw_mutex_unlock(&deque->mutex);
+  return found;
+}
+
+static inline bool steal(Worker *worker, int *index)
+{
+  Batch *batch = worker->batch;
+  int n = batch->numWorkers;
+  for (int i = 1; i < n; ++i)
+  {
+    Deque *deque = &batch->workers[(worker->id + i) % n].deque;
+    akw_mutex_lock(&deque->mutex);
+    bool found = deque->head < deque->tail;
+    if (found)
+      *index = --deque->tail;
+    akw_mutex_unlock(&deque->mutex);
+    if (found) return true;
+  }
+  return false;
+}
+
+static inline void run_chunk(AkwBatchOptions *opts, AkwVM *vm,
+  AkwBatchJob *job, AkwChunk *chunk)
+{
+  akw_vm_run(vm, chunk);
+  if (!akw_vm_is_ok(vm))
+  {
+    job->rc = vm->rc;
+    memcpy(job->err, vm->err, sizeof(job->err));
+  }
+  else if (opts->onResult)
+    opts->onResult(job, akw_vm_peek(vm), opts->userData);
+  akw_vm_reset(vm);
+}
+
+static inline void run_source(AkwBatchOptions *opts, AkwVM *vm,
+  AkwBatchJob *job, AkwSource *src)
+{
+  if (opts->cache && !opts->checkOnly)
+  {
+    AkwCacheEntry *entry = akw_cache_compile(opts->cache, 0, job->source,
+      job->err, &job->rc);
+    if (!entry) return;
+    run_chunk(opts, vm, job, &entry->image.chunk);
+    akw_cache_release(opts->cache, entry);
+    return;
+  }
+  AkwCompiler comp;
+  int flags = opts->checkOnly ? AKW_COMPILER_FLAG_CHECK_ONLY : 0;
+  if (job->source)
+    akw_compiler_init(&comp, flags, job->source);
+  else
+    akw_compiler_init_stream(&comp, flags, akw_source_read, src);
+  if (akw_compiler_is_ok(&comp))
+    akw_compiler_compile(&comp);
+  if (!akw_compiler_is_ok(&comp))
+  {
+    job->rc = comp.rc;
+    memcpy(job->err, comp.err, sizeof(job->err));
+    akw_compiler_deinit(&comp);
+    return;
+  }
+  if (!opts->checkOnly)
+    run_chunk(opts, vm, job, &comp.chunk);
+  akw_compiler_deinit(&comp);
+}
+
+static inline void run_job(AkwBatchOptions *opts, AkwVM *vm, AkwBatchJob *job)
+{
+  if (!akw_is_ok(job->rc)) return;
+  if (!job->path)
+  {
+    run_source(opts, vm, job, NULL);
+    return;
+  }
+  // The cache needs the whole source, otherwise one that cannot be mapped
+  // is compiled as it is read.
+  AkwSource src;
+  if (opts->cache && !opts->checkOnly)
+    akw_source_init(&src, job->path, &job->rc);
+  else
+    akw_source_open(&src, job->path, &job->rc);
+  if (!akw_is_ok(job->rc))
+  {
+    akw_error_set(job->err, job->rc == AKW_RANGE_ERROR ? "source code too large"
+      : "cannot read file");
+    return;
+  }
+  job->source = src.chars;
+  run_source(opts, vm, job, &src);
+  job->source = NULL;
+  akw_source_deinit(&src);
+}
+
+static void worker_main(void *arg)
+{
+  Worker *worker = arg;
+  Batch *batch = worker->batch;
+  AkwBatchOptions *opts = batch->opts;
+  // Nothing is run when only checking.
+  AkwVM vm;
+  int rc = AKW_OK;
+  if (!opts->checkOnly)
+  {
+    akw_vm_init(&vm, opts->stackSize);
+    akw_vm_set_memory_limit(&vm, opts->memLimit, &rc);
+  }
+  for (;;)
+  {
+    int index;
+    if (take(worker, &index))
+      ++worker->stats.numJobs;
+    else if (steal(worker, &index))
+    {
+      ++worker->stats.numJobs;
+      ++worker->stats.numStolen;
+    }
+    else
+      break;
+    AkwBatchJob *job = &batch->jobs[index];
+    job->worker = worker->id;
+    if (!akw_is_ok(rc))
+    {
+      job->rc = rc;
+      akw_error_set(job->err, "memory limit below the %zu byte(s) the VM needs",
+        vm.memStats.bytes);
+      continue;
+    }
+    run_job(opts, &vm, job);
+  }
+  if (!opts->checkOnly)
+    akw_vm_deinit(&vm);
+}
+
+void akw_batch_options_init(AkwBatchOptions *opts)
+{
+  opts->checkOnly = false;
+  opts->numWorkers = akw_thread_count_cores();
+  opts->stackSize = AKW_VM_DEFAULT_STACK_SIZE;
+  opts->memLimit = 0;
+  opts->cache = NULL;
+  opts->onResult = NULL;
+  opts->userData = NULL;
+}
+
+void akw_batch_job_init(AkwBatchJob *job, int index, char *source)
+{
+  job->index = index;
+  job->path = NULL;
+  job->source = source;
+  job->rc = AKW_OK;
+  job->err[0] = '\0';
+  job->worker = -1;
+}
+
+void akw_batch_job_init_file(AkwBatchJob *job, int index, const char *path)
+{
+  akw_batch_job_init(job, index, NULL);
+  job->path = path;
+}
+
+void akw_batch_run(AkwBatchOptions *opts, int numJobs, AkwBatchJob *jobs,
+  AkwBatchWorkerStats *stats, int *rc)
+{
+  int numWorkers = opts->numWorkers;
+  if (numWorkers < 1) numWorkers = 1;
+  if (numWorkers > numJobs) numWorkers = numJobs;
+  if (!numWorkers) return;
+  size_t size = sizeof(Worker) * numWorkers;
+  Worker *workers = akw_memory_alloc(size);
+  if (!workers)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  Batch batch = {
+    .opts = opts,
+    .jobs = jobs,
+    .numWorkers = numWorkers,
+    .workers = workers
+  };
+  for (int i = 0; i < numWorkers; ++i)
+  {
+    Worker *worker = &workers[i];
+    worker->batch = &batch;
+    worker->id = i;
+    akw_mutex_init(&worker->deque.mutex);
+    worker->deque.head = (int) ((long long) numJobs * i / numWorkers);
+    worker->deque.tail = (int) ((long long) numJobs * (i + 1) / numWorkers);
+    worker->stats.numJobs = 0;
+    worker->stats.numStolen = 0;
+  }
+  int numStarted = 0;
+  for (; numStarted < numWorkers; ++numStarted)
+  {
+    akw_thread_start(&workers[numStarted].thread, worker_main,
+      &workers[numStarted], rc);
+    if (!akw_is_ok(*rc)) break;
+  }
+  // Workers that did start steal the jobs of those that did not.
+  for (int i = 0; i < numStarted; ++i)
+    akw_thread_join(&workers[i].thread);
+  if (numStarted)
+    *rc = AKW_OK;
+  for (int i = 0; i < numWorkers; ++i)
+  {
+    if (stats)
+      stats[i] = workers[i].stats;
+    akw_mutex_deinit(&workers[i].deque.mutex);
+  }
+  akw_memory_dealloc(workers, size);
+}
@@ -14,9 +14,14 @@
 #include "akwan/memory.h"
 
 void akw_buffer_init(AkwBuffer *buf)
+{
+  akw_buffer_init_in(buf, akw_memory_current_stats());
+}
+
+void akw_buffer_init_in(AkwBuffer *buf, AkwMemoryStats *stats)
 {
   int capacity = AKW_MIN_CAPACITY;
-  uint8_t *bytes = akw_memory_alloc(capacity);
+  uint8_t *bytes = akw_memory_alloc_in(stats, capacity);
   buf->capacity = capacity;
   buf->count = 0;
   buf->bytes = bytes;
@@ -33,6 +38,11 @@ void akw_buffer_init_with_capacity(AkwBuffer *buf, int capacity, int *rc)
   while (realCapacity < capacity)
     realCapacity <<= 1;
   uint8_t *bytes = akw_memory_alloc(realCapacity);
+  if (!bytes)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
   buf->capacity = realCapacity;
   buf->count = 0;
   buf->bytes = bytes;
@@ -40,10 +50,21 @@ void akw_buffer_init_with_capacity(AkwBuffer *buf, int capacity, int *rc)
 
 void akw_buffer_deinit(AkwBuffer *buf)
 {
-  akw_memory_dealloc(buf->bytes);
+  akw_buffer_deinit_in(buf, akw_memory_current_stats());
+}
+
+void akw_buffer_deinit_in(AkwBuffer *buf, AkwMemoryStats *stats)
+{
+  akw_memory_dealloc_in(stats, buf->bytes, buf->capacity);
 }
 
 void akw_buffer_ensure_capacity(AkwBuffer *buf, int capacity, int *rc)
+{
+  akw_buffer_ensure_capacity_in(buf, capacity, akw_memory_current_stats(), rc);
+}
+
+void akw_buffer_ensure_capacity_in(AkwBuffer *buf, int capacity,
+  AkwMemoryStats *stats, int *rc)
 {
   if (capacity <= buf->capacity) return;
   if (capacity > AKW_MAX_CAPACITY)
@@ -54,7 +75,13 @@ void akw_buffer_ensure_capacity(AkwBuffer *buf, int capacity, int *rc)
   int newCapacity = buf->capacity;
   while (newCapacity < capacity)
     newCapacity <<= 1;
-  uint8_t *newBytes = akw_memory_realloc(buf->bytes, newCapacity);
+  uint8_t *newBytes = akw_memory_realloc_in(stats, buf->bytes, buf->capacity,
+    newCapacity);
+  if (!newBytes)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
   buf->capacity = newCapacity;
   buf->bytes = newBytes;
 }
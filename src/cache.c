@@ -0,0 +1,613 @@
+//
+// cache.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/cache.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "akwan/compiler.h"
+#include "akwan/memory.h"
+
+#ifdef _WIN32
+  #include <direct.h>
+  #include <process.h>
+  #include <sys/utime.h>
+#else
+  #include <dirent.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+  #include <utime.h>
+#endif
+
+#define MAGIC     "AKWC"
+#define EXTENSION ".akwc"
+
+#define MAX_PATH_LENGTH (1 << 10)
+
+#define FNV_OFFSET (0xcbf29ce484222325ULL)
+#define FNV_PRIME  (0x100000001b3ULL)
+
+// Each file in the directory is a header followed by an image and then the
+// source it was compiled from. The key only picks the file: a hit needs the
+// same source, so keys that collide never run the wrong program. The
+// checksum catches files that were truncated or damaged after being written.
+typedef struct
+{
+  char     magic[4];
+  uint32_t version;
+  uint64_t key;
+  uint64_t sourceLength;
+  uint64_t checksum;
+} Header;
+
+typedef struct
+{
+  char      name[32];
+  size_t    size;
+  long long time;
+} FileInfo;
+
+typedef AkwVector(FileInfo) FileVector;
+
+static inline uint64_t hash_bytes(uint64_t hash, size_t size, const void *ptr);
+static inline uint64_t make_key(int flags, const char *source, size_t length);
+static inline void entry_path(AkwCache *cache, uint64_t key, char *path);
+static inline AkwCacheEntry *entry_new(uint64_t key, size_t sourceLength,
+  AkwBuffer *buf, int offset);
+static inline void entry_free(AkwCacheEntry *entry);
+static inline AkwCacheEntry *find(AkwCache *cache, uint64_t key,
+  const char *source, size_t sourceLength);
+static inline void insert(AkwCache *cache, AkwCacheEntry *entry, int *rc);
+static inline void remove_entry(AkwCache *cache, AkwCacheEntry *entry);
+static inline void unlink_entry(AkwCache *cache, AkwCacheEntry *entry);
+static inline void push_front(AkwCache *cache, AkwCacheEntry *entry);
+static inline void evict(AkwCache *cache);
+static inline AkwCacheEntry *load_file(AkwCache *cache, uint64_t key,
+  const char *source, size_t sourceLength);
+static inline AkwCacheEntry *compile(int flags, char *source, uint64_t key,
+  size_t sourceLength, AkwError err, int *rc);
+static inline void store_file(AkwCache *cache, AkwCacheEntry *entry);
+static inline void list_files(AkwCache *cache, FileVector *files, int *rc);
+static inline int compare_files(const void *a, const void *b);
+static inline void trim_dir(AkwCache *cache);
+
+static inline uint64_t hash_bytes(uint64_t hash, size_t size, const void *ptr)
+{
+  const uint8_t *bytes = ptr;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= bytes[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static inline uint64_t make_key(int flags, const char *source, size_t length)
+{
+  // Pipelining does not change the generated code.
+  uint32_t versions[] = {
+    AKW_COMPILER_VERSION,
+    AKW_IMAGE_VERSION,
+    (uint32_t) (flags & ~AKW_COMPILER_FLAG_PIPELINED)
+  };
+  uint64_t hash = hash_bytes(FNV_OFFSET, length, source);
+  return hash_bytes(hash, sizeof(versions), versions);
+}
+
+static inline void entry_path(AkwCache *cache, uint64_t key, char *path)
+{
+  snprintf(path, MAX_PATH_LENGTH, "%s/%016llx" EXTENSION, cache->dir,
+    (unsigned long long) key);
+}
+
+static inline AkwCacheEntry *entry_new(uint64_t key, size_t sourceLength,
+  AkwBuffer *buf, int offset)
+{
+  // Takes over buf, whose bytes from offset on hold the image followed by
+  // the source.
+  size_t imageSize = (size_t) (buf->count - offset) - sourceLength;
+  AkwCacheEntry *entry = akw_memory_alloc(sizeof(*entry));
+  if (!entry) return NULL;
+  entry->prev = NULL;
+  entry->next = NULL;
+  entry->chain = NULL;
+  entry->key = key;
+  entry->source = (char *) &buf->bytes[offset] + imageSize;
+  entry->sourceLength = sourceLength;
+  entry->refCount = 0;
+  entry->isEvicted = false;
+  entry->buf = *buf;
+  akw_image_init_from_bytes(&entry->image, imageSize, &buf->bytes[offset]);
+  if (!akw_image_is_ok(&entry->image))
+  {
+    akw_memory_dealloc(entry, sizeof(*entry));
+    return NULL;
+  }
+  AkwImage *img = &entry->image;
+  entry->size = sizeof(*entry) + (size_t) buf->capacity
+    + sizeof(AkwValue) * (size_t) img->chunk.consts.capacity
+    + sizeof(AkwString) * (size_t) img->numStrings;
+  return entry;
+}
+
+static inline void entry_free(AkwCacheEntry *entry)
+{
+  akw_image_deinit(&entry->image);
+  akw_buffer_deinit(&entry->buf);
+  akw_memory_dealloc(entry, sizeof(*entry));
+}
+
+static inline AkwCacheEntry *find(AkwCache *cache, uint64_t key,
+  const char *source, size_t sourceLength)
+{
+  int index = (int) (key & (uint64_t) (cache->capacity - 1));
+  AkwCacheEntry *entry = cache->buckets[index];
+  while (entry && (entry->key != key || entry->sourceLength != sourceLength
+   || memcmp(entry->source, source, sourceLength)))
+    entry = entry->chain;
+  return entry;
+}
+
+static inline void insert(AkwCache *cache, AkwCacheEntry *entry, int *rc)
+{
+  if (cache->count + 1 > cache->capacity)
+  {
+    int capacity = cache->capacity << 1;
+    AkwCacheEntry **buckets = akw_memory_alloc(sizeof(*buckets) * capacity);
+    if (!buckets)
+    {
+      *rc = AKW_RANGE_ERROR;
+      return;
+    }
+    memset(buckets, 0, sizeof(*buckets) * capacity);
+    for (AkwCacheEntry *e = cache->head; e; e = e->next)
+    {
+      int index = (int) (e->key & (uint64_t) (capacity - 1));
+      e->chain = buckets[index];
+      buckets[index] = e;
+    }
+    akw_memory_dealloc(cache->buckets, sizeof(*buckets) * cache->capacity);
+    cache->capacity = capacity;
+    cache->buckets = buckets;
+  }
+  int index = (int) (entry->key & (uint64_t) (cache->capacity - 1));
+  entry->chain = cache->buckets[index];
+  cache->buckets[index] = entry;
+  ++cache->count;
+  push_front(cache, entry);
+  cache->bytes += entry->size;
+}
+
+static inline void remove_entry(AkwCache *cache, AkwCacheEntry *entry)
+{
+  int index = (int) (entry->key & (uint64_t) (cache->capacity - 1));
+  AkwCacheEntry **link = &cache->buckets[index];
+  while (*link != entry)
+    link = &(*link)->chain;
+  *link = entry->chain;
+  --cache->count;
+  unlink_entry(cache, entry);
+  cache->bytes -= entry->size;
+}
+
+static inline void unlink_entry(AkwCache *cache, AkwCacheEntry *entry)
+{
+  if (entry->prev)
+    entry->prev->next = entry->next;
+  else
+    cache->head = entry->next;
+  if (entry->next)
+    entry->next->prev = entry->prev;
+  else
+    cache->tail = entry->prev;
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static inline void push_front(AkwCache *cache, AkwCacheEntry *entry)
+{
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if (cache->head)
+    cache->head->prev = entry;
+  else
+    cache->tail = entry;
+  cache->head = entry;
+}
+
+static inline void evict(AkwCache *cache)
+{
+  // The most recently used entry is always kept, even when it alone is over
+  // the limit. Entries still in use are freed when released.
+  while (cache->bytes > cache->memLimit && cache->tail != cache->head)
+  {
+    AkwCacheEntry *entry = cache->tail;
+    remove_entry(cache, entry);
+    ++cache->stats.evictions;
+    if (entry->refCount)
+    {
+      entry->isEvicted = true;
+      continue;
+    }
+    entry_free(entry);
+  }
+}
+
+static inline AkwCacheEntry *load_file(AkwCache *cache, uint64_t key,
+  const char *source, size_t sourceLength)
+{
+  char path[MAX_PATH_LENGTH];
+  entry_path(cache, key, path);
+  FILE *file = fopen(path, "rb");
+  if (!file) return NULL;
+  int rc = AKW_OK;
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  char chunk[1 << 14];
+  size_t n;
+  while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+  {
+    akw_buffer_write(&buf, (int) n, chunk, &rc);
+    if (!akw_is_ok(rc)) break;
+  }
+  bool failed = !akw_is_ok(rc) || ferror(file);
+  fclose(file);
+  Header header;
+  int offset = (int) sizeof(header);
+  if (!failed && buf.count >= offset)
+  {
+    memcpy(&header, buf.bytes, sizeof(header));
+    uint64_t checksum = hash_bytes(FNV_OFFSET, (size_t) (buf.count - offset),
+      &buf.bytes[offset]);
+    failed = memcmp(header.magic, MAGIC, 4)
+      || header.version != AKW_IMAGE_VERSION
+      || header.key != key
+      || header.sourceLength != sourceLength
+      || header.checksum != checksum
+      || (size_t) (buf.count - offset) <= sourceLength
+      || memcmp(&buf.bytes[buf.count - (int) sourceLength], source,
+        sourceLength);
+  }
+  else
+    failed = true;
+  AkwCacheEntry *entry = failed ? NULL
+    : entry_new(key, sourceLength, &buf, offset);
+  if (entry)
+  {
+#ifdef _WIN32
+    _utime(path, NULL);
+#else
+    utime(path, NULL);
+#endif
+    return entry;
+  }
+  // A damaged entry, or one for another source, is dropped, so that it is
+  // rewritten after compiling.
+  akw_buffer_deinit(&buf);
+  remove(path);
+  return NULL;
+}
+
+static inline AkwCacheEntry *compile(int flags, char *source, uint64_t key,
+  size_t sourceLength, AkwError err, int *rc)
+{
+  AkwCompiler comp;
+  akw_compiler_init(&comp, flags, source);
+  if (akw_compiler_is_ok(&comp))
+    akw_compiler_compile(&comp);
+  if (!akw_compiler_is_ok(&comp))
+  {
+    *rc = comp.rc;
+    memcpy(err, comp.err, sizeof(AkwError));
+    akw_compiler_deinit(&comp);
+    return NULL;
+  }
+  // The image and the source are written after room for the file header,
+  // so the same bytes can be stored as they are.
+  Header header = { 0 };
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  akw_buffer_write(&buf, sizeof(header), &header, rc);
+  if (akw_is_ok(*rc))
+    akw_image_write(&comp.chunk, &buf, rc);
+  if (akw_is_ok(*rc) && sourceLength > AKW_MAX_CAPACITY)
+    *rc = AKW_RANGE_ERROR;
+  if (akw_is_ok(*rc))
+    akw_buffer_write(&buf, (int) sourceLength, source, rc);
+  akw_compiler_deinit(&comp);
+  AkwCacheEntry *entry = akw_is_ok(*rc)
+    ? entry_new(key, sourceLength, &buf, (int) sizeof(header)) : NULL;
+  if (entry) return entry;
+  akw_buffer_deinit(&buf);
+  *rc = AKW_RANGE_ERROR;
+  akw_error_set(err, "out of memory");
+  return NULL;
+}
+
+static inline void store_file(AkwCache *cache, AkwCacheEntry *entry)
+{
+  // Files are written under a temporary name and renamed into place, so
+  // readers in other processes never see a partial entry. Failing to store
+  // an entry only costs a compile later, so errors are not reported.
+  char path[MAX_PATH_LENGTH];
+  char tmpPath[MAX_PATH_LENGTH + 32];
+  entry_path(cache, entry->key, path);
+#ifdef _WIN32
+  int pid = _getpid();
+#else
+  int pid = (int) getpid();
+#endif
+  snprintf(tmpPath, sizeof(tmpPath), "%s.%d.%d.tmp", path, pid,
+    akw_thread_id());
+  AkwBuffer *buf = &entry->buf;
+  int offset = (int) sizeof(Header);
+  Header header = {
+    .magic = { 'A', 'K', 'W', 'C' },
+    .version = AKW_IMAGE_VERSION,
+    .key = entry->key,
+    .sourceLength = entry->sourceLength,
+    .checksum = hash_bytes(FNV_OFFSET, (size_t) (buf->count - offset),
+      &buf->bytes[offset])
+  };
+  memcpy(buf->bytes, &header, sizeof(header));
+  FILE *file = fopen(tmpPath, "wb");
+  if (!file) return;
+  size_t size = (size_t) buf->count;
+  bool failed = fwrite(buf->bytes, 1, size, file) != size;
+  failed = fclose(file) || failed;
+#ifdef _WIN32
+  failed = failed || !MoveFileExA(tmpPath, path, MOVEFILE_REPLACE_EXISTING);
+#else
+  failed = failed || rename(tmpPath, path);
+#endif
+  if (failed)
+  {
+    remove(tmpPath);
+    return;
+  }
+  trim_dir(cache);
+}
+
+#ifdef _WIN32
+static inline void list_files(AkwCache *cache, FileVector *files, int *rc)
+{
+  char pattern[MAX_PATH_LENGTH];
+  snprintf(pattern, sizeof(pattern), "%s/*" EXTENSION, cache->dir);
+  WIN32_FIND_DATAA data;
+  HANDLE handle = FindFirstFileA(pattern, &data);
+  if (handle == INVALID_HANDLE_VALUE) return;
+  do
+  {
+    FileInfo info;
+    if (strlen(data.cFileName) >= sizeof(info.name)) continue;
+    memcpy(info.name, data.cFileName, strlen(data.cFileName) + 1);
+    info.size = (size_t) (((uint64_t) data.nFileSizeHigh << 32)
+      | data.nFileSizeLow);
+    info.time = (long long) (((uint64_t) data.ftLastWriteTime.dwHighDateTime << 32)
+      | data.ftLastWriteTime.dwLowDateTime);
+    akw_vector_append(files, info, rc);
+  }
+  while (akw_is_ok(*rc) && FindNextFileA(handle, &data));
+  FindClose(handle);
+}
+#else
+static inline void list_files(AkwCache *cache, FileVector *files, int *rc)
+{
+  DIR *dir = opendir(cache->dir);
+  if (!dir) return;
+  struct dirent *ent;
+  while (akw_is_ok(*rc) && (ent = readdir(dir)))
+  {
+    FileInfo info;
+    size_t length = strlen(ent->d_name);
+    size_t extLength = sizeof(EXTENSION) - 1;
+    if (length >= sizeof(info.name) || length <= extLength
+     || strcmp(&ent->d_name[length - extLength], EXTENSION))
+      continue;
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+    struct stat st;
+    if (stat(path, &st) == -1) continue;
+    memcpy(info.name, ent->d_name, length + 1);
+    info.size = (size_t) st.st_size;
+    info.time = (long long) st.st_mtime;
+    akw_vector_append(files, info, rc);
+  }
+  closedir(dir);
+}
+#endif
+
+static inline int compare_files(const void *a, const void *b)
+{
+  const FileInfo *info1 = a;
+  const FileInfo *info2 = b;
+  return (info1->time > info2->time) - (info1->time < info2->time);
+}
+
+static inline void trim_dir(AkwCache *cache)
+{
+  // Entries are read back with their modification time refreshed, so the
+  // oldest files are the least recently used ones.
+  int rc = AKW_OK;
+  FileVector files;
+  akw_vector_init(&files);
+  list_files(cache, &files, &rc);
+  size_t total = 0;
+  for (int i = 0; i < files.count; ++i)
+    total += akw_vector_get(&files, i).size;
+  if (total > cache->diskLimit)
+    qsort(files.elements, (size_t) files.count, sizeof(FileInfo),
+      compare_files);
+  for (int i = 0; i < files.count && total > cache->diskLimit; ++i)
+  {
+    FileInfo info = akw_vector_get(&files, i);
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", cache->dir, info.name);
+    if (remove(path)) continue;
+    total -= info.size;
+    akw_mutex_lock(&cache->mutex);
+    ++cache->stats.diskEvictions;
+    akw_mutex_unlock(&cache->mutex);
+  }
+  akw_vector_deinit(&files);
+}
+
+void akw_cache_init(AkwCache *cache, const char *dir, int *rc)
+{
+  // A NULL dir keeps the cache in memory only.
+  cache->dir = NULL;
+  if (dir)
+  {
+    size_t length = strlen(dir);
+    if (length + 32 >= MAX_PATH_LENGTH)
+    {
+      *rc = AKW_RANGE_ERROR;
+      return;
+    }
+    cache->dir = akw_memory_alloc(length + 1);
+    if (!cache->dir)
+    {
+      *rc = AKW_RANGE_ERROR;
+      return;
+    }
+    memcpy(cache->dir, dir, length + 1);
+#ifdef _WIN32
+    _mkdir(dir);
+#else
+    mkdir(dir, 0755);
+#endif
+  }
+  int capacity = AKW_MIN_CAPACITY;
+  cache->buckets = akw_memory_alloc(sizeof(*cache->buckets) * capacity);
+  if (!cache->buckets)
+  {
+    if (dir) akw_memory_dealloc(cache->dir, strlen(dir) + 1);
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  memset(cache->buckets, 0, sizeof(*cache->buckets) * capacity);
+  cache->memLimit = AKW_CACHE_DEFAULT_MEMORY_LIMIT;
+  cache->diskLimit = AKW_CACHE_DEFAULT_DISK_LIMIT;
+  cache->bytes = 0;
+  cache->capacity = capacity;
+  cache->count = 0;
+  cache->head = NULL;
+  cache->tail = NULL;
+  akw_mutex_init(&cache->mutex);
+  memset(&cache->stats, 0, sizeof(cache->stats));
+}
+
+void akw_cache_deinit(AkwCache *cache)
+{
+  // Every entry must have been released.
+  AkwCacheEntry *entry = cache->head;
+  while (entry)
+  {
+    AkwCacheEntry *next = entry->next;
+    assert(!entry->refCount);
+    entry_free(entry);
+    entry = next;
+  }
+  akw_memory_dealloc(cache->buckets, sizeof(*cache->buckets) * cache->capacity);
+  if (cache->dir)
+    akw_memory_dealloc(cache->dir, strlen(cache->dir) + 1);
+  akw_mutex_deinit(&cache->mutex);
+}
+
+AkwCacheEntry *akw_cache_compile(AkwCache *cache, int flags, char *source,
+  AkwError err, int *rc)
+{
+  // Returns an entry whose image.chunk can be run until the entry is
+  // released. Compile errors are reported through err and never cached.
+  assert(!(flags & AKW_COMPILER_FLAG_CHECK_ONLY));
+  size_t sourceLength = strlen(source);
+  uint64_t key = make_key(flags, source, sourceLength);
+  akw_mutex_lock(&cache->mutex);
+  AkwCacheEntry *entry = find(cache, key, source, sourceLength);
+  if (entry)
+  {
+    ++cache->stats.hits;
+    ++entry->refCount;
+    unlink_entry(cache, entry);
+    push_front(cache, entry);
+    akw_mutex_unlock(&cache->mutex);
+    return entry;
+  }
+  akw_mutex_unlock(&cache->mutex);
+  // Entries are loaded or compiled without holding the lock, and are not
+  // accounted to whatever VM the calling thread runs.
+  AkwMemoryStats *stats = akw_memory_swap_stats(NULL);
+  entry = cache->dir ? load_file(cache, key, source, sourceLength) : NULL;
+  bool isLoaded = entry != NULL;
+  if (!entry)
+  {
+    entry = compile(flags, source, key, sourceLength, err, rc);
+    if (entry && cache->dir)
+      store_file(cache, entry);
+  }
+  if (!entry)
+  {
+    akw_mutex_lock(&cache->mutex);
+    ++cache->stats.misses;
+    akw_mutex_unlock(&cache->mutex);
+    akw_memory_swap_stats(stats);
+    return NULL;
+  }
+  akw_mutex_lock(&cache->mutex);
+  if (isLoaded)
+    ++cache->stats.diskHits;
+  else
+    ++cache->stats.misses;
+  AkwCacheEntry *other = find(cache, key, source, sourceLength);
+  if (other)
+  {
+    // Another thread got here first; its entry is used and ours dropped.
+    entry_free(entry);
+    entry = other;
+    unlink_entry(cache, entry);
+    push_front(cache, entry);
+  }
+  else
+  {
+    insert(cache, entry, rc);
+    if (!akw_is_ok(*rc))
+    {
+      akw_mutex_unlock(&cache->mutex);
+      entry_free(entry);
+      akw_memory_swap_stats(stats);
+      akw_error_set(err, "out of memory");
+      return NULL;
+    }
+    evict(cache);
+  }
+  ++entry->refCount;
+  akw_mutex_unlock(&cache->mutex);
+  akw_memory_swap_stats(stats);
+  return entry;
+}
+
+void akw_cache_release(AkwCache *cache, AkwCacheEntry *entry)
+{
+  akw_mutex_lock(&cache->mutex);
+  bool isFreed = !--entry->refCount && entry->isEvicted;
+  akw_mutex_unlock(&cache->mutex);
+  if (!isFreed) return;
+  AkwMemoryStats *stats = akw_memory_swap_stats(NULL);
+  entry_free(entry);
+  akw_memory_swap_stats(stats);
+}
+
+void akw_cache_get_stats(AkwCache *cache, AkwCacheStats *stats)
+{
+  akw_mutex_lock(&cache->mutex);
+  *stats = cache->stats;
+  akw_mutex_unlock(&cache->mutex);
+}
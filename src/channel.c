@@ -0,0 +1,203 @@
+//
+// channel.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/channel.h"
+#include "akwan/array.h"
+#include "akwan/atomic.h"
+#include "akwan/memory.h"
+#include "akwan/thread.h"
+
+typedef AkwVector(AkwArray *) ArrayVector;
+
+static inline bool must_copy(AkwValue val);
+static inline AkwValue isolate(AkwValue val, int *rc);
+static inline void isolate_elements(ArrayVector *pending, int *rc);
+static inline AkwValue hand_over(AkwValue val, int *rc);
+static inline bool enqueue(AkwChannel *chan, AkwValue val);
+
+static inline bool must_copy(AkwValue val)
+{
+  // Shared objects are copied, and so are immortal ones that are not
+  // frozen, such as chunk constants, which die with their chunk.
+  if (!akw_is_object(val)) return false;
+  AkwObject *obj = akw_as_object(val);
+  if (akw_object_is_frozen(obj)) return false;
+  return akw_object_is_immortal(obj) || akw_object_ref_count(obj) > 1;
+}
+
+static inline AkwValue isolate(AkwValue val, int *rc)
+{
+  // Returns a value that shares no object with anything but frozen values.
+  // Objects owned only by the value are kept, and the others are copied. A
+  // copy shares its own elements with the original, so everything below it
+  // gets copied as well.
+  if (!akw_is_object(val) || akw_object_is_frozen(akw_as_object(val)))
+    return val;
+  if (must_copy(val))
+  {
+    AkwValue result = akw_value_copy(val, rc);
+    if (!akw_is_ok(*rc)) return val;
+    akw_value_retain(result);
+    akw_value_release(val);
+    val = result;
+  }
+  if (!akw_is_array(val)) return val;
+  ArrayVector pending;
+  akw_vector_init_in(&pending, NULL);
+  akw_vector_append_in(&pending, akw_as_array(val), NULL, rc);
+  if (akw_is_ok(*rc))
+    isolate_elements(&pending, rc);
+  akw_vector_deinit_in(&pending, NULL);
+  return val;
+}
+
+static inline void isolate_elements(ArrayVector *pending, int *rc)
+{
+  while (!akw_vector_is_empty(pending))
+  {
+    AkwArray *arr = akw_vector_get(pending, --pending->count);
+    int n = akw_array_count(arr);
+    for (int i = 0; i < n; ++i)
+    {
+      AkwValue elem = akw_array_get(arr, i);
+      if (!akw_is_object(elem) || akw_object_is_frozen(akw_as_object(elem)))
+        continue;
+      if (must_copy(elem))
+      {
+        AkwValue copy = akw_value_copy(elem, rc);
+        if (!akw_is_ok(*rc)) return;
+        akw_array_inplace_set(arr, i, copy);
+        elem = copy;
+      }
+      if (!akw_is_array(elem)) continue;
+      akw_vector_append_in(pending, akw_as_array(elem), NULL, rc);
+      if (!akw_is_ok(*rc)) return;
+    }
+  }
+}
+
+static inline AkwValue hand_over(AkwValue val, int *rc)
+{
+  // A value in flight is charged to no one, since the sender's stats may
+  // be gone by the time it is received. Isolating it leaves nothing shared,
+  // so every object moves whatever stats it was created with.
+  val = isolate(val, rc);
+  if (!akw_is_ok(*rc)) return val;
+  akw_value_transfer_unshared(val, NULL, rc);
+  if (!akw_is_ok(*rc)) return val;
+  akw_value_share(val);
+  return val;
+}
+
+static inline bool enqueue(AkwChannel *chan, AkwValue val)
+{
+  // Producers claim a slot by advancing the tail, then publish the value
+  // by bumping the slot's sequence. A slot whose sequence lags behind the
+  // tail is still held by the consumer, so the channel is full.
+  int mask = chan->capacity - 1;
+  int pos = akw_atomic_load(&chan->tail);
+  AkwChannelSlot *slot;
+  for (;;)
+  {
+    slot = &chan->slots[pos & mask];
+    int seq = akw_atomic_load(&slot->sequence);
+    int diff = (int) ((unsigned) seq - (unsigned) pos);
+    int next = (int) ((unsigned) pos + 1);
+    if (!diff)
+    {
+      if (akw_atomic_compare_exchange(&chan->tail, pos, next)) break;
+    }
+    else if (diff < 0)
+      return false;
+    pos = akw_atomic_load(&chan->tail);
+  }
+  slot->value = val;
+  akw_atomic_store(&slot->sequence, (int) ((unsigned) pos + 1));
+  return true;
+}
+
+void akw_channel_init(AkwChannel *chan, int capacity, int *rc)
+{
+  int realCapacity = AKW_MIN_CAPACITY;
+  while (realCapacity < capacity)
+    realCapacity <<= 1;
+  if (realCapacity > AKW_MAX_CAPACITY)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  AkwChannelSlot *slots = akw_memory_alloc(sizeof(*slots) * realCapacity);
+  if (!slots)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  for (int i = 0; i < realCapacity; ++i)
+  {
+    slots[i].sequence = i;
+    slots[i].value = akw_nil_value();
+  }
+  chan->capacity = realCapacity;
+  chan->slots = slots;
+  chan->tail = 0;
+  chan->head = 0;
+}
+
+void akw_channel_deinit(AkwChannel *chan)
+{
+  AkwValue val;
+  while (akw_channel_try_receive(chan, &val))
+    akw_value_release(val);
+  akw_memory_dealloc(chan->slots, sizeof(*chan->slots) * chan->capacity);
+}
+
+bool akw_channel_try_send(AkwChannel *chan, AkwValue *val, int *rc)
+{
+  // The channel takes over the sender's reference. If the value is shared,
+  // *val is replaced with an unshared copy first, which the sender still
+  // owns when the channel turns out to be full.
+  *val = hand_over(*val, rc);
+  if (!akw_is_ok(*rc)) return false;
+  if (enqueue(chan, *val)) return true;
+  int transferRc = AKW_OK;
+  akw_value_transfer(*val, NULL, akw_memory_current_stats(), &transferRc);
+  return false;
+}
+
+void akw_channel_send(AkwChannel *chan, AkwValue val, int *rc)
+{
+  val = hand_over(val, rc);
+  if (!akw_is_ok(*rc)) return;
+  while (!enqueue(chan, val))
+    akw_thread_yield();
+}
+
+bool akw_channel_try_receive(AkwChannel *chan, AkwValue *val)
+{
+  int head = chan->head;
+  AkwChannelSlot *slot = &chan->slots[head & (chan->capacity - 1)];
+  int seq = akw_atomic_load(&slot->sequence);
+  if (seq != (int) ((unsigned) head + 1)) return false;
+  *val = slot->value;
+  akw_atomic_store(&slot->sequence, (int) ((unsigned) head + chan->capacity));
+  chan->head = (int) ((unsigned) head + 1);
+  // Objects the walk cannot reach for lack of memory stay uncharged.
+  int rc = AKW_OK;
+  akw_value_transfer(*val, NULL, akw_memory_current_stats(), &rc);
+  return true;
+}
+
+AkwValue akw_channel_receive(AkwChannel *chan)
+{
+  AkwValue val;
+  while (!akw_channel_try_receive(chan, &val))
+    akw_thread_yield();
+  return val;
+}
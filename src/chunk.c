@@ -9,6 +9,104 @@
 //
 
 #include "akwan/chunk.h"
+#include <string.h>
+#include "akwan/memory.h"
+#include "akwan/string.h"
+
+#define FNV_OFFSET (0x811c9dc5U)
+#define FNV_PRIME  (0x01000193U)
+
+#define MIN_SLOTS (16)
+
+static inline uint32_t hash_bytes(uint32_t hash, size_t size, const void *bytes);
+static inline uint32_t hash_constant(AkwValue val);
+static inline bool is_same_constant(AkwValue a, AkwValue b);
+static inline int *find_slot(AkwChunk *chunk, AkwValue val, uint32_t hash);
+static inline void grow_slots(AkwChunk *chunk, int *rc);
+
+static inline uint32_t hash_bytes(uint32_t hash, size_t size, const void *bytes)
+{
+  const uint8_t *p = bytes;
+  for (size_t i = 0; i < size; ++i)
+  {
+    hash ^= p[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static inline uint32_t hash_constant(AkwValue val)
+{
+  uint32_t hash = hash_bytes(FNV_OFFSET, sizeof(val.type), &val.type);
+  if (akw_is_number(val))
+  {
+    double num = akw_as_number(val);
+    return hash_bytes(hash, sizeof(num), &num);
+  }
+  AkwString *str = akw_as_string(val);
+  return hash_bytes(hash, (size_t) str->length, str->chars);
+}
+
+static inline bool is_same_constant(AkwValue a, AkwValue b)
+{
+  // Numbers are compared bit for bit, so 0 and -0 are kept apart.
+  if (akw_type(a) != akw_type(b)) return false;
+  if (akw_is_number(a))
+  {
+    double x = akw_as_number(a);
+    double y = akw_as_number(b);
+    return !memcmp(&x, &y, sizeof(x));
+  }
+  AkwString *s = akw_as_string(a);
+  AkwString *t = akw_as_string(b);
+  return s->length == t->length && !memcmp(s->chars, t->chars, s->length);
+}
+
+static inline int *find_slot(AkwChunk *chunk, AkwValue val, uint32_t hash)
+{
+  // Slots hold a constant index plus one, so that zero marks an empty slot.
+  int mask = chunk->numSlots - 1;
+  int i = (int) (hash & (uint32_t) mask);
+  for (;;)
+  {
+    int *slot = &chunk->slots[i];
+    if (!*slot) return slot;
+    if (is_same_constant(akw_vector_get(&chunk->consts, *slot - 1), val))
+      return slot;
+    i = (i + 1) & mask;
+  }
+}
+
+static inline void grow_slots(AkwChunk *chunk, int *rc)
+{
+  int numSlots = chunk->numSlots ? chunk->numSlots << 1 : MIN_SLOTS;
+  if (numSlots > AKW_MAX_CAPACITY)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  int *slots = akw_memory_alloc(sizeof(*slots) * numSlots);
+  if (!slots)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  memset(slots, 0, sizeof(*slots) * numSlots);
+  akw_memory_dealloc(chunk->slots, sizeof(*chunk->slots) * chunk->numSlots);
+  chunk->numSlots = numSlots;
+  chunk->slots = slots;
+  int n = chunk->consts.count;
+  int mask = numSlots - 1;
+  for (int i = 0; i < n; ++i)
+  {
+    AkwValue val = akw_vector_get(&chunk->consts, i);
+    if (!akw_is_number(val) && !akw_is_string(val)) continue;
+    int j = (int) (hash_constant(val) & (uint32_t) mask);
+    while (slots[j])
+      j = (j + 1) & mask;
+    slots[j] = i + 1;
+  }
+}
 
 const char *akw_opcode_name(AkwOpcode op)
 {
@@ -44,6 +142,9 @@ const char *akw_opcode_name(AkwOpcode op)
   case AKW_OP_GET_LOCAL:
     name = "GetLocal";
     break;
+  case AKW_OP_MOVE_LOCAL:
+    name = "MoveLocal";
+    break;
   case AKW_OP_SET_LOCAL:
     name = "SetLocal";
     break;
@@ -85,6 +186,9 @@ void akw_chunk_init(AkwChunk *chunk)
 {
   akw_buffer_init(&chunk->code);
   akw_vector_init(&chunk->consts);
+  chunk->numSlots = 0;
+  chunk->slots = NULL;
+  chunk->maxDepth = 0;
 }
 
 void akw_chunk_deinit(AkwChunk *chunk)
@@ -94,9 +198,10 @@ void akw_chunk_deinit(AkwChunk *chunk)
   for (int i = 0; i < n; ++i)
   {
     AkwValue val = akw_vector_get(&chunk->consts, i);
-    akw_value_release(val);
+    akw_value_free(val);
   }
   akw_vector_deinit(&chunk->consts);
+  akw_memory_dealloc(chunk->slots, sizeof(*chunk->slots) * chunk->numSlots);
 }
 
 void akw_chunk_emit_opcode(AkwChunk *chunk, AkwOpcode op, int *rc)
@@ -111,9 +216,34 @@ void akw_chunk_emit_byte(AkwChunk *chunk, uint8_t byte, int *rc)
 
 int akw_chunk_append_constant(AkwChunk *chunk, AkwValue val, int *rc)
 {
+  // The chunk takes val, so when an equal constant is already there, val is
+  // freed and the index of that one is returned.
+  bool isIndexed = akw_is_number(val) || akw_is_string(val);
+  int *slot = NULL;
+  if (isIndexed)
+  {
+    // Kept at most half full.
+    if ((chunk->consts.count + 1) << 1 > chunk->numSlots)
+    {
+      grow_slots(chunk, rc);
+      if (!akw_is_ok(*rc)) return 0;
+    }
+    slot = find_slot(chunk, val, hash_constant(val));
+    if (*slot)
+    {
+      akw_value_free(val);
+      return *slot - 1;
+    }
+  }
   int index = chunk->consts.count;
   akw_vector_append(&chunk->consts, val, rc);
   if (!akw_is_ok(*rc)) return 0;
-  akw_value_retain(val);
+  if (slot)
+    *slot = index + 1;
+  // Constants belong to the chunk for its whole life, so they are made
+  // immortal. Running a chunk never writes to it, which lets one chunk
+  // be shared by VMs on different threads.
+  if (akw_is_object(val))
+    akw_as_object(val)->flags |= AKW_OBJECT_FLAG_IMMORTAL;
   return index;
 }
@@ -10,15 +10,15 @@
 
 #include "akwan/compiler.h"
 #include <assert.h>
-#include <stdlib.h>
 #include <string.h>
+#include "akwan/number.h"
 #include "akwan/string.h"
 
 #define match(c, t) ((c)->lex.token.kind == (t))
 
 #define next(c) \
   do { \
-    akw_lexer_next(&(c)->lex, &(c)->rc, (c)->err); \
+    read_token(c); \
     if (!akw_compiler_is_ok(c)) return; \
   } while (0)
 
@@ -33,6 +33,8 @@
 
 #define is_check_only(c) ((c)->flags & AKW_COMPILER_FLAG_CHECK_ONLY)
 
+#define is_pipelined(c) ((c)->flags & AKW_COMPILER_FLAG_PIPELINED)
+
 #define check_code(c) \
   do { \
     if (akw_compiler_is_ok(c)) break; \
@@ -60,12 +62,56 @@
     ++(c)->scopeDepth; \
   } while (0)
 
-static inline bool token_equal(AkwToken *token1, AkwToken *token2);
-static inline void define_variable(AkwCompiler *comp, AkwToken *name,
+// An interned name, and where it appears in the source (-1 for parameters).
+typedef struct
+{
+  int offset;
+  int symbol;
+} Name;
+
+enum
+{
+  FRAME_OPERATOR,
+  FRAME_GROUP,
+  FRAME_ARRAY,
+  FRAME_INDEX
+};
+
+enum
+{
+  PREC_NONE,
+  PREC_RANGE,
+  PREC_TERM,
+  PREC_FACTOR,
+  PREC_UNARY
+};
+
+typedef struct
+{
+  uint8_t prec;
+  uint8_t op;
+} InfixOp;
+
+// Tokens that are not infix operators have no precedence.
+static const InfixOp infixOps[AKW_TOKEN_KIND_NAME + 1] = {
+  [AKW_TOKEN_KIND_PLUS]    = { PREC_TERM,   AKW_OP_ADD },
+  [AKW_TOKEN_KIND_MINUS]   = { PREC_TERM,   AKW_OP_SUB },
+  [AKW_TOKEN_KIND_STAR]    = { PREC_FACTOR, AKW_OP_MUL },
+  [AKW_TOKEN_KIND_SLASH]   = { PREC_FACTOR, AKW_OP_DIV },
+  [AKW_TOKEN_KIND_PERCENT] = { PREC_FACTOR, AKW_OP_MOD },
+  [AKW_TOKEN_KIND_DOTDOT]  = { PREC_RANGE,  AKW_OP_RANGE }
+};
+
+static inline void read_token(AkwCompiler *comp);
+static inline Name current_name(AkwCompiler *comp);
+static inline int bind_symbol(AkwCompiler *comp, int length, char *chars);
+static inline void define_variable(AkwCompiler *comp, Name *name,
   AkwTypeInfo typeInfo);
-static inline AkwVariable *find_variable(AkwCompiler *comp, AkwToken *name);
+static inline AkwVariable *find_variable(AkwCompiler *comp, Name *name);
+static inline void settle_variable(AkwCompiler *comp, AkwVariable *var);
 static inline void pop_scope(AkwCompiler *comp);
 static inline void unexpected_token_error(AkwCompiler *comp);
+static inline void init(AkwCompiler *comp, int flags);
 static inline void compile_chunk(AkwCompiler *comp);
 static inline void compile_stmt(AkwCompiler *comp);
 static inline void compile_let_stmt(AkwCompiler *comp);
@@ -73,90 +119,144 @@ static inline void compile_inout_stmt(AkwCompiler *comp);
 static inline void compile_assign_stmt(AkwCompiler *comp);
 static inline void compile_return_stmt(AkwCompiler *comp);
 static inline void compile_block_stmt(AkwCompiler *comp);
+static inline void push_frame(AkwCompiler *comp, int kind, int prec, int op);
+static inline void reduce_operators(AkwCompiler *comp, int prec);
+static inline bool has_range(AkwCompiler *comp);
 static inline void compile_expr(AkwCompiler *comp);
-static inline void compile_add_expr(AkwCompiler *comp);
-static inline void compile_mul_expr(AkwCompiler *comp);
-static inline void compile_unary_expr(AkwCompiler *comp);
-static inline void compile_prim_expr(AkwCompiler *comp);
+static inline void compile_operand(AkwCompiler *comp);
 static inline void compile_int(AkwCompiler *comp);
 static inline void compile_number(AkwCompiler *comp);
 static inline void compile_string(AkwCompiler *comp);
-static inline void compile_array(AkwCompiler *comp);
 static inline void compile_ref(AkwCompiler *comp);
 static inline void compile_variable(AkwCompiler *comp);
 
-static inline bool token_equal(AkwToken *token1, AkwToken *token2)
+static inline void read_token(AkwCompiler *comp)
 {
-  return token1->length == token2->length
-    && !memcmp(token1->chars, token2->chars, token1->length);
+  if (!is_pipelined(comp))
+  {
+    akw_lexer_next(&comp->lex, &comp->rc, comp->err);
+    return;
+  }
+  akw_token_stream_next(&comp->stream, &comp->lex.token, &comp->rc,
+    comp->err);
 }
 
-static inline void define_variable(AkwCompiler *comp, AkwToken *name,
+static inline Name current_name(AkwCompiler *comp)
+{
+  // Names are interned as soon as they are read, since a lexer reading
+  // from a stream drops the characters of tokens it has moved past.
+  AkwToken *token = &comp->lex.token;
+  char *chars = akw_token_chars(&comp->lex, token);
+  return (Name) {
+    .offset = token->offset,
+    .symbol = bind_symbol(comp, token->length, chars)
+  };
+}
+
+static inline int bind_symbol(AkwCompiler *comp, int length, char *chars)
+{
+  // Each symbol is bound to the innermost variable with its name, or to -1.
+  int rc = AKW_OK;
+  int sym = akw_symbol_table_intern(&comp->symbols, length, chars, &rc);
+  while (akw_is_ok(rc) && comp->bindings.count <= sym)
+    akw_vector_append(&comp->bindings, -1, &rc);
+  assert(akw_is_ok(rc));
+  return sym;
+}
+
+static inline void define_variable(AkwCompiler *comp, Name *name,
   AkwTypeInfo typeInfo)
 {
   int n = comp->variables.count;
-  AkwVariable *variables = comp->variables.elements;
-  for (int i = n - 1; i > -1; --i)
+  int sym = name->symbol;
+  int shadowed = akw_vector_get(&comp->bindings, sym);
+  if (shadowed != -1)
   {
-    AkwVariable *var = &variables[i];
-    if (var->depth < comp->scopeDepth) break;
-    if (token_equal(name, &var->name))
+    AkwVariable *var = &comp->variables.elements[shadowed];
+    if (var->depth == comp->scopeDepth)
     {
+      int ln;
+      int col;
+      akw_lexer_position(&comp->lex, name->offset, &ln, &col);
+      AkwSymbol *symbol = akw_symbol_table_get(&comp->symbols, sym);
       comp->rc = AKW_SEMANTIC_ERROR;
       akw_error_set(comp->err, "variable '%.*s' already defined in %d,%d",
-        name->length, name->chars, name->ln, name->col);
+        symbol->length, symbol->chars, ln, col);
       return;
     }
   }
   if (n > UINT8_MAX)
   {
+    int ln;
+    int col;
+    akw_lexer_position(&comp->lex, name->offset, &ln, &col);
     comp->rc = AKW_SEMANTIC_ERROR;
-    akw_error_set(comp->err, "too many variables defined in %d,%d",
-      name->ln, name->col);
+    akw_error_set(comp->err, "too many variables defined in %d,%d", ln, col);
     return;
   }
   AkwVariable var = {
-    .name = *name,
+    .symbol = sym,
+    .shadowed = shadowed,
     .depth = comp->scopeDepth,
     .typeInfo = typeInfo,
-    .index = (uint8_t) n
+    .index = (uint8_t) n,
+    .lastRead = -1,
+    .isEscaped = false
   };
   int rc = AKW_OK;
   akw_vector_append(&comp->variables, var, &rc);
   assert(akw_is_ok(rc));
+  akw_vector_set(&comp->bindings, sym, n);
 }
 
-static inline AkwVariable *find_variable(AkwCompiler *comp, AkwToken *name)
+static inline AkwVariable *find_variable(AkwCompiler *comp, Name *name)
 {
-  int n = comp->variables.count;
-  AkwVariable *variables = comp->variables.elements;
-  int scopeDepth = comp->scopeDepth;
-  for (int i = n - 1; i > -1; --i)
+  // Only variables of the current scope are visible.
+  int index = akw_vector_get(&comp->bindings, name->symbol);
+  if (index != -1)
   {
-    AkwVariable *var = &variables[i];
-    if (var->depth > scopeDepth) continue;
-    if (var->depth < scopeDepth) break;
-    if (token_equal(name, &var->name))
+    AkwVariable *var = &comp->variables.elements[index];
+    if (var->depth == comp->scopeDepth)
       return var;
   }
+  int ln;
+  int col;
+  akw_lexer_position(&comp->lex, name->offset, &ln, &col);
+  AkwSymbol *symbol = akw_symbol_table_get(&comp->symbols, name->symbol);
   comp->rc = AKW_SEMANTIC_ERROR;
   akw_error_set(comp->err, "variable '%.*s' used but not defined in %d,%d",
-    name->length, name->chars, name->ln, name->col);
+    symbol->length, symbol->chars, ln, col);
   return NULL;
 }
 
+static inline void settle_variable(AkwCompiler *comp, AkwVariable *var)
+{
+  // The value held by a variable dies when the variable is assigned or
+  // goes out of scope, so its last read can take the value instead of
+  // copying it. Variables whose reference was taken are never moved.
+  int offset = var->lastRead;
+  var->lastRead = -1;
+  if (offset < 0 || var->isEscaped) return;
+  uint8_t *code = comp->chunk.code.bytes;
+  assert(code[offset] == AKW_OP_GET_LOCAL);
+  code[offset] = AKW_OP_MOVE_LOCAL;
+}
+
 static inline void pop_scope(AkwCompiler *comp)
 {
   int n = comp->variables.count;
   AkwVariable *variables = comp->variables.elements;
   int scopeDepth = comp->scopeDepth;
-  for (int i = n - 1; i > -1; --i)
+  int i = n - 1;
+  for (; i > -1; --i)
   {
     AkwVariable *var = &variables[i];
-    if (var->depth > scopeDepth) continue;
     if (var->depth < scopeDepth) break;
+    settle_variable(comp, var);
+    akw_vector_set(&comp->bindings, var->symbol, var->shadowed);
     emit_opcode(comp, AKW_OP_POP);
   }
+  comp->variables.count = i + 1;
   --comp->scopeDepth;
 }
 
@@ -164,14 +264,33 @@ static inline void unexpected_token_error(AkwCompiler *comp)
 {
   comp->rc = AKW_SYNTAX_ERROR;
   AkwToken *token = &comp->lex.token;
+  int ln;
+  int col;
+  akw_lexer_position(&comp->lex, token->offset, &ln, &col);
   if (token->kind == AKW_TOKEN_KIND_EOF)
   {
-    akw_error_set(comp->err, "unexpected end of file in %d,%d",
-      token->ln, token->col);
+    akw_error_set(comp->err, "unexpected end of file in %d,%d", ln, col);
     return;
   }
   akw_error_set(comp->err, "unexpected token '%.*s' in %d,%d",
-    token->length, token->chars, token->ln, token->col);
+    token->length, akw_token_chars(&comp->lex, token), ln, col);
+}
+
+static inline void init(AkwCompiler *comp, int flags)
+{
+  // Everything is set up before the first token is read, so the compiler
+  // can be deinitialized even when reading it fails.
+  comp->flags = flags;
+  comp->rc = AKW_OK;
+  comp->scopeDepth = 0;
+  akw_vector_init(&comp->variables);
+  akw_symbol_table_init(&comp->symbols);
+  akw_vector_init(&comp->bindings);
+  akw_vector_init(&comp->frames);
+  // Nothing is emitted when only checking, so there is no chunk to hold it.
+  if (!is_check_only(comp))
+    akw_chunk_init(&comp->chunk);
+  comp->stream.tokens = NULL;
 }
 
 static inline void compile_chunk(AkwCompiler *comp)
@@ -181,6 +300,9 @@ static inline void compile_chunk(AkwCompiler *comp)
     compile_stmt(comp);
     if (!akw_compiler_is_ok(comp)) return;
   }
+  int n = comp->variables.count;
+  for (int i = 0; i < n; ++i)
+    settle_variable(comp, &comp->variables.elements[i]);
   emit_opcode(comp, AKW_OP_NIL);
   emit_opcode(comp, AKW_OP_RETURN);
 }
@@ -226,7 +348,7 @@ static inline void compile_let_stmt(AkwCompiler *comp)
     unexpected_token_error(comp);
     return;
   }
-  AkwToken token = comp->lex.token;
+  Name name = current_name(comp);
   next(comp);
   if (match(comp, AKW_TOKEN_KIND_EQ))
   {
@@ -237,7 +359,7 @@ static inline void compile_let_stmt(AkwCompiler *comp)
   else
     emit_opcode(comp, AKW_OP_NIL);
   consume(comp, AKW_TOKEN_KIND_SEMICOLON);
-  define_variable(comp, &token, akw_type_info(false));
+  define_variable(comp, &name, akw_type_info(false));
 }
 
 static inline void compile_inout_stmt(AkwCompiler *comp)
@@ -248,31 +370,36 @@ static inline void compile_inout_stmt(AkwCompiler *comp)
     unexpected_token_error(comp);
     return;
   }
-  AkwToken token = comp->lex.token;
+  Name name = current_name(comp);
   next(comp);
   consume(comp, AKW_TOKEN_KIND_EQ);
   compile_expr(comp);
   if (!akw_compiler_is_ok(comp)) return;
   consume(comp, AKW_TOKEN_KIND_SEMICOLON);
   AkwTypeInfo rhsInfo = comp->typeInfo;
-  define_variable(comp, &token, akw_type_info(true));
+  define_variable(comp, &name, akw_type_info(true));
   if (!akw_compiler_is_ok(comp)) return;
   if (rhsInfo.isRef) return;
+  int ln;
+  int col;
+  akw_lexer_position(&comp->lex, name.offset, &ln, &col);
+  AkwSymbol *symbol = akw_symbol_table_get(&comp->symbols, name.symbol);
   comp->rc = AKW_TYPE_ERROR;
   akw_error_set(comp->err, "cannot pass a value to the inout variable '%.*s' in %d,%d",
-    token.length, token.chars, token.ln, token.col);
+    symbol->length, symbol->chars, ln, col);
 }
 
 static inline void compile_assign_stmt(AkwCompiler *comp)
 {
-  AkwToken token = comp->lex.token;
+  Name name = current_name(comp);
   next(comp);
   consume(comp, AKW_TOKEN_KIND_EQ);
   compile_expr(comp);
   if (!akw_compiler_is_ok(comp)) return;
   consume(comp, AKW_TOKEN_KIND_SEMICOLON);
-  AkwVariable *var = find_variable(comp, &token);
+  AkwVariable *var = find_variable(comp, &name);
   if (!akw_compiler_is_ok(comp)) return;
+  settle_variable(comp, var);
   AkwOpcode op = var->typeInfo.isRef ? AKW_OP_SET_LOCAL_BY_REF : AKW_OP_SET_LOCAL;
   emit_opcode(comp, op);
   emit_byte(comp, var->index); 
@@ -305,236 +432,255 @@ static inline void compile_block_stmt(AkwCompiler *comp)
   pop_scope(comp);
 }
 
-static inline void compile_expr(AkwCompiler *comp)
+static inline void push_frame(AkwCompiler *comp, int kind, int prec, int op)
 {
-  compile_add_expr(comp);
-  if (!akw_compiler_is_ok(comp)) return;
-  if (match(comp, AKW_TOKEN_KIND_DOTDOT))
+  AkwExprFrame frame = {
+    .kind = (uint8_t) kind,
+    .prec = (uint8_t) prec,
+    .op = (uint8_t) op,
+    .count = 1
+  };
+  akw_vector_append(&comp->frames, frame, &comp->rc);
+  if (akw_compiler_is_ok(comp)) return;
+  akw_error_set(comp->err, "expression too deeply nested");
+}
+
+static inline void reduce_operators(AkwCompiler *comp, int prec)
+{
+  // Brackets have no precedence, so this stops at the innermost one.
+  while (!akw_vector_is_empty(&comp->frames))
   {
-    next(comp);
-    compile_add_expr(comp);
-    if (!akw_compiler_is_ok(comp)) return;
-    emit_opcode(comp, AKW_OP_RANGE);
+    AkwExprFrame frame = comp->frames.elements[comp->frames.count - 1];
+    if (frame.prec < prec) break;
+    --comp->frames.count;
+    emit_opcode(comp, frame.op);
     comp->typeInfo = akw_type_info(false);
   }
 }
 
-static inline void compile_add_expr(AkwCompiler *comp)
+static inline bool has_range(AkwCompiler *comp)
 {
-  compile_mul_expr(comp);
-  if (!akw_compiler_is_ok(comp)) return;
+  // A range cannot be the operand of another one.
+  for (int i = comp->frames.count - 1; i >= 0; --i)
+  {
+    AkwExprFrame *frame = &comp->frames.elements[i];
+    if (frame->kind != FRAME_OPERATOR) break;
+    if (frame->op == AKW_OP_RANGE) return true;
+  }
+  return false;
+}
+
+static inline void compile_expr(AkwCompiler *comp)
+{
+  // Operators waiting for their right operand and open brackets are kept in
+  // comp->frames rather than on the C stack, so nesting is bounded by memory.
+  akw_vector_clear(&comp->frames);
+  bool needsOperand = true;
   for (;;)
   {
-    if (match(comp, AKW_TOKEN_KIND_PLUS))
+    if (needsOperand)
     {
-      next(comp);
-      compile_mul_expr(comp);
+      compile_operand(comp);
       if (!akw_compiler_is_ok(comp)) return;
-      emit_opcode(comp, AKW_OP_ADD);
-      comp->typeInfo = akw_type_info(false);
-      continue;
+      needsOperand = false;
     }
-    if (match(comp, AKW_TOKEN_KIND_MINUS))
+    AkwTokenKind kind = comp->lex.token.kind;
+    InfixOp infix = infixOps[kind];
+    if (infix.prec != PREC_NONE
+      && (kind != AKW_TOKEN_KIND_DOTDOT || !has_range(comp)))
     {
-      next(comp);
-      compile_mul_expr(comp);
+      reduce_operators(comp, infix.prec);
       if (!akw_compiler_is_ok(comp)) return;
-      emit_opcode(comp, AKW_OP_SUB);
-      comp->typeInfo = akw_type_info(false);
+      push_frame(comp, FRAME_OPERATOR, infix.prec, infix.op);
+      if (!akw_compiler_is_ok(comp)) return;
+      next(comp);
+      needsOperand = true;
       continue;
     }
-    break;
+    reduce_operators(comp, PREC_RANGE);
+    if (!akw_compiler_is_ok(comp)) return;
+    if (akw_vector_is_empty(&comp->frames)) return;
+    AkwExprFrame *frame = &comp->frames.elements[comp->frames.count - 1];
+    switch (frame->kind)
+    {
+    case FRAME_GROUP:
+      consume(comp, AKW_TOKEN_KIND_RPAREN);
+      --comp->frames.count;
+      break;
+    case FRAME_ARRAY:
+      if (match(comp, AKW_TOKEN_KIND_COMMA))
+      {
+        next(comp);
+        ++frame->count;
+        needsOperand = true;
+        break;
+      }
+      consume(comp, AKW_TOKEN_KIND_RBRACKET);
+      uint8_t n = frame->count;
+      --comp->frames.count;
+      emit_opcode(comp, AKW_OP_ARRAY);
+      emit_byte(comp, n);
+      comp->typeInfo = akw_type_info(false);
+      break;
+    case FRAME_INDEX:
+      consume(comp, AKW_TOKEN_KIND_RBRACKET);
+      emit_opcode(comp, AKW_OP_GET_ELEMENT);
+      comp->typeInfo = akw_type_info(false);
+      if (match(comp, AKW_TOKEN_KIND_LBRACKET))
+      {
+        next(comp);
+        needsOperand = true;
+        break;
+      }
+      --comp->frames.count;
+      break;
+    }
   }
 }
 
-static inline void compile_mul_expr(AkwCompiler *comp)
+static inline void compile_operand(AkwCompiler *comp)
 {
-  compile_unary_expr(comp);
-  if (!akw_compiler_is_ok(comp)) return;
+  // Prefix operators and open brackets are pushed until a primary is found.
   for (;;)
   {
-    if (match(comp, AKW_TOKEN_KIND_STAR))
+    switch (comp->lex.token.kind)
     {
+    case AKW_TOKEN_KIND_MINUS:
+      push_frame(comp, FRAME_OPERATOR, PREC_UNARY, AKW_OP_NEG);
+      if (!akw_compiler_is_ok(comp)) return;
       next(comp);
-      compile_unary_expr(comp);
+      continue;
+    case AKW_TOKEN_KIND_LPAREN:
+      push_frame(comp, FRAME_GROUP, PREC_NONE, 0);
       if (!akw_compiler_is_ok(comp)) return;
-      emit_opcode(comp, AKW_OP_MUL);
-      comp->typeInfo = akw_type_info(false);
+      next(comp);
       continue;
-    }
-    if (match(comp, AKW_TOKEN_KIND_SLASH))
-    {
+    case AKW_TOKEN_KIND_LBRACKET:
       next(comp);
-      compile_unary_expr(comp);
-      if (!akw_compiler_is_ok(comp)) return;
-      emit_opcode(comp, AKW_OP_DIV);
-      comp->typeInfo = akw_type_info(false);
+      if (match(comp, AKW_TOKEN_KIND_RBRACKET))
+      {
+        next(comp);
+        emit_opcode(comp, AKW_OP_ARRAY);
+        emit_byte(comp, 0);
+        comp->typeInfo = akw_type_info(false);
+        return;
+      }
+      push_frame(comp, FRAME_ARRAY, PREC_NONE, 0);
       continue;
-    }
-    if (match(comp, AKW_TOKEN_KIND_PERCENT))
-    {
+    case AKW_TOKEN_KIND_NIL_KW:
+      next(comp);
+      emit_opcode(comp, AKW_OP_NIL);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_FALSE_KW:
+      next(comp);
+      emit_opcode(comp, AKW_OP_FALSE);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_TRUE_KW:
       next(comp);
-      compile_unary_expr(comp);
+      emit_opcode(comp, AKW_OP_TRUE);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_INT:
+      compile_int(comp);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_NUMBER:
+      compile_number(comp);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_STRING:
+      compile_string(comp);
+      comp->typeInfo = akw_type_info(false);
+      return;
+    case AKW_TOKEN_KIND_AMP:
+      compile_ref(comp);
+      comp->typeInfo = akw_type_info(true);
+      return;
+    case AKW_TOKEN_KIND_NAME:
+      compile_variable(comp);
       if (!akw_compiler_is_ok(comp)) return;
-      emit_opcode(comp, AKW_OP_MOD);
       comp->typeInfo = akw_type_info(false);
+      if (!match(comp, AKW_TOKEN_KIND_LBRACKET)) return;
+      push_frame(comp, FRAME_INDEX, PREC_NONE, 0);
+      if (!akw_compiler_is_ok(comp)) return;
+      next(comp);
       continue;
+    default:
+      break;
     }
-    break;
-  }
-}
-
-static inline void compile_unary_expr(AkwCompiler *comp)
-{
-  if (match(comp, AKW_TOKEN_KIND_MINUS))
-  {
-    next(comp);
-    compile_unary_expr(comp);
-    if (!akw_compiler_is_ok(comp)) return;
-    emit_opcode(comp, AKW_OP_NEG);
-    comp->typeInfo = akw_type_info(false);
+    unexpected_token_error(comp);
     return;
   }
-  compile_prim_expr(comp);
 }
 
-static inline void compile_prim_expr(AkwCompiler *comp)
+static inline void compile_int(AkwCompiler *comp)
 {
-  if (match(comp, AKW_TOKEN_KIND_NIL_KW))
-  {
-    next(comp);
-    emit_opcode(comp, AKW_OP_NIL);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_FALSE_KW))
-  {
-    next(comp);
-    emit_opcode(comp, AKW_OP_FALSE);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_TRUE_KW))
-  {
-    next(comp);
-    emit_opcode(comp, AKW_OP_TRUE);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_INT))
-  {
-    compile_int(comp);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_NUMBER))
-  {
-    compile_number(comp);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_STRING))
-  {
-    compile_string(comp);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_LBRACKET))
-  {
-    compile_array(comp);
-    comp->typeInfo = akw_type_info(false);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_AMP))
-  {
-    compile_ref(comp);
-    comp->typeInfo = akw_type_info(true);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_NAME))
-  {
-    compile_variable(comp);
-    return;
-  }
-  if (match(comp, AKW_TOKEN_KIND_LPAREN))
+  // Literals are compiled before the next token is read, which may drop
+  // their characters.
+  if (is_check_only(comp))
   {
     next(comp);
-    compile_expr(comp);
-    if (!akw_compiler_is_ok(comp)) return;
-    consume(comp, AKW_TOKEN_KIND_RPAREN);
     return;
   }
-  unexpected_token_error(comp);
-}
-
-static inline void compile_int(AkwCompiler *comp)
-{
-  AkwToken token = comp->lex.token;
-  next(comp);
-  if (is_check_only(comp)) return;
-  int64_t num = strtoll(token.chars, NULL, 10);
-  if (num <= UINT8_MAX)
+  AkwToken *token = &comp->lex.token;
+  char *chars = akw_token_chars(&comp->lex, token);
+  uint64_t num;
+  bool fits = akw_parse_int(token->length, chars, &num);
+  if (fits && num <= UINT8_MAX)
   {
     emit_opcode(comp, AKW_OP_INT);
     emit_byte(comp, (uint8_t) num);
+    next(comp);
     return;
   }
-  AkwValue val = akw_int_value(num);
+  // Past 64 bits the digits only need rounding, like any number.
+  AkwValue val = fits ? akw_int_value(num)
+    : akw_number_value(akw_parse_number(token->length, chars));
   uint8_t index = (uint8_t) akw_chunk_append_constant(&comp->chunk, val, &comp->rc);
   if (!akw_compiler_is_ok(comp)) return;
   emit_opcode(comp, AKW_OP_CONST);
   emit_byte(comp, index);
+  next(comp);
 }
 
 static inline void compile_number(AkwCompiler *comp)
 {
-  AkwToken token = comp->lex.token;
-  next(comp);
-  if (is_check_only(comp)) return;
-  double num = strtod(token.chars, NULL);
+  if (is_check_only(comp))
+  {
+    next(comp);
+    return;
+  }
+  AkwToken *token = &comp->lex.token;
+  double num = akw_parse_number(token->length,
+    akw_token_chars(&comp->lex, token));
   AkwValue val = akw_number_value(num);
   uint8_t index = (uint8_t) akw_chunk_append_constant(&comp->chunk, val, &comp->rc);
   if (!akw_compiler_is_ok(comp)) return;
   emit_opcode(comp, AKW_OP_CONST);
   emit_byte(comp, index);
+  next(comp);
 }
 
 static inline void compile_string(AkwCompiler *comp)
 {
-  AkwToken token = comp->lex.token;
-  next(comp);
-  if (is_check_only(comp)) return;
-  AkwString *str = akw_string_new_from(token.length, token.chars, &comp->rc);
+  if (is_check_only(comp))
+  {
+    next(comp);
+    return;
+  }
+  // The token includes the quotes.
+  AkwToken *token = &comp->lex.token;
+  char *chars = akw_token_chars(&comp->lex, token);
+  AkwString *str = akw_string_new_from(token->length - 2, &chars[1], &comp->rc);
   if (!akw_compiler_is_ok(comp)) return;
   AkwValue val = akw_string_value(str);
   uint8_t index = (uint8_t) akw_chunk_append_constant(&comp->chunk, val, &comp->rc);
   if (!akw_compiler_is_ok(comp)) return;
   emit_opcode(comp, AKW_OP_CONST);
   emit_byte(comp, index);
-}
-
-static inline void compile_array(AkwCompiler *comp)
-{
   next(comp);
-  if (match(comp, AKW_TOKEN_KIND_RBRACKET))
-  {
-    next(comp);
-    emit_opcode(comp, AKW_OP_ARRAY);
-    emit_byte(comp, 0);
-    return;
-  }
-  compile_expr(comp);
-  if (!akw_compiler_is_ok(comp)) return;
-  uint8_t n = 1;
-  while (match(comp, AKW_TOKEN_KIND_COMMA))
-  {
-    next(comp);
-    compile_expr(comp);
-    if (!akw_compiler_is_ok(comp)) return;
-    ++n;
-  }
-  consume(comp, AKW_TOKEN_KIND_RBRACKET);
-  emit_opcode(comp, AKW_OP_ARRAY);
-  emit_byte(comp, n);
 }
 
 static inline void compile_ref(AkwCompiler *comp)
@@ -545,10 +691,11 @@ static inline void compile_ref(AkwCompiler *comp)
     unexpected_token_error(comp);
     return;
   }
-  AkwToken token = comp->lex.token;
+  Name name = current_name(comp);
   next(comp);
-  AkwVariable *var = find_variable(comp, &token);
+  AkwVariable *var = find_variable(comp, &name);
   if (!akw_compiler_is_ok(comp)) return;
+  var->isEscaped = true;
   AkwOpcode op = var->typeInfo.isRef ? AKW_OP_GET_LOCAL : AKW_OP_LOCAL_REF;
   emit_opcode(comp, op);
   emit_byte(comp, var->index);
@@ -556,42 +703,74 @@ static inline void compile_ref(AkwCompiler *comp)
 
 static inline void compile_variable(AkwCompiler *comp)
 {
-  AkwToken token = comp->lex.token;
+  Name name = current_name(comp);
   next(comp);
-  AkwVariable *var = find_variable(comp, &token);
+  AkwVariable *var = find_variable(comp, &name);
   if (!akw_compiler_is_ok(comp)) return;
   AkwOpcode op = var->typeInfo.isRef ? AKW_OP_GET_LOCAL_BY_REF : AKW_OP_GET_LOCAL;
+  if (!is_check_only(comp) && !var->typeInfo.isRef)
+    var->lastRead = comp->chunk.code.count;
   emit_opcode(comp, op);
   emit_byte(comp, var->index);
-  while (match(comp, AKW_TOKEN_KIND_LBRACKET))
+}
+
+void akw_compiler_init(AkwCompiler *comp, int flags, char *source)
+{
+  init(comp, flags);
+  // With a single core the two threads would only take turns.
+  if (akw_thread_count_cores() < 2)
+    comp->flags &= ~AKW_COMPILER_FLAG_PIPELINED;
+  if (!is_pipelined(comp))
   {
-    next(comp);
-    compile_expr(comp);
-    if (!akw_compiler_is_ok(comp)) return;
-    consume(comp, AKW_TOKEN_KIND_RBRACKET);
-    emit_opcode(comp, AKW_OP_GET_ELEMENT);
+    akw_lexer_init(&comp->lex, source, &comp->rc, comp->err);
+    return;
+  }
+  // Tokens are read on another thread. The lexer here is only used to
+  // work out positions for error messages.
+  akw_lexer_init_source(&comp->lex, source);
+  akw_token_stream_init(&comp->stream, source,
+    AKW_TOKEN_STREAM_DEFAULT_CAPACITY, &comp->rc);
+  if (!akw_compiler_is_ok(comp))
+  {
+    akw_error_set(comp->err, "cannot start lexer thread");
+    return;
   }
-  comp->typeInfo = akw_type_info(false);
+  read_token(comp);
 }
 
-void akw_compiler_init(AkwCompiler *comp, int flags, char *source)
+void akw_compiler_init_stream(AkwCompiler *comp, int flags, AkwReadFn read,
+  void *userData)
 {
-  comp->flags = flags;
-  comp->rc = AKW_OK;
-  akw_lexer_init(&comp->lex, source, &comp->rc, comp->err);
-  if (!akw_compiler_is_ok(comp)) return;
-  comp->scopeDepth = 0;
-  akw_vector_init(&comp->variables);
-  akw_chunk_init(&comp->chunk);
+  // The stream is lexed in windows on this thread, so it is never
+  // pipelined.
+  init(comp, flags & ~AKW_COMPILER_FLAG_PIPELINED);
+  akw_lexer_init_stream(&comp->lex, read, userData, &comp->rc, comp->err);
 }
 
 void akw_compiler_deinit(AkwCompiler *comp)
 {
+  akw_token_stream_deinit(&comp->stream);
+  akw_lexer_deinit(&comp->lex);
   akw_vector_deinit(&comp->variables);
-  akw_chunk_deinit(&comp->chunk);
+  akw_symbol_table_deinit(&comp->symbols);
+  akw_vector_deinit(&comp->bindings);
+  akw_vector_deinit(&comp->frames);
+  if (!is_check_only(comp))
+    akw_chunk_deinit(&comp->chunk);
+}
+
+void akw_compiler_define_param(AkwCompiler *comp, const char *name)
+{
+  Name param = {
+    .offset = -1,
+    .symbol = bind_symbol(comp, (int) strlen(name), (char *) name)
+  };
+  define_variable(comp, &param, akw_type_info(false));
 }
 
 void akw_compiler_compile(AkwCompiler *comp)
 {
   compile_chunk(comp);
+  // Stops the lexer thread, which may still be reading ahead after an error.
+  akw_token_stream_deinit(&comp->stream);
 }
@@ -45,6 +45,7 @@ void akw_dump_chunk(const AkwChunk *chunk)
     case AKW_OP_ARRAY:
     case AKW_OP_LOCAL_REF:
     case AKW_OP_GET_LOCAL:
+    case AKW_OP_MOVE_LOCAL:
     case AKW_OP_SET_LOCAL:
     case AKW_OP_GET_LOCAL_BY_REF:
     case AKW_OP_SET_LOCAL_BY_REF:
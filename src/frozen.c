@@ -0,0 +1,324 @@
+//
+// frozen.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/frozen.h"
+#include <stdint.h>
+#include <string.h>
+#include "akwan/array.h"
+#include "akwan/memory.h"
+#include "akwan/range.h"
+#include "akwan/string.h"
+
+#define align(n) (((n) + 15) & ~(size_t) 15)
+
+// A frozen graph lives in a region of its own: a header, the copy of the
+// root, then the copies of everything below it. The region is sealed
+// read-only once filled, and freed as a whole. Only the root copy is
+// flagged as owning the region.
+typedef struct
+{
+  size_t size;
+} Region;
+
+typedef struct
+{
+  AkwValue val;
+  void     *copy;
+} Entry;
+
+typedef struct
+{
+  int   capacity;
+  int   count;
+  Entry *entries;
+} Map;
+
+typedef AkwVector(AkwValue) ValueVector;
+
+typedef AkwVector(Entry) EntryVector;
+
+static inline void map_init(Map *map, int *rc);
+static inline void map_deinit(Map *map);
+static inline Entry *map_find(Map *map, void *ptr);
+static inline void map_grow(Map *map, int *rc);
+static inline bool map_add(Map *map, AkwValue val, int *rc);
+static inline bool needs_copy(AkwValue val);
+static inline size_t copy_size(AkwValue val);
+static inline bool is_shared(AkwValue val);
+static inline void collect(Map *map, AkwValue root, size_t *size, int *rc);
+static inline void *bump(char **top, size_t size);
+static inline void *copy_object(AkwValue val, char **top);
+static inline void copy_graph(Map *map, AkwValue root, void *rootCopy,
+  char **top, int *rc);
+
+static inline void map_init(Map *map, int *rc)
+{
+  int capacity = AKW_MIN_CAPACITY;
+  Entry *entries = akw_memory_alloc(sizeof(*entries) * capacity);
+  if (!entries)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  memset(entries, 0, sizeof(*entries) * capacity);
+  map->capacity = capacity;
+  map->count = 0;
+  map->entries = entries;
+}
+
+static inline void map_deinit(Map *map)
+{
+  akw_memory_dealloc(map->entries, sizeof(*map->entries) * map->capacity);
+}
+
+static inline Entry *map_find(Map *map, void *ptr)
+{
+  uint64_t hash = (uint64_t) (uintptr_t) ptr * 0x9e3779b97f4a7c15ULL;
+  hash ^= hash >> 32;
+  int mask = map->capacity - 1;
+  int i = (int) (hash & (uint64_t) mask);
+  for (;;)
+  {
+    Entry *entry = &map->entries[i];
+    if (!entry->val.asPointer || entry->val.asPointer == ptr)
+      return entry;
+    i = (i + 1) & mask;
+  }
+}
+
+static inline void map_grow(Map *map, int *rc)
+{
+  Map newMap;
+  int capacity = map->capacity << 1;
+  Entry *entries = akw_memory_alloc(sizeof(*entries) * capacity);
+  if (!entries)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  memset(entries, 0, sizeof(*entries) * capacity);
+  newMap.capacity = capacity;
+  newMap.count = map->count;
+  newMap.entries = entries;
+  for (int i = 0; i < map->capacity; ++i)
+  {
+    Entry *entry = &map->entries[i];
+    if (!entry->val.asPointer) continue;
+    *map_find(&newMap, entry->val.asPointer) = *entry;
+  }
+  map_deinit(map);
+  *map = newMap;
+}
+
+static inline bool map_add(Map *map, AkwValue val, int *rc)
+{
+  if ((map->count + 1) << 1 > map->capacity)
+  {
+    map_grow(map, rc);
+    if (!akw_is_ok(*rc)) return false;
+  }
+  Entry *entry = map_find(map, val.asPointer);
+  if (entry->val.asPointer) return false;
+  entry->val = val;
+  entry->copy = NULL;
+  ++map->count;
+  return true;
+}
+
+static inline bool needs_copy(AkwValue val)
+{
+  return akw_is_object(val) && !akw_object_is_frozen(akw_as_object(val));
+}
+
+static inline size_t copy_size(AkwValue val)
+{
+  if (akw_is_string(val))
+    return align(sizeof(AkwString))
+      + align((size_t) akw_as_string(val)->length + 1);
+  if (akw_is_range(val))
+    return align(sizeof(AkwRange));
+  return align(sizeof(AkwArray))
+    + align(sizeof(AkwValue) * akw_array_count(akw_as_array(val)));
+}
+
+static inline bool is_shared(AkwValue val)
+{
+  AkwObject *obj = akw_as_object(val);
+  return akw_object_is_immortal(obj) || akw_object_ref_count(obj) > 1;
+}
+
+static inline void collect(Map *map, AkwValue root, size_t *size, int *rc)
+{
+  // Only objects with more than one reference can be reached twice, so only
+  // those go through the map. That keeps sharing inside the graph intact
+  // without hashing every object of a tree.
+  ValueVector pending;
+  akw_vector_init(&pending);
+  akw_vector_append(&pending, root, rc);
+  while (akw_is_ok(*rc) && !akw_vector_is_empty(&pending))
+  {
+    AkwValue val = akw_vector_get(&pending, --pending.count);
+    bool shared = is_shared(val) || val.asPointer == root.asPointer;
+    if (shared && !map_add(map, val, rc)) continue;
+    *size += copy_size(val);
+    if (!akw_is_array(val)) continue;
+    AkwArray *arr = akw_as_array(val);
+    int n = akw_array_count(arr);
+    for (int i = 0; i < n && akw_is_ok(*rc); ++i)
+    {
+      AkwValue elem = akw_array_get(arr, i);
+      if (needs_copy(elem))
+        akw_vector_append(&pending, elem, rc);
+    }
+  }
+  akw_vector_deinit(&pending);
+}
+
+static inline void *bump(char **top, size_t size)
+{
+  void *ptr = *top;
+  *top += align(size);
+  return ptr;
+}
+
+static inline void *copy_object(AkwValue val, char **top)
+{
+  if (akw_is_string(val))
+  {
+    AkwString *str = akw_as_string(val);
+    AkwString *copy = bump(top, sizeof(*copy));
+    akw_object_init(&copy->obj);
+    copy->capacity = str->length + 1;
+    copy->length = str->length;
+    copy->chars = bump(top, (size_t) copy->capacity);
+    memcpy(copy->chars, str->chars, (size_t) str->length);
+    copy->chars[str->length] = '\0';
+    return copy;
+  }
+  if (akw_is_range(val))
+  {
+    AkwRange *range = akw_as_range(val);
+    AkwRange *copy = bump(top, sizeof(*copy));
+    akw_range_init(copy, range->start, range->end);
+    return copy;
+  }
+  AkwArray *arr = akw_as_array(val);
+  int n = akw_array_count(arr);
+  AkwArray *copy = bump(top, sizeof(*copy));
+  akw_object_init(&copy->obj);
+  copy->vec.capacity = n;
+  copy->vec.count = n;
+  copy->vec.elements = bump(top, sizeof(AkwValue) * n);
+  return copy;
+}
+
+static inline void copy_graph(Map *map, AkwValue root, void *rootCopy,
+  char **top, int *rc)
+{
+  // Walks the graph in the same shape as collect, so the region is filled
+  // exactly once and every array is forwarded as soon as it is copied.
+  EntryVector pending;
+  akw_vector_init(&pending);
+  Entry first = { .val = root, .copy = rootCopy };
+  akw_vector_append(&pending, first, rc);
+  while (akw_is_ok(*rc) && !akw_vector_is_empty(&pending))
+  {
+    Entry entry = akw_vector_get(&pending, --pending.count);
+    AkwObject *obj = entry.copy;
+    obj->flags |= AKW_OBJECT_FLAG_IMMORTAL | AKW_OBJECT_FLAG_FROZEN;
+    if (!akw_is_array(entry.val)) continue;
+    AkwArray *arr = akw_as_array(entry.val);
+    AkwArray *copy = entry.copy;
+    int n = akw_array_count(arr);
+    for (int i = 0; i < n && akw_is_ok(*rc); ++i)
+    {
+      AkwValue elem = akw_array_get(arr, i);
+      if (needs_copy(elem))
+      {
+        Entry next = { .val = elem, .copy = NULL };
+        if (is_shared(elem) || elem.asPointer == root.asPointer)
+        {
+          Entry *found = map_find(map, elem.asPointer);
+          if (!found->copy)
+          {
+            found->copy = copy_object(elem, top);
+            next.copy = found->copy;
+          }
+          elem.asPointer = found->copy;
+        }
+        else
+        {
+          next.copy = copy_object(elem, top);
+          elem.asPointer = next.copy;
+        }
+        if (next.copy)
+          akw_vector_append(&pending, next, rc);
+      }
+      copy->vec.elements[i] = elem;
+    }
+  }
+  akw_vector_deinit(&pending);
+}
+
+AkwValue akw_value_freeze(AkwValue val, int *rc)
+{
+  // Takes over the caller's reference to val, and returns the frozen copy.
+  if (!needs_copy(val)) return val;
+  AkwMemoryStats *stats = akw_memory_swap_stats(NULL);
+  Map map;
+  map_init(&map, rc);
+  if (!akw_is_ok(*rc))
+  {
+    akw_memory_swap_stats(stats);
+    return val;
+  }
+  size_t size = align(sizeof(Region));
+  collect(&map, val, &size, rc);
+  Region *region = akw_is_ok(*rc) ? akw_memory_alloc_pages(size) : NULL;
+  if (!region)
+  {
+    *rc = AKW_RANGE_ERROR;
+    map_deinit(&map);
+    akw_memory_swap_stats(stats);
+    return val;
+  }
+  region->size = size;
+  char *top = (char *) region + align(sizeof(Region));
+  Entry *rootEntry = map_find(&map, val.asPointer);
+  rootEntry->copy = copy_object(val, &top);
+  copy_graph(&map, val, rootEntry->copy, &top, rc);
+  if (!akw_is_ok(*rc))
+  {
+    map_deinit(&map);
+    akw_memory_dealloc_pages(region, size);
+    akw_memory_swap_stats(stats);
+    return val;
+  }
+  AkwValue result = val;
+  result.asPointer = rootEntry->copy;
+  akw_as_object(result)->flags |= AKW_OBJECT_FLAG_REGION;
+  map_deinit(&map);
+  akw_memory_seal_pages(region, size);
+  akw_memory_swap_stats(stats);
+  akw_value_release(val);
+  return result;
+}
+
+void akw_value_free_frozen(AkwValue val)
+{
+  // Only a root copied by akw_value_freeze owns a region. Values it
+  // returned as they were, elements of a frozen graph and image constants
+  // are left alone.
+  if (!akw_is_object(val)
+   || !(akw_as_object(val)->flags & AKW_OBJECT_FLAG_REGION))
+    return;
+  Region *region = (Region *) ((char *) val.asPointer - align(sizeof(Region)));
+  akw_memory_dealloc_pages(region, region->size);
+}
@@ -0,0 +1,564 @@
+//
+// image.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/image.h"
+#include <stdio.h>
+#include <string.h>
+#include "akwan/memory.h"
+
+#ifdef _WIN32
+  #ifndef WIN32_LEAN_AND_MEAN
+    #define WIN32_LEAN_AND_MEAN
+  #endif
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#define MAGIC           "AKWI"
+#define BYTE_ORDER_MARK (0x01020304u)
+
+#define align(n) (((n) + 7) & ~(size_t) 7)
+
+// An image is a header, the code, then the constant pool. Each constant is
+// a record header followed by its payload, padded to eight bytes. Numbers
+// are stored as doubles and strings as their characters plus a NUL, so the
+// loader can point string constants straight at the mapped file.
+typedef struct
+{
+  char     magic[4];
+  uint32_t version;
+  uint32_t byteOrder;
+  uint32_t codeSize;
+  uint32_t numConsts;
+  uint32_t constsOffset;
+  uint32_t size;
+  uint32_t maxDepth;
+} Header;
+
+typedef struct
+{
+  uint32_t type;
+  uint32_t length;
+} Record;
+
+static inline void write_padding(AkwBuffer *buf, int *rc);
+static inline void write_constant(AkwBuffer *buf, AkwValue val, int *rc);
+static inline void *map_file(const char *path, size_t *size);
+static inline void unmap_file(void *ptr, size_t size);
+static inline bool check_header(AkwImage *img, Header *header);
+static inline bool has_operand(AkwOpcode op);
+static inline bool check_instruction(AkwOpcode op, int arg, int numConsts,
+  int *kinds, int *depth);
+static inline int walk_code(int size, const uint8_t *code, int numConsts,
+  int *kinds);
+static inline bool check_code(AkwImage *img, Header *header);
+static inline bool check_constants(AkwImage *img, Header *header);
+static inline void load_constants(AkwImage *img, Header *header);
+static inline void corrupted(AkwImage *img);
+static inline void image_init(AkwImage *img, bool isMapped, size_t size,
+  void *base);
+static inline void load(AkwImage *img);
+
+static inline void write_padding(AkwBuffer *buf, int *rc)
+{
+  static const uint8_t zeros[8] = { 0 };
+  int n = (int) (align((size_t) buf->count) - (size_t) buf->count);
+  if (n) akw_buffer_write(buf, n, (void *) zeros, rc);
+}
+
+static inline void write_constant(AkwBuffer *buf, AkwValue val, int *rc)
+{
+  Record record = { .type = (uint32_t) akw_type(val), .length = 0 };
+  if (akw_is_number(val))
+  {
+    double num = akw_as_number(val);
+    record.length = sizeof(num);
+    akw_buffer_write(buf, sizeof(record), &record, rc);
+    if (!akw_is_ok(*rc)) return;
+    akw_buffer_write(buf, sizeof(num), &num, rc);
+    return;
+  }
+  if (!akw_is_string(val))
+  {
+    *rc = AKW_TYPE_ERROR;
+    return;
+  }
+  AkwString *str = akw_as_string(val);
+  record.length = (uint32_t) str->length;
+  akw_buffer_write(buf, sizeof(record), &record, rc);
+  if (!akw_is_ok(*rc)) return;
+  akw_buffer_write(buf, str->length, str->chars, rc);
+  if (!akw_is_ok(*rc)) return;
+  akw_buffer_write(buf, 1, "\0", rc);
+  if (!akw_is_ok(*rc)) return;
+  write_padding(buf, rc);
+}
+
+#ifdef _WIN32
+static inline void *map_file(const char *path, size_t *size)
+{
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+    OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return NULL;
+  LARGE_INTEGER fileSize;
+  if (!GetFileSizeEx(file, &fileSize) || !fileSize.QuadPart)
+  {
+    CloseHandle(file);
+    return NULL;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(file);
+  if (!mapping) return NULL;
+  void *ptr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping);
+  *size = (size_t) fileSize.QuadPart;
+  return ptr;
+}
+
+static inline void unmap_file(void *ptr, size_t size)
+{
+  (void) size;
+  UnmapViewOfFile(ptr);
+}
+#else
+static inline void *map_file(const char *path, size_t *size)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd == -1) return NULL;
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !st.st_size)
+  {
+    close(fd);
+    return NULL;
+  }
+  void *ptr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (ptr == MAP_FAILED) return NULL;
+  *size = (size_t) st.st_size;
+  return ptr;
+}
+
+static inline void unmap_file(void *ptr, size_t size)
+{
+  munmap(ptr, size);
+}
+#endif
+
+static inline bool check_header(AkwImage *img, Header *header)
+{
+  if (img->size < sizeof(*header) || memcmp(header->magic, MAGIC, 4))
+  {
+    img->rc = AKW_SYNTAX_ERROR;
+    akw_error_set(img->err, "not an image");
+    return false;
+  }
+  if (header->byteOrder != BYTE_ORDER_MARK
+   || header->version != AKW_IMAGE_VERSION)
+  {
+    img->rc = AKW_SYNTAX_ERROR;
+    akw_error_set(img->err, "image was built by an incompatible version");
+    return false;
+  }
+  size_t codeEnd = sizeof(*header) + header->codeSize;
+  if (header->size != img->size || !header->codeSize
+   || header->constsOffset < codeEnd || header->constsOffset > img->size
+   || header->numConsts > UINT8_MAX + 1)
+  {
+    corrupted(img);
+    return false;
+  }
+  return true;
+}
+
+static inline bool has_operand(AkwOpcode op)
+{
+  switch (op)
+  {
+  case AKW_OP_INT:
+  case AKW_OP_CONST:
+  case AKW_OP_ARRAY:
+  case AKW_OP_LOCAL_REF:
+  case AKW_OP_GET_LOCAL:
+  case AKW_OP_MOVE_LOCAL:
+  case AKW_OP_SET_LOCAL:
+  case AKW_OP_GET_LOCAL_BY_REF:
+  case AKW_OP_SET_LOCAL_BY_REF:
+    return true;
+  default:
+    break;
+  }
+  return false;
+}
+
+static inline bool check_instruction(AkwOpcode op, int arg, int numConsts,
+  int *kinds, int *depth)
+{
+  // Each entry of kinds is -1 for a value, or the slot a reference points to.
+  int n = *depth;
+  int target;
+  switch (op)
+  {
+  case AKW_OP_NIL:
+  case AKW_OP_FALSE:
+  case AKW_OP_TRUE:
+  case AKW_OP_INT:
+    kinds[n++] = -1;
+    break;
+  case AKW_OP_CONST:
+    if (arg >= numConsts) return false;
+    kinds[n++] = -1;
+    break;
+  case AKW_OP_RANGE:
+  case AKW_OP_GET_ELEMENT:
+  case AKW_OP_ADD:
+  case AKW_OP_SUB:
+  case AKW_OP_MUL:
+  case AKW_OP_DIV:
+  case AKW_OP_MOD:
+    if (n < 2) return false;
+    kinds[--n - 1] = -1;
+    break;
+  case AKW_OP_NEG:
+  case AKW_OP_RETURN:
+    if (n < 1) return false;
+    break;
+  case AKW_OP_ARRAY:
+    if (n < arg) return false;
+    n -= arg - 1;
+    kinds[n - 1] = -1;
+    break;
+  case AKW_OP_LOCAL_REF:
+    if (arg >= n) return false;
+    kinds[n++] = arg;
+    break;
+  case AKW_OP_POP:
+    if (n < 1) return false;
+    --n;
+    break;
+  case AKW_OP_GET_LOCAL:
+    if (arg >= n) return false;
+    kinds[n] = kinds[arg];
+    ++n;
+    break;
+  case AKW_OP_MOVE_LOCAL:
+    if (arg >= n) return false;
+    kinds[n] = kinds[arg];
+    kinds[arg] = -1;
+    ++n;
+    break;
+  case AKW_OP_SET_LOCAL:
+    if (arg >= n - 1) return false;
+    kinds[arg] = kinds[--n];
+    break;
+  case AKW_OP_GET_LOCAL_BY_REF:
+    if (arg >= n) return false;
+    target = kinds[arg];
+    if (target < 0 || target >= n) return false;
+    kinds[n] = kinds[target];
+    ++n;
+    break;
+  case AKW_OP_SET_LOCAL_BY_REF:
+    if (arg >= n - 1) return false;
+    target = kinds[arg];
+    if (target < 0 || target >= n - 1) return false;
+    kinds[target] = kinds[--n];
+    break;
+  }
+  *depth = n;
+  return true;
+}
+
+static inline int walk_code(int size, const uint8_t *code, int numConsts,
+  int *kinds)
+{
+  // Images come from outside the process, so their code is walked once
+  // over an abstract stack before it is trusted: operands must be there,
+  // locals must be live, and indirect accesses must go through a slot that
+  // holds a reference to a live slot. Code has no jumps, so one pass covers
+  // every path. Returns the deepest the stack gets, or -1 for invalid code.
+  int depth = 0;
+  int maxDepth = 0;
+  AkwOpcode op = AKW_OP_NIL;
+  int i = 0;
+  while (i < size)
+  {
+    op = (AkwOpcode) code[i];
+    if (op > AKW_OP_RETURN) break;
+    int arg = 0;
+    if (has_operand(op))
+    {
+      if (i + 1 >= size) break;
+      arg = code[++i];
+    }
+    if (!check_instruction(op, arg, numConsts, kinds, &depth))
+      break;
+    if (depth > maxDepth) maxDepth = depth;
+    ++i;
+  }
+  return i == size && op == AKW_OP_RETURN ? maxDepth : -1;
+}
+
+static inline bool check_code(AkwImage *img, Header *header)
+{
+  // The depth recorded in the header must be the one the code reaches, so
+  // that the VM can refuse code too deep for its stack before running it.
+  uint8_t *code = (uint8_t *) img->base + sizeof(*header);
+  int n = (int) header->codeSize;
+  int *kinds = akw_memory_alloc(sizeof(*kinds) * n);
+  if (!kinds)
+  {
+    img->rc = AKW_RANGE_ERROR;
+    akw_error_set(img->err, "out of memory");
+    return false;
+  }
+  int maxDepth = walk_code(n, code, (int) header->numConsts, kinds);
+  akw_memory_dealloc(kinds, sizeof(*kinds) * n);
+  if (maxDepth != -1 && (uint32_t) maxDepth == header->maxDepth) return true;
+  img->rc = AKW_SYNTAX_ERROR;
+  akw_error_set(img->err, "image has invalid code");
+  return false;
+}
+
+static inline bool check_constants(AkwImage *img, Header *header)
+{
+  char *base = img->base;
+  size_t end = img->size;
+  size_t offset = header->constsOffset;
+  int n = (int) header->numConsts;
+  int numStrings = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    Record record;
+    if (offset > end || end - offset < sizeof(record))
+    {
+      corrupted(img);
+      return false;
+    }
+    memcpy(&record, &base[offset], sizeof(record));
+    offset += sizeof(record);
+    size_t left = end - offset;
+    if (record.type == AKW_TYPE_NUMBER
+     && record.length == sizeof(double) && left >= sizeof(double))
+    {
+      offset += sizeof(double);
+      continue;
+    }
+    if (record.type == AKW_TYPE_STRING
+     && record.length < left && !base[offset + record.length])
+    {
+      offset += align((size_t) record.length + 1);
+      ++numStrings;
+      continue;
+    }
+    corrupted(img);
+    return false;
+  }
+  img->numStrings = numStrings;
+  return true;
+}
+
+static inline void load_constants(AkwImage *img, Header *header)
+{
+  char *base = img->base;
+  int n = (int) header->numConsts;
+  int numStrings = img->numStrings;
+  if (numStrings)
+  {
+    img->strings = akw_memory_alloc(sizeof(*img->strings) * numStrings);
+    if (!img->strings)
+    {
+      img->rc = AKW_RANGE_ERROR;
+      akw_error_set(img->err, "out of memory");
+      return;
+    }
+  }
+  akw_vector_init_with_capacity(&img->chunk.consts, n, &img->rc);
+  if (!akw_image_is_ok(img))
+  {
+    akw_memory_dealloc(img->strings, sizeof(*img->strings) * numStrings);
+    akw_error_set(img->err, "out of memory");
+    return;
+  }
+  // Constants are immortal and frozen, like those of a compiled chunk.
+  // Here that also guarantees nothing writes to the read-only pages.
+  size_t offset = header->constsOffset;
+  AkwString *str = img->strings;
+  for (int i = 0; i < n; ++i)
+  {
+    Record record;
+    memcpy(&record, &base[offset], sizeof(record));
+    offset += sizeof(record);
+    AkwValue val;
+    if (record.type == AKW_TYPE_NUMBER)
+    {
+      double num;
+      memcpy(&num, &base[offset], sizeof(num));
+      offset += sizeof(num);
+      val = akw_number_value(num);
+    }
+    else
+    {
+      akw_object_init(&str->obj);
+      str->obj.flags |= AKW_OBJECT_FLAG_IMMORTAL | AKW_OBJECT_FLAG_FROZEN;
+      str->capacity = (int) record.length + 1;
+      str->length = (int) record.length;
+      str->chars = &base[offset];
+      offset += align((size_t) record.length + 1);
+      val = akw_string_value(str);
+      ++str;
+    }
+    img->chunk.consts.elements[i] = val;
+  }
+  img->chunk.consts.count = n;
+}
+
+static inline void corrupted(AkwImage *img)
+{
+  img->rc = AKW_SYNTAX_ERROR;
+  akw_error_set(img->err, "image is corrupted");
+}
+
+static inline void image_init(AkwImage *img, bool isMapped, size_t size,
+  void *base)
+{
+  img->rc = AKW_OK;
+  img->err[0] = '\0';
+  img->isMapped = isMapped;
+  img->base = base;
+  img->size = size;
+  img->numStrings = 0;
+  img->strings = NULL;
+}
+
+static inline void load(AkwImage *img)
+{
+  Header header = { 0 };
+  if (img->size >= sizeof(header))
+    memcpy(&header, img->base, sizeof(header));
+  if (!check_header(img, &header) || !check_code(img, &header)
+   || !check_constants(img, &header))
+    return;
+  AkwChunk *chunk = &img->chunk;
+  chunk->code.capacity = (int) header.codeSize;
+  chunk->code.count = (int) header.codeSize;
+  chunk->code.bytes = (uint8_t *) img->base + sizeof(header);
+  chunk->numSlots = 0;
+  chunk->slots = NULL;
+  chunk->maxDepth = (int) header.maxDepth;
+  load_constants(img, &header);
+}
+
+void akw_image_write(const AkwChunk *chunk, AkwBuffer *buf, int *rc)
+{
+  Header header = {
+    .magic = { 'A', 'K', 'W', 'I' },
+    .version = AKW_IMAGE_VERSION,
+    .byteOrder = BYTE_ORDER_MARK,
+    .codeSize = (uint32_t) chunk->code.count,
+    .numConsts = (uint32_t) chunk->consts.count,
+    .constsOffset = 0,
+    .size = 0,
+    .maxDepth = 0
+  };
+  int n = chunk->code.count;
+  int *kinds = akw_memory_alloc(sizeof(*kinds) * n);
+  if (!kinds)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  int maxDepth = walk_code(n, chunk->code.bytes, chunk->consts.count, kinds);
+  akw_memory_dealloc(kinds, sizeof(*kinds) * n);
+  if (maxDepth == -1)
+  {
+    *rc = AKW_SYNTAX_ERROR;
+    return;
+  }
+  header.maxDepth = (uint32_t) maxDepth;
+  int start = buf->count;
+  akw_buffer_write(buf, sizeof(header), &header, rc);
+  if (!akw_is_ok(*rc)) return;
+  akw_buffer_write(buf, chunk->code.count, chunk->code.bytes, rc);
+  if (!akw_is_ok(*rc)) return;
+  write_padding(buf, rc);
+  if (!akw_is_ok(*rc)) return;
+  header.constsOffset = (uint32_t) (buf->count - start);
+  n = chunk->consts.count;
+  for (int i = 0; i < n; ++i)
+  {
+    write_constant(buf, akw_vector_get(&chunk->consts, i), rc);
+    if (!akw_is_ok(*rc)) return;
+  }
+  header.size = (uint32_t) (buf->count - start);
+  memcpy(&buf->bytes[start], &header, sizeof(header));
+}
+
+void akw_image_save(const AkwChunk *chunk, const char *path, int *rc)
+{
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  akw_image_write(chunk, &buf, rc);
+  if (!akw_is_ok(*rc))
+  {
+    akw_buffer_deinit(&buf);
+    return;
+  }
+  FILE *file = fopen(path, "wb");
+  if (!file)
+  {
+    *rc = AKW_SYSTEM_ERROR;
+    akw_buffer_deinit(&buf);
+    return;
+  }
+  size_t size = (size_t) buf.count;
+  if (fwrite(buf.bytes, 1, size, file) != size)
+    *rc = AKW_SYSTEM_ERROR;
+  if (fclose(file))
+    *rc = AKW_SYSTEM_ERROR;
+  akw_buffer_deinit(&buf);
+}
+
+void akw_image_init(AkwImage *img, const char *path)
+{
+  size_t size = 0;
+  void *base = map_file(path, &size);
+  if (!base)
+  {
+    image_init(img, false, 0, NULL);
+    img->rc = AKW_SYSTEM_ERROR;
+    akw_error_set(img->err, "cannot open image '%s'", path);
+    return;
+  }
+  image_init(img, true, size, base);
+  load(img);
+  if (!akw_image_is_ok(img))
+    unmap_file(base, size);
+}
+
+void akw_image_init_from_bytes(AkwImage *img, size_t size, void *bytes)
+{
+  // The bytes are borrowed, and must outlive the image.
+  image_init(img, false, size, bytes);
+  load(img);
+}
+
+void akw_image_deinit(AkwImage *img)
+{
+  // The chunk borrows its code from the mapping, so it is not deinitialized
+  // as a compiled chunk would be.
+  akw_vector_deinit(&img->chunk.consts);
+  akw_memory_dealloc(img->strings, sizeof(*img->strings) * img->numStrings);
+  if (img->isMapped)
+    unmap_file(img->base, img->size);
+}
@@ -9,80 +9,141 @@
 //
 
 #include "akwan/lexer.h"
+#include <assert.h>
 #include <ctype.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #include "akwan/common.h"
+#include "akwan/memory.h"
+#include "akwan/scan.h"
+
+#define offset_of(l, p) ((int) ((p) - (l)->source) + (l)->base)
 
 #define char_at(l, i)   ((l)->curr[(i)])
 #define current_char(l) char_at(l, 0)
 
+#define char_class(c)   (charClasses[(uint8_t) (c)])
+#define is_digit(c)     (char_class(c) == CHAR_CLASS_DIGIT)
+#define is_name_char(c) (char_class(c) == CHAR_CLASS_ALPHA \
+  || char_class(c) == CHAR_CLASS_DIGIT)
+
+// Runs longer than this are handed to the vectorized scanners; shorter ones
+// are cheaper to finish here.
+#define SHORT_RUN (16)
+
+// The initial size of the window of a lexer reading from a stream.
+#define WINDOW_SIZE (1 << 16)
+
+// Chosen so that the six keywords land in distinct slots.
+#define keyword_hash(c, l, n) (((uint8_t) (c) + ((uint8_t) (l) << 1) + (n)) & 7)
+
+typedef enum
+{
+  CHAR_CLASS_INVALID,
+  CHAR_CLASS_EOF,
+  CHAR_CLASS_SPACE,
+  CHAR_CLASS_NEWLINE,
+  CHAR_CLASS_PUNCT,
+  CHAR_CLASS_DOT,
+  CHAR_CLASS_DIGIT,
+  CHAR_CLASS_ALPHA,
+  CHAR_CLASS_QUOTE
+} CharClass;
+
+typedef struct
+{
+  int          length;
+  const char   *chars;
+  AkwTokenKind kind;
+} Keyword;
+
+static const uint8_t charClasses[256] = {
+  ['\0'] = CHAR_CLASS_EOF,
+  ['\t'] = CHAR_CLASS_SPACE, ['\v'] = CHAR_CLASS_SPACE,
+  ['\f'] = CHAR_CLASS_SPACE, ['\r'] = CHAR_CLASS_SPACE,
+  [' '] = CHAR_CLASS_SPACE, ['\n'] = CHAR_CLASS_NEWLINE,
+  [','] = CHAR_CLASS_PUNCT, [';'] = CHAR_CLASS_PUNCT, ['('] = CHAR_CLASS_PUNCT,
+  [')'] = CHAR_CLASS_PUNCT, ['['] = CHAR_CLASS_PUNCT, [']'] = CHAR_CLASS_PUNCT,
+  ['{'] = CHAR_CLASS_PUNCT, ['}'] = CHAR_CLASS_PUNCT, ['&'] = CHAR_CLASS_PUNCT,
+  ['='] = CHAR_CLASS_PUNCT, ['+'] = CHAR_CLASS_PUNCT, ['-'] = CHAR_CLASS_PUNCT,
+  ['*'] = CHAR_CLASS_PUNCT, ['/'] = CHAR_CLASS_PUNCT, ['%'] = CHAR_CLASS_PUNCT,
+  ['.'] = CHAR_CLASS_DOT, ['"'] = CHAR_CLASS_QUOTE,
+  ['0'] = CHAR_CLASS_DIGIT, ['1'] = CHAR_CLASS_DIGIT, ['2'] = CHAR_CLASS_DIGIT,
+  ['3'] = CHAR_CLASS_DIGIT, ['4'] = CHAR_CLASS_DIGIT, ['5'] = CHAR_CLASS_DIGIT,
+  ['6'] = CHAR_CLASS_DIGIT, ['7'] = CHAR_CLASS_DIGIT, ['8'] = CHAR_CLASS_DIGIT,
+  ['9'] = CHAR_CLASS_DIGIT, ['_'] = CHAR_CLASS_ALPHA,
+  ['a'] = CHAR_CLASS_ALPHA, ['b'] = CHAR_CLASS_ALPHA, ['c'] = CHAR_CLASS_ALPHA,
+  ['d'] = CHAR_CLASS_ALPHA, ['e'] = CHAR_CLASS_ALPHA, ['f'] = CHAR_CLASS_ALPHA,
+  ['g'] = CHAR_CLASS_ALPHA, ['h'] = CHAR_CLASS_ALPHA, ['i'] = CHAR_CLASS_ALPHA,
+  ['j'] = CHAR_CLASS_ALPHA, ['k'] = CHAR_CLASS_ALPHA, ['l'] = CHAR_CLASS_ALPHA,
+  ['m'] = CHAR_CLASS_ALPHA, ['n'] = CHAR_CLASS_ALPHA, ['o'] = CHAR_CLASS_ALPHA,
+  ['p'] = CHAR_CLASS_ALPHA, ['q'] = CHAR_CLASS_ALPHA, ['r'] = CHAR_CLASS_ALPHA,
+  ['s'] = CHAR_CLASS_ALPHA, ['t'] = CHAR_CLASS_ALPHA, ['u'] = CHAR_CLASS_ALPHA,
+  ['v'] = CHAR_CLASS_ALPHA, ['w'] = CHAR_CLASS_ALPHA, ['x'] = CHAR_CLASS_ALPHA,
+  ['y'] = CHAR_CLASS_ALPHA, ['z'] = CHAR_CLASS_ALPHA, ['A'] = CHAR_CLASS_ALPHA,
+  ['B'] = CHAR_CLASS_ALPHA, ['C'] = CHAR_CLASS_ALPHA, ['D'] = CHAR_CLASS_ALPHA,
+  ['E'] = CHAR_CLASS_ALPHA, ['F'] = CHAR_CLASS_ALPHA, ['G'] = CHAR_CLASS_ALPHA,
+  ['H'] = CHAR_CLASS_ALPHA, ['I'] = CHAR_CLASS_ALPHA, ['J'] = CHAR_CLASS_ALPHA,
+  ['K'] = CHAR_CLASS_ALPHA, ['L'] = CHAR_CLASS_ALPHA, ['M'] = CHAR_CLASS_ALPHA,
+  ['N'] = CHAR_CLASS_ALPHA, ['O'] = CHAR_CLASS_ALPHA, ['P'] = CHAR_CLASS_ALPHA,
+  ['Q'] = CHAR_CLASS_ALPHA, ['R'] = CHAR_CLASS_ALPHA, ['S'] = CHAR_CLASS_ALPHA,
+  ['T'] = CHAR_CLASS_ALPHA, ['U'] = CHAR_CLASS_ALPHA, ['V'] = CHAR_CLASS_ALPHA,
+  ['W'] = CHAR_CLASS_ALPHA, ['X'] = CHAR_CLASS_ALPHA, ['Y'] = CHAR_CLASS_ALPHA,
+  ['Z'] = CHAR_CLASS_ALPHA
+};
+
+static const uint8_t punctKinds[256] = {
+  [','] = AKW_TOKEN_KIND_COMMA,    [';'] = AKW_TOKEN_KIND_SEMICOLON,
+  ['('] = AKW_TOKEN_KIND_LPAREN,   [')'] = AKW_TOKEN_KIND_RPAREN,
+  ['['] = AKW_TOKEN_KIND_LBRACKET, [']'] = AKW_TOKEN_KIND_RBRACKET,
+  ['{'] = AKW_TOKEN_KIND_LBRACE,   ['}'] = AKW_TOKEN_KIND_RBRACE,
+  ['&'] = AKW_TOKEN_KIND_AMP,      ['='] = AKW_TOKEN_KIND_EQ,
+  ['+'] = AKW_TOKEN_KIND_PLUS,     ['-'] = AKW_TOKEN_KIND_MINUS,
+  ['*'] = AKW_TOKEN_KIND_STAR,     ['/'] = AKW_TOKEN_KIND_SLASH,
+  ['%'] = AKW_TOKEN_KIND_PERCENT
+};
+
+static const Keyword keywords[8] = {
+  [1] = { 3, "nil",    AKW_TOKEN_KIND_NIL_KW    },
+  [2] = { 4, "true",   AKW_TOKEN_KIND_TRUE_KW   },
+  [4] = { 6, "return", AKW_TOKEN_KIND_RETURN_KW },
+  [5] = { 5, "false",  AKW_TOKEN_KIND_FALSE_KW  },
+  [6] = { 5, "inout",  AKW_TOKEN_KIND_INOUT_KW  },
+  [7] = { 3, "let",    AKW_TOKEN_KIND_LET_KW    }
+};
+
 static inline void skip_space(AkwLexer *lex);
-static inline void next_char(AkwLexer *lex);
-static inline void next_chars(AkwLexer *lex, int length);
-static inline bool match_char(AkwLexer *lex, char c, AkwTokenKind kind);
-static inline bool match_chars(AkwLexer *lex, const char *chars, AkwTokenKind kind);
-static inline bool match_keyword(AkwLexer *lex, const char *kw, AkwTokenKind kind);
 static inline bool match_number(AkwLexer *lex);
 static inline bool match_string(AkwLexer *lex, int *rc, AkwError err);
-static inline bool match_name(AkwLexer *lex);
+static inline void match_name(AkwLexer *lex);
 static inline AkwToken token(AkwLexer *lex, AkwTokenKind kind, int length,
   char *chars);
+static inline void unexpected_char(AkwLexer *lex, int *rc, AkwError err);
+static inline void index_lines(AkwLexer *lex, int offset);
+static inline void refill(AkwLexer *lex, int *rc, AkwError err);
+static inline void fill_window(AkwLexer *lex, int *rc, AkwError err);
+static inline void grow_window(AkwLexer *lex, int *rc, AkwError err);
 
 static inline void skip_space(AkwLexer *lex)
 {
-  while (isspace(current_char(lex)))
-    next_char(lex);
-}
-
-static inline void next_char(AkwLexer *lex)
-{
-  if (current_char(lex) == '\n')
+  for (;;)
   {
-    ++lex->ln;
-    lex->col = 1;
-    ++lex->curr;
-    return;
+    CharClass class = char_class(current_char(lex));
+    if (class == CHAR_CLASS_NEWLINE)
+    {
+      ++lex->curr;
+      continue;
+    }
+    if (class != CHAR_CLASS_SPACE) break;
+    int length = 1;
+    while (length < SHORT_RUN && char_class(char_at(lex, length)) == CHAR_CLASS_SPACE)
+      ++length;
+    if (length == SHORT_RUN)
+      length = (int) (akw_scan_blanks(lex->curr) - lex->curr);
+    lex->curr += length;
   }
-  ++lex->col;
-  ++lex->curr;
-}
-
-static inline void next_chars(AkwLexer *lex, int length)
-{
-  for (int i = 0; i < length; ++i)
-    next_char(lex);
-}
-
-static inline bool match_char(AkwLexer *lex, char c, AkwTokenKind kind)
-{
-  if (current_char(lex) != c)
-    return false;
-  lex->token = token(lex, kind, 1, lex->curr);
-  next_char(lex);
-  return true;
-}
-
-static inline bool match_chars(AkwLexer *lex, const char *chars, AkwTokenKind kind)
-{
-  int length = (int) strlen(chars);
-  if (memcmp(lex->curr, chars, length))
-    return false;
-  lex->token = token(lex, kind, length, lex->curr);
-  next_chars(lex, length);
-  return true;
-}
-
-static inline bool match_keyword(AkwLexer *lex, const char *kw, AkwTokenKind kind)
-{
-  int length = (int) strlen(kw);
-  if (strncmp(lex->curr, kw, length)
-   || (isalnum(char_at(lex, length)))
-   || (char_at(lex, length) == '_'))
-    return false;
-  lex->token = token(lex, kind, length, lex->curr);
-  next_chars(lex, length);
-  return true;
 }
 
 static inline bool match_number(AkwLexer *lex)
@@ -92,75 +153,85 @@ static inline bool match_number(AkwLexer *lex)
     ++length;
   else
   {
-    if (char_at(lex, length) < '1' || char_at(lex, length) > '9')
-      return false;
     ++length;
-    while (isdigit(char_at(lex, length)))
+    while (is_digit(char_at(lex, length)))
       ++length;
   }
   AkwTokenKind kind = AKW_TOKEN_KIND_INT;
   if (char_at(lex, length) == '.')
   {
     kind = AKW_TOKEN_KIND_NUMBER;
-    if (!isdigit(char_at(lex, length + 1)))
+    if (!is_digit(char_at(lex, length + 1)))
       goto end;
     length += 2;
-    while (isdigit(char_at(lex, length)))
+    while (is_digit(char_at(lex, length)))
       ++length;
   }
   if (char_at(lex, length) == 'e' || char_at(lex, length) == 'E')
   {
+    kind = AKW_TOKEN_KIND_NUMBER;
     ++length;
     if (char_at(lex, length) == '+' || char_at(lex, length) == '-')
       ++length;
-    if (!isdigit(char_at(lex, length)))
+    if (!is_digit(char_at(lex, length)))
       return false;
     ++length;
-    while (isdigit(char_at(lex, length)))
+    while (is_digit(char_at(lex, length)))
       ++length;
   }
-  if (isalnum(char_at(lex, length)) || char_at(lex, length) == '_')
+  if (is_name_char(char_at(lex, length)))
     return false;
 end:
   lex->token = token(lex, kind, length, lex->curr);
-  next_chars(lex, length);
+  lex->curr += length;
   return true;
 }
 
 static inline bool match_string(AkwLexer *lex, int *rc, AkwError err)
 {
-  if (current_char(lex) != '\"') return false;
-  int n = 1;
-  for (;;)
+  char *end = &lex->curr[1];
+  while (end < &lex->curr[SHORT_RUN] && *end != '"' && *end)
+    ++end;
+  if (end == &lex->curr[SHORT_RUN])
+    end = akw_scan_string(end);
+  while (end == lex->end)
   {
-    if (char_at(lex, n) == '\"')
-    {
-      ++n;
-      break;
-    }
-    if (char_at(lex, n) == '\0')
-    {
-      *rc = AKW_LEXICAL_ERROR;
-      akw_error_set(err, "unterminated string in %d,%d", lex->ln, lex->col);
-      return false;
-    }
-    ++n;
+    // The string runs past the window, so the window is moved on and the
+    // scan goes on from where it stopped.
+    int scanned = (int) (end - lex->curr);
+    refill(lex, rc, err);
+    if (!akw_is_ok(*rc)) return false;
+    end = akw_scan_string(&lex->curr[scanned]);
   }
-  lex->token = token(lex, AKW_TOKEN_KIND_STRING, n - 2, &lex->curr[1]);
-  next_chars(lex, n);
+  if (!*end)
+  {
+    int ln;
+    int col;
+    akw_lexer_position(lex, offset_of(lex, lex->curr), &ln, &col);
+    *rc = AKW_LEXICAL_ERROR;
+    akw_error_set(err, "unterminated string in %d,%d", ln, col);
+    return false;
+  }
+  int n = (int) (end - lex->curr) + 1;
+  lex->token = token(lex, AKW_TOKEN_KIND_STRING, n, lex->curr);
+  lex->curr += n;
   return true;
 }
 
-static inline bool match_name(AkwLexer *lex)
+static inline void match_name(AkwLexer *lex)
 {
-  if (current_char(lex) != '_' && !isalpha(current_char(lex)))
-    return false;
+  char *chars = lex->curr;
   int length = 1;
-  while (char_at(lex, length) == '_' || isalnum(char_at(lex, length)))
+  while (length < SHORT_RUN && is_name_char(chars[length]))
     ++length;
-  lex->token = token(lex, AKW_TOKEN_KIND_NAME, length, lex->curr);
-  next_chars(lex, length);
-  return true;
+  if (length == SHORT_RUN)
+    length = (int) (akw_scan_name(chars) - chars);
+  AkwTokenKind kind = AKW_TOKEN_KIND_NAME;
+  const Keyword *kw = &keywords[keyword_hash(chars[0], chars[length - 1], length)];
+  if (kw->length == length && !memcmp(chars, kw->chars, length))
+    kind = kw->kind;
+  lex->token = token(lex, kind, length, chars);
+  lex->curr += length;
 }
 
 static inline AkwToken token(AkwLexer *lex, AkwTokenKind kind, int length,
@@ -168,13 +239,126 @@ static inline AkwToken token(AkwLexer *lex, AkwTokenKind kind, int length,
 {
   return (AkwToken) {
     .kind = kind,
-    .ln = lex->ln,
-    .col = lex->col,
-    .length = length,
-    .chars = chars
+    .offset = offset_of(lex, chars),
+    .length = length
   };
 }
 
+static inline void unexpected_char(AkwLexer *lex, int *rc, AkwError err)
+{
+  char c = current_char(lex);
+  c = isprint(c) ? c : '?';
+  int ln;
+  int col;
+  akw_lexer_position(lex, offset_of(lex, lex->curr), &ln, &col);
+  *rc = AKW_LEXICAL_ERROR;
+  akw_error_set(err, "unexpected character '%c' in %d,%d", c, ln, col);
+}
+
+static inline void index_lines(AkwLexer *lex, int offset)
+{
+  // Records the start of every line up to offset. Lines are only indexed
+  // as far as they are asked for.
+  if (!lex->lineStarts.elements)
+  {
+    akw_vector_init(&lex->lineStarts);
+    lex->lineStarts.elements[lex->lineStarts.count++] = 0;
+  }
+  while (lex->indexed <= offset)
+  {
+    char *end = akw_scan_line(&lex->source[lex->indexed - lex->base]);
+    if (!*end) break;
+    lex->indexed = offset_of(lex, end) + 1;
+    int rc = AKW_OK;
+    akw_vector_append(&lex->lineStarts, lex->indexed, &rc);
+    assert(akw_is_ok(rc));
+  }
+}
+
+static inline void refill(AkwLexer *lex, int *rc, AkwError err)
+{
+  // Drops everything before the current character. Lines are indexed
+  // before they are dropped, so that positions can still be worked out for
+  // them.
+  index_lines(lex, offset_of(lex, lex->curr));
+  *lex->end = lex->hidden;
+  int kept = lex->length - (int) (lex->curr - lex->source);
+  memmove(lex->source, lex->curr, kept);
+  lex->base = offset_of(lex, lex->curr);
+  lex->length = kept;
+  lex->curr = lex->source;
+  if (kept > lex->capacity >> 1)
+  {
+    grow_window(lex, rc, err);
+    if (!akw_is_ok(*rc)) return;
+  }
+  fill_window(lex, rc, err);
+}
+
+static inline void fill_window(AkwLexer *lex, int *rc, AkwError err)
+{
+  // Reads until the window is full, then ends it after its last newline.
+  // The character there is hidden under the NUL until the next refill.
+  for (;;)
+  {
+    int n = 0;
+    while (lex->length < lex->capacity)
+    {
+      n = lex->read(lex->userData, lex->capacity - lex->length,
+        &lex->source[lex->length]);
+      if (n <= 0) break;
+      lex->length += n;
+    }
+    if (n < 0)
+    {
+      *rc = AKW_SYSTEM_ERROR;
+      akw_error_set(err, "cannot read source code");
+      return;
+    }
+    if (lex->base > INT_MAX - lex->length)
+    {
+      *rc = AKW_RANGE_ERROR;
+      akw_error_set(err, "source code too large");
+      return;
+    }
+    lex->source[lex->length] = '\0';
+    if (lex->length < lex->capacity)
+    {
+      lex->end = NULL;
+      return;
+    }
+    char *end = &lex->source[lex->length];
+    while (end > lex->source && end[-1] != '\n')
+      --end;
+    if (end > lex->source)
+    {
+      lex->end = end;
+      lex->hidden = *end;
+      *end = '\0';
+      return;
+    }
+    grow_window(lex, rc, err);
+    if (!akw_is_ok(*rc)) return;
+  }
+}
+
+static inline void grow_window(AkwLexer *lex, int *rc, AkwError err)
+{
+  int capacity = lex->capacity << 1;
+  char *source = NULL;
+  if (capacity <= AKW_MAX_CAPACITY)
+    source = akw_memory_realloc(lex->source, lex->capacity + 1, capacity + 1);
+  if (!source)
+  {
+    *rc = AKW_RANGE_ERROR;
+    akw_error_set(err, "source line too long");
+    return;
+  }
+  lex->curr = &source[lex->curr - lex->source];
+  lex->source = source;
+  lex->capacity = capacity;
+}
+
 const char *akw_token_kind_name(AkwTokenKind kind)
 {
   char *name = "Eof";
@@ -265,46 +449,116 @@ const char *akw_token_kind_name(AkwTokenKind kind)
 }
 
 void akw_lexer_init(AkwLexer *lex, char *source, int *rc, AkwError err)
+{
+  akw_lexer_init_source(lex, source);
+  akw_lexer_next(lex, rc, err);
+}
+
+void akw_lexer_init_source(AkwLexer *lex, char *source)
 {
   lex->source = source;
   lex->curr = source;
-  lex->ln = 1;
-  lex->col = 1;
+  lex->indexed = 0;
+  lex->lineStarts.capacity = 0;
+  lex->lineStarts.count = 0;
+  lex->lineStarts.elements = NULL;
+  lex->read = NULL;
+  lex->userData = NULL;
+  lex->base = 0;
+  lex->length = 0;
+  lex->capacity = 0;
+  lex->end = NULL;
+  lex->hidden = '\0';
+}
+
+void akw_lexer_init_stream(AkwLexer *lex, AkwReadFn read, void *userData,
+  int *rc, AkwError err)
+{
+  char *source = akw_memory_alloc(WINDOW_SIZE + 1);
+  akw_lexer_init_source(lex, source);
+  if (!source)
+  {
+    *rc = AKW_RANGE_ERROR;
+    akw_error_set(err, "out of memory");
+    return;
+  }
+  lex->read = read;
+  lex->userData = userData;
+  lex->capacity = WINDOW_SIZE;
+  fill_window(lex, rc, err);
+  if (!akw_is_ok(*rc)) return;
   akw_lexer_next(lex, rc, err);
 }
 
+void akw_lexer_deinit(AkwLexer *lex)
+{
+  if (lex->read)
+    akw_memory_dealloc(lex->source, lex->capacity + 1);
+  if (!lex->lineStarts.elements) return;
+  akw_vector_deinit(&lex->lineStarts);
+}
+
 void akw_lexer_next(AkwLexer *lex, int *rc, AkwError err)
 {
   skip_space(lex);
-  if (match_char(lex, 0, AKW_TOKEN_KIND_EOF)) return;
-  if (match_char(lex, ',', AKW_TOKEN_KIND_COMMA)) return;
-  if (match_char(lex, ';', AKW_TOKEN_KIND_SEMICOLON)) return;
-  if (match_char(lex, '(', AKW_TOKEN_KIND_LPAREN)) return;
-  if (match_char(lex, ')', AKW_TOKEN_KIND_RPAREN)) return;
-  if (match_char(lex, '[', AKW_TOKEN_KIND_LBRACKET)) return;
-  if (match_char(lex, ']', AKW_TOKEN_KIND_RBRACKET)) return;
-  if (match_char(lex, '{', AKW_TOKEN_KIND_LBRACE)) return;
-  if (match_char(lex, '}', AKW_TOKEN_KIND_RBRACE)) return;
-  if (match_char(lex, '&', AKW_TOKEN_KIND_AMP)) return;
-  if (match_char(lex, '=', AKW_TOKEN_KIND_EQ)) return;
-  if (match_char(lex, '+', AKW_TOKEN_KIND_PLUS)) return;
-  if (match_char(lex, '-', AKW_TOKEN_KIND_MINUS)) return;
-  if (match_char(lex, '*', AKW_TOKEN_KIND_STAR)) return;
-  if (match_char(lex, '/', AKW_TOKEN_KIND_SLASH)) return;
-  if (match_char(lex, '%', AKW_TOKEN_KIND_PERCENT)) return;
-  if (match_chars(lex, "..", AKW_TOKEN_KIND_DOTDOT)) return;
-  if (match_number(lex)) return;
-  if (match_string(lex, rc, err) || !akw_is_ok(*rc)) return;
-  if (match_keyword(lex, "false", AKW_TOKEN_KIND_FALSE_KW)) return;
-  if (match_keyword(lex, "inout", AKW_TOKEN_KIND_INOUT_KW)) return;
-  if (match_keyword(lex, "let", AKW_TOKEN_KIND_LET_KW)) return;
-  if (match_keyword(lex, "nil", AKW_TOKEN_KIND_NIL_KW)) return;
-  if (match_keyword(lex, "return", AKW_TOKEN_KIND_RETURN_KW)) return;
-  if (match_keyword(lex, "true", AKW_TOKEN_KIND_TRUE_KW)) return;
-  if (match_name(lex)) return;
+  while (lex->curr == lex->end)
+  {
+    refill(lex, rc, err);
+    if (!akw_is_ok(*rc)) return;
+    skip_space(lex);
+  }
   char c = current_char(lex);
-  c = isprint(c) ? c : '?';
-  *rc = AKW_LEXICAL_ERROR;
-  akw_error_set(err, "unexpected character '%c' in %d,%d", c, lex->ln,
-    lex->col);
+  switch (char_class(c))
+  {
+  case CHAR_CLASS_EOF:
+    lex->token = token(lex, AKW_TOKEN_KIND_EOF, 1, lex->curr);
+    return;
+  case CHAR_CLASS_PUNCT:
+    lex->token = token(lex, punctKinds[(uint8_t) c], 1, lex->curr);
+    ++lex->curr;
+    return;
+  case CHAR_CLASS_DOT:
+    if (char_at(lex, 1) != '.') break;
+    lex->token = token(lex, AKW_TOKEN_KIND_DOTDOT, 2, lex->curr);
+    lex->curr += 2;
+    return;
+  case CHAR_CLASS_DIGIT:
+    if (!match_number(lex)) break;
+    return;
+  case CHAR_CLASS_QUOTE:
+    match_string(lex, rc, err);
+    return;
+  case CHAR_CLASS_ALPHA:
+    match_name(lex);
+    return;
+  default:
+    break;
+  }
+  unexpected_char(lex, rc, err);
+}
+
+void akw_lexer_position(AkwLexer *lex, int offset, int *ln, int *col)
+{
+  // Offsets outside the source, such as those of parameters, have no
+  // position.
+  if (offset < 0)
+  {
+    *ln = 0;
+    *col = 0;
+    return;
+  }
+  index_lines(lex, offset);
+  int *starts = lex->lineStarts.elements;
+  int lo = 0;
+  int hi = lex->lineStarts.count - 1;
+  while (lo < hi)
+  {
+    int mid = (lo + hi + 1) >> 1;
+    if (starts[mid] <= offset)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  *ln = lo + 1;
+  *col = offset - starts[lo] + 1;
 }
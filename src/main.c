@@ -9,22 +9,143 @@
 //
 
 #include <akwan.h>
-#include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
-static inline void read_from_stdin(AkwBuffer *buf, int *rc);
+typedef struct
+{
+  bool   memStats;
+  size_t memLimit;
+  bool   batch;
+  bool   check;
+  int    numWorkers;
+  int    numFiles;
+  char   **files;
+  char   *emitPath;
+  char   *imagePath;
+  char   *cacheDir;
+  bool   cacheStats;
+  bool   pipeline;
+} Options;
+
+typedef struct
+{
+  AkwMutex mutex;
+  char     **files;
+  int      numFailed;
+} BatchOutput;
+
+static inline bool parse_options(Options *opts, int argc, char *argv[]);
 static inline void print_error(char *err);
+static inline void print_usage(const char *program);
+static inline void print_mem_stats(AkwMemoryStats *stats);
+static inline void print_cache_stats(AkwCache *cache);
+static void print_batch_result(AkwBatchJob *job, AkwValue result, void *userData);
+static inline int run_batch(Options *opts);
+static inline const char *error_kind(int rc);
+static inline void print_json_string(const char *str);
+static inline int run_check(Options *opts);
+static inline int emit_image(Options *opts, AkwChunk *chunk);
+static inline int run_chunk(Options *opts, AkwChunk *chunk);
+static inline int run_image(Options *opts);
+static inline int run_cached(Options *opts, char *source);
 
-static inline void read_from_stdin(AkwBuffer *buf, int *rc)
+static inline bool parse_options(Options *opts, int argc, char *argv[])
 {
-  int c;
-  while ((c = getchar()) != EOF)
+  opts->memStats = false;
+  opts->memLimit = 0;
+  opts->batch = false;
+  opts->check = false;
+  opts->numWorkers = 0;
+  opts->numFiles = 0;
+  opts->files = &argv[argc];
+  opts->emitPath = NULL;
+  opts->imagePath = NULL;
+  opts->cacheDir = NULL;
+  opts->cacheStats = false;
+  opts->pipeline = false;
+  for (int i = 1; i < argc; ++i)
   {
-    akw_buffer_write(buf, 1, &c, rc);
-    if (!akw_is_ok(*rc)) return;
+    char *arg = argv[i];
+    if (arg[0] != '-')
+    {
+      if (!opts->numFiles)
+        opts->files = &argv[i];
+      else if (opts->files + opts->numFiles != &argv[i])
+        return false;
+      ++opts->numFiles;
+      continue;
+    }
+    if (!strcmp(arg, "--mem-stats"))
+    {
+      opts->memStats = true;
+      continue;
+    }
+    if (!strcmp(arg, "--mem-limit") && i + 1 < argc)
+    {
+      char *end;
+      opts->memLimit = (size_t) strtoull(argv[++i], &end, 10);
+      if (*end) return false;
+      continue;
+    }
+    if (!strcmp(arg, "--emit") && i + 1 < argc)
+    {
+      opts->emitPath = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--image") && i + 1 < argc)
+    {
+      opts->imagePath = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--cache") && i + 1 < argc)
+    {
+      opts->cacheDir = argv[++i];
+      continue;
+    }
+    if (!strcmp(arg, "--cache-stats"))
+    {
+      opts->cacheStats = true;
+      continue;
+    }
+    if (!strcmp(arg, "--pipeline"))
+    {
+      opts->pipeline = true;
+      continue;
+    }
+    if (!strcmp(arg, "--batch"))
+    {
+      opts->batch = true;
+      continue;
+    }
+    if (!strcmp(arg, "--check"))
+    {
+      opts->check = true;
+      continue;
+    }
+    if (!strcmp(arg, "--jobs") && i + 1 < argc)
+    {
+      char *end;
+      opts->numWorkers = (int) strtol(argv[++i], &end, 10);
+      if (*end || opts->numWorkers < 1) return false;
+      continue;
+    }
+    return false;
   }
-  akw_buffer_write(buf, 1, "\0", rc);
+  if ((opts->emitPath || opts->imagePath)
+   && (opts->batch || (opts->emitPath && opts->imagePath)))
+    return false;
+  if ((opts->cacheStats && !opts->cacheDir)
+   || (opts->cacheDir && opts->imagePath))
+    return false;
+  if (opts->pipeline && (opts->batch || opts->imagePath))
+    return false;
+  if (opts->check && (opts->batch || opts->memStats || opts->memLimit
+   || opts->emitPath || opts->imagePath || opts->cacheDir || opts->pipeline))
+    return false;
+  return (opts->batch || opts->check) ? opts->numFiles > 0
+    : opts->numFiles <= 1;
 }
 
 static inline void print_error(char *err)
@@ -32,64 +153,366 @@ static inline void print_error(char *err)
   fprintf(stderr, "ERROR: %s\n", err);
 }
 
-int main(void)
+static inline void print_usage(const char *program)
+{
+  fprintf(stderr, "usage: %s [--mem-stats] [--mem-limit <bytes>]"
+    " [--cache <dir> [--cache-stats]] [--pipeline] [<file>]\n"
+    "       %s --emit <image> [--cache <dir>] [--pipeline] [<file>]\n"
+    "       %s --image <image> [--mem-stats] [--mem-limit <bytes>]\n"
+    "       %s --batch [--jobs <n>] [--mem-limit <bytes>]"
+    " [--cache <dir> [--cache-stats]] <file>...\n"
+    "       %s --check [--jobs <n>] <file>...\n",
+    program, program, program, program, program);
+}
+
+static inline void print_mem_stats(AkwMemoryStats *stats)
+{
+  fprintf(stderr, "; memory: %zu byte(s) in use, %zu byte(s) peak\n",
+    stats->bytes, stats->peakBytes);
+  AkwType types[] = { AKW_TYPE_STRING, AKW_TYPE_RANGE, AKW_TYPE_ARRAY };
+  int n = (int) (sizeof(types) / sizeof(*types));
+  for (int i = 0; i < n; ++i)
+  {
+    AkwType type = types[i];
+    fprintf(stderr, "; %-6s %lld live object(s)\n", akw_type_name(type),
+      stats->objects[type]);
+  }
+}
+
+static inline void print_cache_stats(AkwCache *cache)
+{
+  AkwCacheStats stats;
+  akw_cache_get_stats(cache, &stats);
+  fprintf(stderr, "; cache: %lld hit(s), %lld disk hit(s), %lld miss(es)\n",
+    stats.hits, stats.diskHits, stats.misses);
+  fprintf(stderr, "; cache: %lld eviction(s), %lld disk eviction(s)\n",
+    stats.evictions, stats.diskEvictions);
+}
+
+static void print_batch_result(AkwBatchJob *job, AkwValue result, void *userData)
 {
-  // Read source code
-  AkwBuffer buf;
-  akw_buffer_init(&buf);
+  BatchOutput *out = userData;
+  char *file = out->files[job->index];
+  AkwWriter w;
+  akw_writer_init(&w, stdout);
+  akw_mutex_lock(&out->mutex);
+  akw_writer_write(&w, (int) strlen(file), file);
+  akw_writer_write(&w, 2, ": ");
+  akw_writer_write_value(&w, result, false);
+  akw_writer_write(&w, 1, "\n");
+  akw_writer_flush(&w);
+  akw_mutex_unlock(&out->mutex);
+  akw_writer_deinit(&w);
+}
+
+static inline int run_batch(Options *opts)
+{
+  int n = opts->numFiles;
+  AkwSource *srcs = malloc(sizeof(*srcs) * n);
+  AkwBatchJob *jobs = malloc(sizeof(*jobs) * n);
+  if (!srcs || !jobs)
+  {
+    print_error("out of memory");
+    free(srcs);
+    free(jobs);
+    return EXIT_FAILURE;
+  }
+  for (int i = 0; i < n; ++i)
+  {
+    AkwSource *src = &srcs[i];
+    int rc = AKW_OK;
+    akw_source_init(src, opts->files[i], &rc);
+    akw_batch_job_init(&jobs[i], i, src->chars);
+    if (akw_is_ok(rc)) continue;
+    jobs[i].source = NULL;
+    jobs[i].rc = rc;
+    akw_error_set(jobs[i].err, "cannot read file");
+  }
+  AkwCache cache;
   int rc = AKW_OK;
-  read_from_stdin(&buf, &rc);
+  if (opts->cacheDir)
+    akw_cache_init(&cache, opts->cacheDir, &rc);
   if (!akw_is_ok(rc))
   {
-    assert(rc == AKW_RANGE_ERROR);
-    print_error("source code too large");
-    akw_buffer_deinit(&buf);
+    print_error("cannot open compile cache");
+    for (int i = 0; i < n; ++i)
+      if (jobs[i].source) akw_source_deinit(&srcs[i]);
+    free(srcs);
+    free(jobs);
     return EXIT_FAILURE;
   }
+  BatchOutput out = { .files = opts->files, .numFailed = 0 };
+  akw_mutex_init(&out.mutex);
+  AkwBatchOptions batchOpts;
+  akw_batch_options_init(&batchOpts);
+  if (opts->numWorkers)
+    batchOpts.numWorkers = opts->numWorkers;
+  batchOpts.memLimit = opts->memLimit;
+  batchOpts.cache = opts->cacheDir ? &cache : NULL;
+  batchOpts.onResult = print_batch_result;
+  batchOpts.userData = &out;
+  akw_batch_run(&batchOpts, n, jobs, NULL, &rc);
+  if (!akw_is_ok(rc))
+    print_error("cannot start worker threads");
+  for (int i = 0; i < n; ++i)
+  {
+    AkwBatchJob *job = &jobs[i];
+    if (!akw_is_ok(job->rc))
+    {
+      fprintf(stderr, "%s: ERROR: %s\n", opts->files[i], job->err);
+      ++out.numFailed;
+    }
+    if (job->source) akw_source_deinit(&srcs[i]);
+  }
+  if (opts->cacheDir)
+  {
+    if (opts->cacheStats)
+      print_cache_stats(&cache);
+    akw_cache_deinit(&cache);
+  }
+  akw_mutex_deinit(&out.mutex);
+  free(srcs);
+  free(jobs);
+  return (akw_is_ok(rc) && !out.numFailed) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-  // Compile
-  AkwCompiler comp;
-  akw_compiler_init(&comp, 0, (char *) buf.bytes);
-  if (!akw_compiler_is_ok(&comp))
+static inline const char *error_kind(int rc)
+{
+  switch (rc)
   {
-    print_error(comp.err);
-    akw_buffer_deinit(&buf);
+  case AKW_LEXICAL_ERROR:
+    return "lexical";
+  case AKW_SYNTAX_ERROR:
+    return "syntax";
+  case AKW_SEMANTIC_ERROR:
+    return "semantic";
+  case AKW_TYPE_ERROR:
+    return "type";
+  case AKW_RANGE_ERROR:
+    return "range";
+  default:
+    break;
+  }
+  return "system";
+}
+
+static inline void print_json_string(const char *str)
+{
+  putchar('"');
+  for (const unsigned char *p = (const unsigned char *) str; *p; ++p)
+  {
+    int c = *p;
+    if (c == '"' || c == '\\')
+      printf("\\%c", c);
+    else if (c < 0x20)
+      printf("\\u%04x", c);
+    else
+      putchar(c);
+  }
+  putchar('"');
+}
+
+static inline int run_check(Options *opts)
+{
+  int n = opts->numFiles;
+  AkwBatchJob *jobs = malloc(sizeof(*jobs) * n);
+  if (!jobs)
+  {
+    print_error("out of memory");
     return EXIT_FAILURE;
   }
-  akw_compiler_compile(&comp);
-  if (!akw_compiler_is_ok(&comp))
+  for (int i = 0; i < n; ++i)
+    akw_batch_job_init_file(&jobs[i], i, opts->files[i]);
+  AkwBatchOptions batchOpts;
+  akw_batch_options_init(&batchOpts);
+  batchOpts.checkOnly = true;
+  if (opts->numWorkers)
+    batchOpts.numWorkers = opts->numWorkers;
+  int rc = AKW_OK;
+  akw_batch_run(&batchOpts, n, jobs, NULL, &rc);
+  if (!akw_is_ok(rc))
   {
-    print_error(comp.err);
-    akw_buffer_deinit(&buf);
-    akw_compiler_deinit(&comp);
+    print_error("cannot start worker threads");
+    free(jobs);
+    return EXIT_FAILURE;
+  }
+  // One JSON object per line for each file that failed, in the order given.
+  int numFailed = 0;
+  for (int i = 0; i < n; ++i)
+  {
+    AkwBatchJob *job = &jobs[i];
+    if (akw_is_ok(job->rc)) continue;
+    fputs("{\"file\":", stdout);
+    print_json_string(opts->files[i]);
+    printf(",\"kind\":\"%s\",\"message\":", error_kind(job->rc));
+    print_json_string(job->err);
+    fputs("}\n", stdout);
+    ++numFailed;
+  }
+  free(jobs);
+  if (fflush(stdout))
+  {
+    print_error("cannot write result");
     return EXIT_FAILURE;
   }
+  return numFailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+static inline int emit_image(Options *opts, AkwChunk *chunk)
+{
+  int rc = AKW_OK;
+  akw_image_save(chunk, opts->emitPath, &rc);
+  if (akw_is_ok(rc)) return EXIT_SUCCESS;
+  print_error("cannot write image");
+  return EXIT_FAILURE;
+}
 
+static inline int run_chunk(Options *opts, AkwChunk *chunk)
+{
   // Dump
-  akw_dump_chunk(&comp.chunk);
+  akw_dump_chunk(chunk);
 
   // Run
   AkwVM vm;
   akw_vm_init(&vm, AKW_VM_DEFAULT_STACK_SIZE);
-  akw_vm_run(&vm, &comp.chunk);
+  int rc = AKW_OK;
+  akw_vm_set_memory_limit(&vm, opts->memLimit, &rc);
+  if (!akw_is_ok(rc))
+  {
+    fprintf(stderr, "ERROR: memory limit below the %zu byte(s) the VM needs\n",
+      vm.memStats.bytes);
+    akw_vm_deinit(&vm);
+    return EXIT_FAILURE;
+  }
+  akw_vm_run(&vm, chunk);
+  if (opts->memStats)
+    print_mem_stats(&vm.memStats);
   if (!akw_vm_is_ok(&vm))
   {
     print_error(vm.err);
-    akw_buffer_deinit(&buf);
-    akw_compiler_deinit(&comp);
     akw_vm_deinit(&vm);
     return EXIT_FAILURE;
   }
 
   // Print result
-  AkwValue result = akw_vm_peek(&vm);
-  akw_value_print(result, false);
+  AkwWriter w;
+  akw_writer_init(&w, stdout);
+  akw_writer_write_value(&w, akw_vm_peek(&vm), false);
+  akw_writer_write(&w, 1, "\n");
+  akw_writer_deinit(&w);
   akw_vm_pop(&vm);
-  printf("\n");
-
-  // Cleanup
-  akw_buffer_deinit(&buf);
-  akw_compiler_deinit(&comp);
   akw_vm_deinit(&vm);
+  if (!akw_writer_is_ok(&w))
+  {
+    print_error("cannot write result");
+    return EXIT_FAILURE;
+  }
   return EXIT_SUCCESS;
 }
+
+static inline int run_image(Options *opts)
+{
+  AkwImage img;
+  akw_image_init(&img, opts->imagePath);
+  if (!akw_image_is_ok(&img))
+  {
+    print_error(img.err);
+    return EXIT_FAILURE;
+  }
+  int status = run_chunk(opts, &img.chunk);
+  akw_image_deinit(&img);
+  return status;
+}
+
+static inline int run_cached(Options *opts, char *source)
+{
+  AkwCache cache;
+  int rc = AKW_OK;
+  akw_cache_init(&cache, opts->cacheDir, &rc);
+  if (!akw_is_ok(rc))
+  {
+    print_error("cannot open compile cache");
+    return EXIT_FAILURE;
+  }
+  AkwError err;
+  int flags = opts->pipeline ? AKW_COMPILER_FLAG_PIPELINED : 0;
+  AkwCacheEntry *entry = akw_cache_compile(&cache, flags, source, err, &rc);
+  int status = EXIT_FAILURE;
+  if (!entry)
+    print_error(err);
+  else
+  {
+    AkwChunk *chunk = &entry->image.chunk;
+    status = opts->emitPath ? emit_image(opts, chunk) : run_chunk(opts, chunk);
+    akw_cache_release(&cache, entry);
+  }
+  if (opts->cacheStats)
+    print_cache_stats(&cache);
+  akw_cache_deinit(&cache);
+  return status;
+}
+
+int main(int argc, char *argv[])
+{
+  Options opts;
+  if (!parse_options(&opts, argc, argv))
+  {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  if (opts.batch)
+    return run_batch(&opts);
+
+  if (opts.check)
+    return run_check(&opts);
+
+  if (opts.imagePath)
+    return run_image(&opts);
+
+  // Read source code. Without a cache, which needs all of it, a source
+  // that cannot be mapped is compiled as it is read.
+  AkwSource src;
+  int rc = AKW_OK;
+  char *path = opts.numFiles ? opts.files[0] : NULL;
+  if (opts.cacheDir)
+    akw_source_init(&src, path, &rc);
+  else
+    akw_source_open(&src, path, &rc);
+  if (!akw_is_ok(rc))
+  {
+    print_error(rc == AKW_RANGE_ERROR ? "source code too large"
+      : "cannot read source code");
+    return EXIT_FAILURE;
+  }
+
+  if (opts.cacheDir)
+  {
+    int status = run_cached(&opts, src.chars);
+    akw_source_deinit(&src);
+    return status;
+  }
+
+  // Compile
+  AkwCompiler comp;
+  int flags = opts.pipeline ? AKW_COMPILER_FLAG_PIPELINED : 0;
+  if (src.chars)
+    akw_compiler_init(&comp, flags, src.chars);
+  else
+    akw_compiler_init_stream(&comp, flags, akw_source_read, &src);
+  if (akw_compiler_is_ok(&comp))
+    akw_compiler_compile(&comp);
+  if (!akw_compiler_is_ok(&comp))
+  {
+    print_error(comp.err);
+    akw_compiler_deinit(&comp);
+    akw_source_deinit(&src);
+    return EXIT_FAILURE;
+  }
+
+  int status = opts.emitPath ? emit_image(&opts, &comp.chunk)
+    : run_chunk(&opts, &comp.chunk);
+  akw_compiler_deinit(&comp);
+  akw_source_deinit(&src);
+  return status;
+}
@@ -8,20 +8,243 @@
 // located in the root directory of this project.
 //
 
+#ifdef __linux__
+  #define _GNU_SOURCE
+#endif
+
 #include "akwan/memory.h"
+#include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include "akwan/common.h"
 
-void *akw_memory_alloc(size_t size)
+#ifdef __linux__
+  #include <sys/mman.h>
+  #define AKW_MEMORY_USE_MAP
+#endif
+
+#define is_mapped(s) ((s) >= AKW_MEMORY_MAP_THRESHOLD)
+
+static AKW_THREAD_LOCAL AkwMemoryStats *currentStats = NULL;
+
+static inline bool reserve(AkwMemoryStats *stats, size_t size);
+static inline void unreserve(AkwMemoryStats *stats, size_t size);
+static inline void *block_alloc(size_t size);
+static inline void *block_realloc(void *ptr, size_t size, size_t newSize);
+static inline void block_dealloc(void *ptr, size_t size);
+
+#ifdef AKW_MEMORY_USE_MAP
+static inline void *map_alloc(size_t size);
+static inline void *map_realloc(void *ptr, size_t size, size_t newSize);
+static inline void map_dealloc(void *ptr, size_t size);
+static inline void advise(void *ptr, size_t size);
+
+static inline void *map_alloc(size_t size)
+{
+  void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (ptr == MAP_FAILED) return NULL;
+  advise(ptr, size);
+  return ptr;
+}
+
+static inline void *map_realloc(void *ptr, size_t size, size_t newSize)
 {
+  void *newPtr = mremap(ptr, size, newSize, MREMAP_MAYMOVE);
+  if (newPtr == MAP_FAILED) return NULL;
+  advise(newPtr, newSize);
+  return newPtr;
+}
+
+static inline void map_dealloc(void *ptr, size_t size)
+{
+  munmap(ptr, size);
+}
+
+static inline void advise(void *ptr, size_t size)
+{
+#if defined(AKW_USE_HUGE_PAGES) && defined(MADV_HUGEPAGE)
+  madvise(ptr, size, MADV_HUGEPAGE);
+#else
+  (void) ptr;
+  (void) size;
+#endif
+}
+#endif
+
+static inline bool reserve(AkwMemoryStats *stats, size_t size)
+{
+  if (!stats) return true;
+  if (stats->limit
+   && (stats->bytes >= stats->limit || size > stats->limit - stats->bytes))
+    return false;
+  stats->bytes += size;
+  if (stats->bytes > stats->peakBytes)
+    stats->peakBytes = stats->bytes;
+  return true;
+}
+
+static inline void unreserve(AkwMemoryStats *stats, size_t size)
+{
+  if (!stats) return;
+  assert(size <= stats->bytes);
+  stats->bytes -= size;
+}
+
+static inline void *block_alloc(size_t size)
+{
+#ifdef AKW_MEMORY_USE_MAP
+  if (is_mapped(size))
+    return map_alloc(size);
+#endif
   return malloc(size);
 }
 
-void *akw_memory_realloc(void *ptr, size_t newSize)
+static inline void *block_realloc(void *ptr, size_t size, size_t newSize)
 {
+#ifdef AKW_MEMORY_USE_MAP
+  if (is_mapped(size) && is_mapped(newSize))
+    return map_realloc(ptr, size, newSize);
+  if (is_mapped(size) || is_mapped(newSize))
+  {
+    void *newPtr = block_alloc(newSize);
+    if (!newPtr) return NULL;
+    memcpy(newPtr, ptr, size < newSize ? size : newSize);
+    block_dealloc(ptr, size);
+    return newPtr;
+  }
+#else
+  (void) size;
+#endif
   return realloc(ptr, newSize);
 }
 
-void akw_memory_dealloc(void *ptr)
+static inline void block_dealloc(void *ptr, size_t size)
+{
+#ifdef AKW_MEMORY_USE_MAP
+  if (is_mapped(size))
+  {
+    map_dealloc(ptr, size);
+    return;
+  }
+#else
+  (void) size;
+#endif
+  free(ptr);
+}
+
+void akw_memory_stats_init(AkwMemoryStats *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+}
+
+AkwMemoryStats *akw_memory_swap_stats(AkwMemoryStats *stats)
+{
+  AkwMemoryStats *prevStats = currentStats;
+  currentStats = stats;
+  return prevStats;
+}
+
+AkwMemoryStats *akw_memory_current_stats(void)
+{
+  return currentStats;
+}
+
+void akw_memory_count_object(AkwMemoryStats *stats, int type, int delta)
+{
+  if (!stats) return;
+  stats->objects[type] += delta;
+}
+
+void akw_memory_move_object(AkwMemoryStats *from, AkwMemoryStats *to, int type,
+  size_t size)
+{
+  // The object already exists, so the new owner takes it over even past its
+  // limit.
+  if (from == to) return;
+  unreserve(from, size);
+  akw_memory_count_object(from, type, -1);
+  if (to)
+  {
+    to->bytes += size;
+    if (to->bytes > to->peakBytes)
+      to->peakBytes = to->bytes;
+  }
+  akw_memory_count_object(to, type, 1);
+}
+
+void *akw_memory_alloc(size_t size)
+{
+  return akw_memory_alloc_in(currentStats, size);
+}
+
+void *akw_memory_realloc(void *ptr, size_t size, size_t newSize)
+{
+  return akw_memory_realloc_in(currentStats, ptr, size, newSize);
+}
+
+void akw_memory_dealloc(void *ptr, size_t size)
+{
+  akw_memory_dealloc_in(currentStats, ptr, size);
+}
+
+void *akw_memory_alloc_in(AkwMemoryStats *stats, size_t size)
+{
+  if (!reserve(stats, size)) return NULL;
+  void *ptr = block_alloc(size);
+  if (!ptr) unreserve(stats, size);
+  return ptr;
+}
+
+void *akw_memory_realloc_in(AkwMemoryStats *stats, void *ptr, size_t size,
+  size_t newSize)
+{
+  if (newSize > size && !reserve(stats, newSize - size)) return NULL;
+  void *newPtr = block_realloc(ptr, size, newSize);
+  if (!newPtr)
+  {
+    if (newSize > size) unreserve(stats, newSize - size);
+    return NULL;
+  }
+  if (newSize < size) unreserve(stats, size - newSize);
+  return newPtr;
+}
+
+void akw_memory_dealloc_in(AkwMemoryStats *stats, void *ptr, size_t size)
+{
+  if (!ptr) return;
+  block_dealloc(ptr, size);
+  unreserve(stats, size);
+}
+
+void *akw_memory_alloc_pages(size_t size)
+{
+  // Pages are not accounted to any VM; they back data shared by all VMs.
+#ifdef AKW_MEMORY_USE_MAP
+  return map_alloc(size);
+#else
+  return malloc(size);
+#endif
+}
+
+void akw_memory_seal_pages(void *ptr, size_t size)
+{
+#ifdef AKW_MEMORY_USE_MAP
+  mprotect(ptr, size, PROT_READ);
+#else
+  (void) ptr;
+  (void) size;
+#endif
+}
+
+void akw_memory_dealloc_pages(void *ptr, size_t size)
 {
+  if (!ptr) return;
+#ifdef AKW_MEMORY_USE_MAP
+  map_dealloc(ptr, size);
+#else
+  (void) size;
   free(ptr);
+#endif
 }
@@ -0,0 +1,481 @@
+//
+// parallel.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/parallel.h"
+#include <stdint.h>
+#include <string.h>
+#include "akwan/array.h"
+#include "akwan/memory.h"
+#include "akwan/range.h"
+#include "akwan/thread.h"
+#include "akwan/vm.h"
+
+typedef struct
+{
+  AkwParallel *par;
+  AkwChunk    *chunk;
+  AkwValue    init;
+  AkwValue    input;
+  bool        isReduce;
+  int64_t     count;
+  int64_t     numBlocks;
+  AkwValue    *results;
+  AkwMutex    mutex;
+  int64_t     nextBlock;
+  int64_t     errIndex;
+} Job;
+
+static inline bool is_shareable(AkwValue input);
+static inline void job_init(Job *job, AkwParallel *par, AkwChunk *chunk,
+  AkwValue init, AkwValue input, bool isReduce);
+static inline AkwValue get_element(Job *job, int64_t index);
+static inline bool claim(Job *job, int64_t *block);
+static inline void fail(Job *job, int64_t index, AkwVM *vm);
+static inline bool call(AkwVM *vm, AkwChunk *chunk, int n, AkwValue *args,
+  AkwValue *result);
+static inline bool hand_over(AkwVM *vm, AkwValue val);
+static inline void map_block(Job *job, AkwVM *vm, int64_t start, int64_t end);
+static inline void reduce_block(Job *job, AkwVM *vm, int64_t start, int64_t end,
+  int64_t block);
+static inline void work(Job *job);
+static void worker_main(void *arg);
+static inline void start_threads(AkwParallel *par);
+static inline void run(Job *job);
+static inline bool keeps_init(AkwParallel *par, AkwChunk *combine,
+  AkwValue init);
+
+static inline bool is_shareable(AkwValue input)
+{
+  // With plain reference counts, workers may only share frozen elements.
+#if defined(AKW_ATOMIC_RC) || defined(AKW_BIASED_RC)
+  (void) input;
+  return true;
+#else
+  return !akw_is_array(input) || akw_object_is_frozen(akw_as_object(input));
+#endif
+}
+
+static inline void job_init(Job *job, AkwParallel *par, AkwChunk *chunk,
+  AkwValue init, AkwValue input, bool isReduce)
+{
+  job->par = par;
+  job->chunk = chunk;
+  job->init = init;
+  job->input = input;
+  job->isReduce = isReduce;
+  job->count = akw_is_array(input) ? akw_array_count(akw_as_array(input))
+    : akw_range_count(akw_as_range(input));
+  job->numBlocks = (job->count + AKW_PARALLEL_BLOCK_SIZE - 1)
+    / AKW_PARALLEL_BLOCK_SIZE;
+  job->results = NULL;
+  job->nextBlock = 0;
+  job->errIndex = job->count;
+}
+
+static inline AkwValue get_element(Job *job, int64_t index)
+{
+  AkwValue input = job->input;
+  if (akw_is_array(input))
+    return akw_array_get(akw_as_array(input), (int) index);
+  return akw_int_value(akw_range_get(akw_as_range(input), index));
+}
+
+static inline bool claim(Job *job, int64_t *block)
+{
+  // Blocks are claimed in order, so once an element has failed, no block
+  // past it is started and the error reported is always the first one.
+  akw_mutex_lock(&job->mutex);
+  int64_t next = job->nextBlock;
+  bool found = next < job->numBlocks
+    && next * AKW_PARALLEL_BLOCK_SIZE < job->errIndex;
+  if (found)
+  {
+    *block = next;
+    ++job->nextBlock;
+  }
+  akw_mutex_unlock(&job->mutex);
+  return found;
+}
+
+static inline void fail(Job *job, int64_t index, AkwVM *vm)
+{
+  akw_mutex_lock(&job->mutex);
+  if (index < job->errIndex)
+  {
+    job->errIndex = index;
+    job->par->rc = vm->rc;
+    memcpy(job->par->err, vm->err, sizeof(job->par->err));
+  }
+  akw_mutex_unlock(&job->mutex);
+}
+
+static inline bool call(AkwVM *vm, AkwChunk *chunk, int n, AkwValue *args,
+  AkwValue *result)
+{
+  for (int i = 0; i < n && akw_vm_is_ok(vm); ++i)
+    akw_vm_push(vm, args[i]);
+  if (akw_vm_is_ok(vm))
+    akw_vm_run(vm, chunk);
+  if (!akw_vm_is_ok(vm)) return false;
+  *result = akw_vm_peek(vm);
+  akw_value_retain(*result);
+  return true;
+}
+
+static inline bool hand_over(AkwVM *vm, AkwValue val)
+{
+  // Results outlive the worker's VM, so they are charged to no one until
+  // the calling thread takes them over.
+  int rc = AKW_OK;
+  akw_value_transfer(val, &vm->memStats, NULL, &rc);
+  if (akw_is_ok(rc)) return true;
+  vm->rc = rc;
+  akw_error_set(vm->err, "out of memory");
+  return false;
+}
+
+static inline void map_block(Job *job, AkwVM *vm, int64_t start, int64_t end)
+{
+  AkwValue *results = job->results;
+  for (int64_t i = start; i < end; ++i)
+  {
+    AkwValue elem = get_element(job, i);
+    bool ok = call(vm, job->chunk, 1, &elem, &results[i]);
+    if (ok && !hand_over(vm, results[i]))
+    {
+      akw_value_release(results[i]);
+      ok = false;
+    }
+    if (ok)
+      akw_value_share(results[i]);
+    if (!ok)
+    {
+      fail(job, i, vm);
+      for (; i < end; ++i)
+        results[i] = akw_nil_value();
+    }
+    akw_vm_reset(vm);
+  }
+}
+
+static inline void reduce_block(Job *job, AkwVM *vm, int64_t start, int64_t end,
+  int64_t block)
+{
+  AkwValue acc = job->init;
+  akw_value_retain(acc);
+  for (int64_t i = start; i < end; ++i)
+  {
+    AkwValue args[] = { acc, get_element(job, i) };
+    AkwValue result;
+    bool ok = call(vm, job->chunk, 2, args, &result);
+    if (!ok) fail(job, i, vm);
+    akw_vm_reset(vm);
+    akw_value_release(acc);
+    if (!ok)
+    {
+      acc = akw_nil_value();
+      break;
+    }
+    acc = result;
+  }
+  if (!hand_over(vm, acc))
+  {
+    fail(job, end - 1, vm);
+    akw_vm_reset(vm);
+    akw_value_release(acc);
+    acc = akw_nil_value();
+  }
+  akw_value_share(acc);
+  job->results[block] = acc;
+}
+
+static inline void work(Job *job)
+{
+  // A worker that finds every block taken has no need for a VM.
+  AkwVM vm;
+  bool hasVM = false;
+  int64_t block;
+  while (claim(job, &block))
+  {
+    if (!hasVM)
+    {
+      akw_vm_init(&vm, job->par->stackSize);
+      hasVM = true;
+    }
+    int64_t start = block * AKW_PARALLEL_BLOCK_SIZE;
+    int64_t end = start + AKW_PARALLEL_BLOCK_SIZE;
+    if (end > job->count) end = job->count;
+    if (job->isReduce)
+      reduce_block(job, &vm, start, end, block);
+    else
+      map_block(job, &vm, start, end);
+  }
+  if (hasVM)
+    akw_vm_deinit(&vm);
+}
+
+static void worker_main(void *arg)
+{
+  // Threads are started before the first job is posted, so each one has
+  // seen generation 0, and takes part in every job after it.
+  AkwParallel *par = arg;
+  int seen = 0;
+  akw_mutex_lock(&par->mutex);
+  for (;;)
+  {
+    while (!par->isStopping && par->generation == seen)
+      akw_cond_wait(&par->wake, &par->mutex);
+    if (par->isStopping) break;
+    seen = par->generation;
+    Job *job = par->job;
+    akw_mutex_unlock(&par->mutex);
+    work(job);
+    akw_mutex_lock(&par->mutex);
+    if (!--par->numBusy)
+      akw_cond_signal(&par->done);
+  }
+  akw_mutex_unlock(&par->mutex);
+}
+
+static inline void start_threads(AkwParallel *par)
+{
+  // The calling thread is one of the workers.
+  int numThreads = par->numWorkers - 1;
+  if (numThreads < 1) return;
+  par->threads = akw_memory_alloc(sizeof(*par->threads) * numThreads);
+  if (!par->threads) return;
+  par->capacity = numThreads;
+  for (; par->numThreads < numThreads; ++par->numThreads)
+  {
+    int rc = AKW_OK;
+    akw_thread_start(&par->threads[par->numThreads], worker_main, par, &rc);
+    if (!akw_is_ok(rc)) break;
+  }
+}
+
+static inline void run(Job *job)
+{
+  AkwParallel *par = job->par;
+  if (!par->threads && !par->generation)
+    start_threads(par);
+  akw_mutex_lock(&par->mutex);
+  par->job = job;
+  ++par->generation;
+  par->numBusy = par->numThreads;
+  akw_cond_broadcast(&par->wake);
+  akw_mutex_unlock(&par->mutex);
+  work(job);
+  akw_mutex_lock(&par->mutex);
+  while (par->numBusy)
+    akw_cond_wait(&par->done, &par->mutex);
+  par->job = NULL;
+  akw_mutex_unlock(&par->mutex);
+}
+
+static inline bool keeps_init(AkwParallel *par, AkwChunk *combine,
+  AkwValue init)
+{
+  // Only a number init can be compared without knowing what it stands for.
+  if (!akw_is_number(init)) return true;
+  AkwVM vm;
+  akw_vm_init(&vm, par->stackSize);
+  AkwValue args[] = { init, init };
+  AkwValue result;
+  bool ok = call(&vm, combine, 2, args, &result);
+  if (!ok)
+  {
+    par->rc = vm.rc;
+    memcpy(par->err, vm.err, sizeof(par->err));
+  }
+  else if (!akw_is_number(result)
+   || akw_as_number(result) != akw_as_number(init))
+  {
+    par->rc = AKW_TYPE_ERROR;
+    akw_error_set(par->err, "init is not an identity of the combining chunk");
+    ok = false;
+  }
+  if (ok) akw_value_release(result);
+  akw_vm_deinit(&vm);
+  return ok;
+}
+
+void akw_parallel_init(AkwParallel *par)
+{
+  par->numWorkers = akw_thread_count_cores();
+  par->stackSize = AKW_VM_DEFAULT_STACK_SIZE;
+  par->rc = AKW_OK;
+  par->err[0] = '\0';
+  par->capacity = 0;
+  par->numThreads = 0;
+  par->threads = NULL;
+  akw_mutex_init(&par->mutex);
+  akw_cond_init(&par->wake);
+  akw_cond_init(&par->done);
+  par->job = NULL;
+  par->generation = 0;
+  par->numBusy = 0;
+  par->isStopping = false;
+}
+
+void akw_parallel_deinit(AkwParallel *par)
+{
+  akw_mutex_lock(&par->mutex);
+  par->isStopping = true;
+  akw_cond_broadcast(&par->wake);
+  akw_mutex_unlock(&par->mutex);
+  for (int i = 0; i < par->numThreads; ++i)
+    akw_thread_join(&par->threads[i]);
+  akw_memory_dealloc(par->threads, sizeof(*par->threads) * par->capacity);
+  akw_cond_deinit(&par->done);
+  akw_cond_deinit(&par->wake);
+  akw_mutex_deinit(&par->mutex);
+}
+
+AkwValue akw_parallel_map(AkwParallel *par, AkwChunk *chunk, AkwValue input)
+{
+  par->rc = AKW_OK;
+  if (!akw_is_array(input) && !akw_is_range(input))
+  {
+    par->rc = AKW_TYPE_ERROR;
+    akw_error_set(par->err, "cannot map over %s", akw_value_type_name(input));
+    return akw_nil_value();
+  }
+  if (!is_shareable(input))
+  {
+    par->rc = AKW_TYPE_ERROR;
+    akw_error_set(par->err, "cannot map over an array that is not frozen");
+    return akw_nil_value();
+  }
+  Job job;
+  job_init(&job, par, chunk, akw_nil_value(), input, false);
+  if (job.count > AKW_MAX_CAPACITY)
+  {
+    par->rc = AKW_RANGE_ERROR;
+    akw_error_set(par->err, "cannot map over more than %d element(s)",
+      AKW_MAX_CAPACITY);
+    return akw_nil_value();
+  }
+  int n = (int) job.count;
+  int rc = AKW_OK;
+  AkwArray *arr = akw_array_new_with_capacity(n, &rc);
+  if (!akw_is_ok(rc))
+  {
+    par->rc = rc;
+    akw_error_set(par->err, "out of memory");
+    return akw_nil_value();
+  }
+  job.results = arr->vec.elements;
+  akw_mutex_init(&job.mutex);
+  run(&job);
+  akw_mutex_deinit(&job.mutex);
+  int64_t claimed = job.nextBlock * AKW_PARALLEL_BLOCK_SIZE;
+  for (int64_t i = claimed; i < n; ++i)
+    job.results[i] = akw_nil_value();
+  arr->vec.count = n;
+  AkwValue result = akw_array_value(arr);
+  if (!akw_parallel_is_ok(par))
+  {
+    akw_array_free(arr);
+    return akw_nil_value();
+  }
+  // Elements the walk cannot reach for lack of memory stay uncharged.
+  AkwMemoryStats *stats = akw_memory_current_stats();
+  for (int i = 0; i < n && akw_is_ok(rc); ++i)
+    akw_value_transfer(job.results[i], NULL, stats, &rc);
+  akw_value_retain(result);
+  return result;
+}
+
+AkwValue akw_parallel_reduce(AkwParallel *par, AkwChunk *chunk,
+  AkwChunk *combine, AkwValue init, AkwValue input)
+{
+  par->rc = AKW_OK;
+  if (!akw_is_array(input) && !akw_is_range(input))
+  {
+    par->rc = AKW_TYPE_ERROR;
+    akw_error_set(par->err, "cannot reduce %s", akw_value_type_name(input));
+    return akw_nil_value();
+  }
+  if (!is_shareable(input))
+  {
+    par->rc = AKW_TYPE_ERROR;
+    akw_error_set(par->err, "cannot reduce an array that is not frozen");
+    return akw_nil_value();
+  }
+  Job job;
+  job_init(&job, par, chunk, init, input, true);
+  if (job.numBlocks > 1 && !keeps_init(par, combine, init))
+    return akw_nil_value();
+  size_t size = sizeof(*job.results) * job.numBlocks;
+  if (job.numBlocks)
+  {
+    job.results = akw_memory_alloc(size);
+    if (!job.results)
+    {
+      par->rc = AKW_RANGE_ERROR;
+      akw_error_set(par->err, "out of memory");
+      return akw_nil_value();
+    }
+  }
+  akw_mutex_init(&job.mutex);
+  run(&job);
+  akw_mutex_deinit(&job.mutex);
+  // Partial results are combined in block order on the calling thread.
+  AkwValue acc = init;
+  if (!job.numBlocks)
+    akw_value_retain(acc);
+  AkwVM vm;
+  akw_vm_init(&vm, par->stackSize);
+  for (int64_t i = 0; i < job.nextBlock; ++i)
+  {
+    AkwValue partial = job.results[i];
+    if (!i)
+    {
+      acc = partial;
+      continue;
+    }
+    if (akw_parallel_is_ok(par))
+    {
+      AkwValue args[] = { acc, partial };
+      AkwValue result;
+      bool ok = call(&vm, combine, 2, args, &result);
+      if (!ok)
+      {
+        par->rc = vm.rc;
+        memcpy(par->err, vm.err, sizeof(par->err));
+      }
+      akw_vm_reset(&vm);
+      akw_value_release(acc);
+      acc = ok ? result : akw_nil_value();
+    }
+    akw_value_release(partial);
+  }
+  // The result may be a partial or come from the combining VM, and is
+  // charged to the caller either way. Partials the walk cannot reach for
+  // lack of memory stay uncharged.
+  AkwMemoryStats *stats = akw_memory_current_stats();
+  int rc = AKW_OK;
+  if (akw_parallel_is_ok(par))
+    akw_value_transfer(acc, &vm.memStats, stats, &rc);
+  if (!akw_is_ok(rc))
+  {
+    par->rc = rc;
+    akw_error_set(par->err, "out of memory");
+  }
+  if (!akw_parallel_is_ok(par))
+  {
+    akw_value_release(acc);
+    acc = akw_nil_value();
+  }
+  akw_value_transfer(acc, NULL, stats, &rc);
+  akw_vm_deinit(&vm);
+  akw_memory_dealloc(job.results, size);
+  return acc;
+}
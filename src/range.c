@@ -9,7 +9,6 @@
 //
 
 #include "akwan/range.h"
-#include <stdio.h>
 #include "akwan/memory.h"
 
 void akw_range_init(AkwRange *range, int64_t start, int64_t end)
@@ -22,26 +21,28 @@ void akw_range_init(AkwRange *range, int64_t start, int64_t end)
 AkwRange *akw_range_new(int64_t start, int64_t end)
 {
   AkwRange *range = akw_memory_alloc(sizeof(*range));
+  if (!range) return NULL;
   akw_range_init(range, start, end);
+  akw_memory_count_object(range->obj.stats, AKW_TYPE_RANGE, 1);
   return range;
 }
 
 void akw_range_free(AkwRange *range)
 {
-  akw_memory_dealloc(range);
+  AkwMemoryStats *stats = range->obj.stats;
+  akw_memory_dealloc_in(stats, range, sizeof(*range));
+  akw_memory_count_object(stats, AKW_TYPE_RANGE, -1);
 }
 
 void akw_range_release(AkwRange *range)
 {
   AkwObject *obj = &range->obj;
-  --obj->refCount;
-  if (obj->refCount) return;
-  akw_range_free(range);
+  if (akw_object_is_immortal(obj)) return;
+  if (!akw_object_decref(obj)) return;
+  akw_value_dispose(akw_range_value(range));
 }
 
 void akw_range_print(AkwRange *range)
 {
-  long long start = (long long) range->start;
-  long long end = (long long) range->end;
-  printf("%lld..%lld", start, end);
+  akw_value_print(akw_range_value(range), false);
 }
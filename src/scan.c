@@ -0,0 +1,239 @@
+//
+// scan.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/scan.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#if defined(AKW_USE_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+  #define SCAN_SSE2
+  #include <emmintrin.h>
+  #if defined(__GNUC__)
+    #define SCAN_AVX2
+    #include <immintrin.h>
+  #endif
+#endif
+
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
+// Blocks are read with aligned loads, which never cross a page boundary, so
+// reading past the NUL is safe even though it is outside the string.
+#if defined(__GNUC__)
+  #define NO_SANITIZE __attribute__((no_sanitize_address))
+  #define AVX2        __attribute__((target("avx2"))) NO_SANITIZE
+#else
+  #define NO_SANITIZE
+#endif
+
+typedef enum
+{
+  SCAN_BLANKS,
+  SCAN_NAME,
+  SCAN_STRING,
+  SCAN_LINE
+} ScanKind;
+
+static inline bool is_blank(char c);
+static inline bool is_name_char(char c);
+static inline char *scalar_scan(char *chars, ScanKind kind);
+static inline char *scan(char *chars, ScanKind kind);
+
+#ifdef SCAN_SSE2
+static inline int count_trailing_zeros(uint32_t bits);
+static inline NO_SANITIZE __m128i sse2_range(__m128i v, char lo, char hi);
+static inline NO_SANITIZE uint32_t sse2_stops(__m128i v, ScanKind kind);
+static inline NO_SANITIZE char *sse2_scan(char *chars, ScanKind kind);
+#endif
+
+#ifdef SCAN_AVX2
+static inline AVX2 __m256i avx2_range(__m256i v, char lo, char hi);
+static inline AVX2 uint32_t avx2_stops(__m256i v, ScanKind kind);
+static inline AVX2 char *avx2_scan(char *chars, ScanKind kind);
+#endif
+
+static inline bool is_blank(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static inline bool is_name_char(char c)
+{
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z')
+    || (c >= '0' && c <= '9') || c == '_';
+}
+
+static inline char *scalar_scan(char *chars, ScanKind kind)
+{
+  switch (kind)
+  {
+  case SCAN_BLANKS:
+    while (is_blank(*chars))
+      ++chars;
+    break;
+  case SCAN_NAME:
+    while (is_name_char(*chars))
+      ++chars;
+    break;
+  case SCAN_STRING:
+    while (*chars != '"' && *chars)
+      ++chars;
+    break;
+  case SCAN_LINE:
+    while (*chars != '\n' && *chars)
+      ++chars;
+    break;
+  }
+  return chars;
+}
+
+#ifdef SCAN_SSE2
+static inline int count_trailing_zeros(uint32_t bits)
+{
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward(&index, bits);
+  return (int) index;
+#else
+  return __builtin_ctz(bits);
+#endif
+}
+
+static inline NO_SANITIZE __m128i sse2_range(__m128i v, char lo, char hi)
+{
+  // Signed compares, so bytes from 0x80 up are never in range.
+  __m128i above = _mm_cmpgt_epi8(v, _mm_set1_epi8((char) (lo - 1)));
+  __m128i below = _mm_cmplt_epi8(v, _mm_set1_epi8((char) (hi + 1)));
+  return _mm_and_si128(above, below);
+}
+
+static inline NO_SANITIZE uint32_t sse2_stops(__m128i v, ScanKind kind)
+{
+  __m128i match;
+  switch (kind)
+  {
+  case SCAN_BLANKS:
+    match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+      _mm_andnot_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')),
+        sse2_range(v, '\t', '\r')));
+    return ~(uint32_t) _mm_movemask_epi8(match) & 0xffff;
+  case SCAN_NAME:
+    match = _mm_or_si128(sse2_range(_mm_or_si128(v, _mm_set1_epi8(0x20)),
+      'a', 'z'), _mm_or_si128(sse2_range(v, '0', '9'),
+        _mm_cmpeq_epi8(v, _mm_set1_epi8('_'))));
+    return ~(uint32_t) _mm_movemask_epi8(match) & 0xffff;
+  case SCAN_STRING:
+    match = _mm_cmpeq_epi8(v, _mm_set1_epi8('"'));
+    break;
+  case SCAN_LINE:
+    match = _mm_cmpeq_epi8(v, _mm_set1_epi8('\n'));
+    break;
+  }
+  match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+  return (uint32_t) _mm_movemask_epi8(match);
+}
+
+static inline NO_SANITIZE char *sse2_scan(char *chars, ScanKind kind)
+{
+  uintptr_t offset = (uintptr_t) chars & 15;
+  const __m128i *block = (const __m128i *) (chars - offset);
+  uint32_t stops = sse2_stops(_mm_load_si128(block), kind) >> offset;
+  if (stops) return chars + count_trailing_zeros(stops);
+  for (;;)
+  {
+    ++block;
+    stops = sse2_stops(_mm_load_si128(block), kind);
+    if (stops) return (char *) block + count_trailing_zeros(stops);
+  }
+}
+#endif
+
+#ifdef SCAN_AVX2
+static inline AVX2 __m256i avx2_range(__m256i v, char lo, char hi)
+{
+  __m256i above = _mm256_cmpgt_epi8(v, _mm256_set1_epi8((char) (lo - 1)));
+  __m256i below = _mm256_cmpgt_epi8(_mm256_set1_epi8((char) (hi + 1)), v);
+  return _mm256_and_si256(above, below);
+}
+
+static inline AVX2 uint32_t avx2_stops(__m256i v, ScanKind kind)
+{
+  __m256i match;
+  switch (kind)
+  {
+  case SCAN_BLANKS:
+    match = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+      _mm256_andnot_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')),
+        avx2_range(v, '\t', '\r')));
+    return ~(uint32_t) _mm256_movemask_epi8(match);
+  case SCAN_NAME:
+    match = _mm256_or_si256(avx2_range(_mm256_or_si256(v,
+      _mm256_set1_epi8(0x20)), 'a', 'z'), _mm256_or_si256(avx2_range(v, '0',
+        '9'), _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_'))));
+    return ~(uint32_t) _mm256_movemask_epi8(match);
+  case SCAN_STRING:
+    match = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('"'));
+    break;
+  case SCAN_LINE:
+    match = _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n'));
+    break;
+  }
+  match = _mm256_or_si256(match, _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+  return (uint32_t) _mm256_movemask_epi8(match);
+}
+
+static inline AVX2 char *avx2_scan(char *chars, ScanKind kind)
+{
+  uintptr_t offset = (uintptr_t) chars & 31;
+  const __m256i *block = (const __m256i *) (chars - offset);
+  uint32_t stops = avx2_stops(_mm256_load_si256(block), kind) >> offset;
+  if (stops) return chars + count_trailing_zeros(stops);
+  for (;;)
+  {
+    ++block;
+    stops = avx2_stops(_mm256_load_si256(block), kind);
+    if (stops) return (char *) block + count_trailing_zeros(stops);
+  }
+}
+#endif
+
+static inline char *scan(char *chars, ScanKind kind)
+{
+#ifdef SCAN_AVX2
+  if (__builtin_cpu_supports("avx2"))
+    return avx2_scan(chars, kind);
+#endif
+#ifdef SCAN_SSE2
+  return sse2_scan(chars, kind);
+#else
+  return scalar_scan(chars, kind);
+#endif
+}
+
+char *akw_scan_blanks(char *chars)
+{
+  return scan(chars, SCAN_BLANKS);
+}
+
+char *akw_scan_name(char *chars)
+{
+  return scan(chars, SCAN_NAME);
+}
+
+char *akw_scan_string(char *chars)
+{
+  return scan(chars, SCAN_STRING);
+}
+
+char *akw_scan_line(char *chars)
+{
+  return scan(chars, SCAN_LINE);
+}
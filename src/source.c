@@ -0,0 +1,186 @@
+//
+// source.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/source.h"
+#include "akwan/common.h"
+
+#ifdef _WIN32
+  #include <fcntl.h>
+  #include <io.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#define READ_SIZE (1 << 16)
+
+static inline int open_input(const char *path);
+static inline void close_input(AkwSource *src);
+static inline bool map_source(AkwSource *src, int fd);
+static inline void read_source(AkwSource *src, int fd, int *rc);
+
+static inline int open_input(const char *path)
+{
+  if (!path) return 0;
+#ifdef _WIN32
+  return _open(path, _O_RDONLY | _O_BINARY);
+#else
+  return open(path, O_RDONLY);
+#endif
+}
+
+static inline void close_input(AkwSource *src)
+{
+  // The standard input is left open.
+  int fd = src->fd;
+  src->fd = -1;
+  if (!src->ownsFd) return;
+#ifdef _WIN32
+  _close(fd);
+#else
+  close(fd);
+#endif
+}
+
+#ifdef _WIN32
+static inline bool map_source(AkwSource *src, int fd)
+{
+  (void) src;
+  (void) fd;
+  return false;
+}
+#else
+static inline bool map_source(AkwSource *src, int fd)
+{
+  // Only a regular file read from its start can be mapped.
+  struct stat st;
+  if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || !st.st_size
+   || st.st_size > AKW_MAX_CAPACITY || lseek(fd, 0, SEEK_CUR))
+    return false;
+  size_t length = (size_t) st.st_size;
+  size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+  size_t mapSize = (length / pageSize + 1) * pageSize;
+  // The bytes past the end of a file read as zeros up to the end of its last
+  // page, which gives the lexer its NUL. A file that ends exactly on a page
+  // boundary has no such bytes, so the file is mapped over a zeroed block
+  // that is one page larger.
+  char *chars = mmap(NULL, mapSize, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+    -1, 0);
+  if (chars == MAP_FAILED) return false;
+  if (mmap(chars, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0)
+    == MAP_FAILED)
+  {
+    munmap(chars, mapSize);
+    return false;
+  }
+  src->isMapped = true;
+  src->length = length;
+  src->mapSize = mapSize;
+  src->chars = chars;
+  return true;
+}
+#endif
+
+static inline void read_source(AkwSource *src, int fd, int *rc)
+{
+  AkwBuffer *buf = &src->buf;
+  akw_buffer_init(buf);
+  for (;;)
+  {
+    akw_buffer_ensure_capacity(buf, buf->count + READ_SIZE + 1, rc);
+    if (!akw_is_ok(*rc)) break;
+    int size = buf->capacity - buf->count - 1;
+#ifdef _WIN32
+    int n = _read(fd, &buf->bytes[buf->count], (unsigned int) size);
+#else
+    int n = (int) read(fd, &buf->bytes[buf->count], (size_t) size);
+    if (n == -1 && errno == EINTR) continue;
+#endif
+    if (n == -1)
+    {
+      *rc = AKW_SYSTEM_ERROR;
+      break;
+    }
+    if (!n) break;
+    buf->count += n;
+  }
+  if (!akw_is_ok(*rc))
+  {
+    akw_buffer_deinit(buf);
+    return;
+  }
+  buf->bytes[buf->count] = '\0';
+  src->length = (size_t) buf->count;
+  src->chars = (char *) buf->bytes;
+}
+
+void akw_source_init(AkwSource *src, const char *path, int *rc)
+{
+  // A NULL path reads the standard input.
+  akw_source_open(src, path, rc);
+  if (!akw_is_ok(*rc) || src->chars) return;
+  read_source(src, src->fd, rc);
+  close_input(src);
+}
+
+void akw_source_open(AkwSource *src, const char *path, int *rc)
+{
+  src->isMapped = false;
+  src->length = 0;
+  src->mapSize = 0;
+  src->chars = NULL;
+  src->fd = -1;
+  src->ownsFd = path != NULL;
+  int fd = open_input(path);
+  if (fd == -1)
+  {
+    *rc = AKW_SYSTEM_ERROR;
+    return;
+  }
+  src->fd = fd;
+  if (map_source(src, fd))
+    close_input(src);
+}
+
+void akw_source_deinit(AkwSource *src)
+{
+  if (src->fd != -1)
+  {
+    close_input(src);
+    return;
+  }
+#ifndef _WIN32
+  if (src->isMapped)
+  {
+    munmap(src->chars, src->mapSize);
+    return;
+  }
+#endif
+  akw_buffer_deinit(&src->buf);
+}
+
+int akw_source_read(void *src, int size, char *chars)
+{
+  // Has the signature of an AkwReadFn.
+  int fd = ((AkwSource *) src)->fd;
+  for (;;)
+  {
+#ifdef _WIN32
+    int n = _read(fd, chars, (unsigned int) size);
+#else
+    int n = (int) read(fd, chars, (size_t) size);
+    if (n == -1 && errno == EINTR) continue;
+#endif
+    return n;
+  }
+}
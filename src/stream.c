@@ -0,0 +1,134 @@
+//
+// stream.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/stream.h"
+#include <string.h>
+#include "akwan/atomic.h"
+#include "akwan/memory.h"
+
+// Positions are published to the other thread once per batch, and whenever
+// a thread is about to wait, so the two threads rarely touch the same line.
+#define BATCH_SIZE (1 << 6)
+
+static void lex_tokens(void *arg);
+static inline bool wait_for_room(AkwTokenStream *stream, int tail, int *head);
+
+static void lex_tokens(void *arg)
+{
+  AkwTokenStream *stream = arg;
+  AkwLexer *lex = &stream->lex;
+  int mask = stream->capacity - 1;
+  int head = 0;
+  int tail = 0;
+  akw_lexer_next(lex, &stream->rc, stream->err);
+  while (akw_is_ok(stream->rc))
+  {
+    if (tail - head == stream->capacity
+     && !wait_for_room(stream, tail, &head))
+      break;
+    stream->tokens[tail & mask] = lex->token;
+    ++tail;
+    if (lex->token.kind == AKW_TOKEN_KIND_EOF) break;
+    if (!(tail & (BATCH_SIZE - 1)))
+      akw_atomic_store(&stream->tail, tail);
+    akw_lexer_next(lex, &stream->rc, stream->err);
+  }
+  akw_atomic_store(&stream->tail, tail);
+  akw_atomic_store(&stream->isDone, true);
+}
+
+static inline bool wait_for_room(AkwTokenStream *stream, int tail, int *head)
+{
+  akw_atomic_store(&stream->tail, tail);
+  for (;;)
+  {
+    *head = akw_atomic_load(&stream->head);
+    if (tail - *head < stream->capacity) return true;
+    if (akw_atomic_load(&stream->isCancelled)) return false;
+    akw_thread_yield();
+  }
+}
+
+void akw_token_stream_init(AkwTokenStream *stream, char *source, int capacity,
+  int *rc)
+{
+  int realCapacity = BATCH_SIZE << 1;
+  while (realCapacity < capacity)
+    realCapacity <<= 1;
+  akw_lexer_init_source(&stream->lex, source);
+  stream->rc = AKW_OK;
+  stream->capacity = realCapacity;
+  stream->tokens = NULL;
+  stream->head = 0;
+  stream->tail = 0;
+  stream->isDone = false;
+  stream->isCancelled = false;
+  stream->readPos = 0;
+  stream->readLimit = 0;
+  if (realCapacity > AKW_MAX_CAPACITY)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  AkwToken *tokens = akw_memory_alloc(sizeof(*tokens) * realCapacity);
+  if (!tokens)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  stream->tokens = tokens;
+  akw_thread_start(&stream->thread, lex_tokens, stream, rc);
+  if (akw_is_ok(*rc)) return;
+  akw_memory_dealloc(tokens, sizeof(*tokens) * realCapacity);
+  stream->tokens = NULL;
+}
+
+void akw_token_stream_deinit(AkwTokenStream *stream)
+{
+  if (!stream->tokens) return;
+  akw_atomic_store(&stream->isCancelled, true);
+  akw_thread_join(&stream->thread);
+  // The line index, if any, was built on the lexer thread.
+  AkwMemoryStats *stats = akw_memory_swap_stats(NULL);
+  akw_lexer_deinit(&stream->lex);
+  akw_memory_swap_stats(stats);
+  akw_memory_dealloc(stream->tokens, sizeof(*stream->tokens) * stream->capacity);
+  stream->tokens = NULL;
+}
+
+void akw_token_stream_next(AkwTokenStream *stream, AkwToken *token, int *rc,
+  AkwError err)
+{
+  while (stream->readPos == stream->readLimit)
+  {
+    akw_atomic_store(&stream->head, stream->readPos);
+    // The final tail is published before isDone, so it is loaded again.
+    bool isDone = akw_atomic_load(&stream->isDone);
+    stream->readLimit = akw_atomic_load(&stream->tail);
+    if (stream->readPos != stream->readLimit) break;
+    if (isDone)
+    {
+      if (!akw_is_ok(stream->rc))
+      {
+        *rc = stream->rc;
+        memcpy(err, stream->err, sizeof(stream->err));
+        return;
+      }
+      // Past the end, the last token is EOF, just like with a lexer.
+      *token = stream->tokens[(stream->readPos - 1) & (stream->capacity - 1)];
+      return;
+    }
+    akw_thread_yield();
+  }
+  *token = stream->tokens[stream->readPos & (stream->capacity - 1)];
+  ++stream->readPos;
+  if (!(stream->readPos & (BATCH_SIZE - 1)))
+    akw_atomic_store(&stream->head, stream->readPos);
+}
@@ -9,25 +9,29 @@
 //
 
 #include "akwan/string.h"
-#include <stdio.h>
 #include <string.h>
 #include "akwan/common.h"
 #include "akwan/memory.h"
 
-static inline void string_init(AkwString *str, int length, int capacity);
+static inline void string_init(AkwString *str, int length, int capacity, int *rc);
 
-static inline void string_init(AkwString *str, int length, int capacity)
+static inline void string_init(AkwString *str, int length, int capacity, int *rc)
 {
-  char *chars = akw_memory_alloc(capacity);
   akw_object_init(&str->obj);
+  char *chars = akw_memory_alloc_in(str->obj.stats, capacity);
+  if (!chars)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
   str->capacity = capacity;
   str->length = length;
   str->chars = chars;
 }
 
-void akw_string_init(AkwString *str)
+void akw_string_init(AkwString *str, int *rc)
 {
-  string_init(str, 0, AKW_MIN_CAPACITY);
+  string_init(str, 0, AKW_MIN_CAPACITY, rc);
 }
 
 void akw_string_init_with_capacity(AkwString *str, int capacity, int *rc)
@@ -40,7 +44,7 @@ void akw_string_init_with_capacity(AkwString *str, int capacity, int *rc)
   int realCapacity = AKW_MIN_CAPACITY;
   while (realCapacity < capacity)
     realCapacity <<= 1;
-  string_init(str, 0, realCapacity);
+  string_init(str, 0, realCapacity, rc);
 }
 
 void akw_string_init_from(AkwString *str, int length, char *chars, int *rc)
@@ -54,58 +58,81 @@ void akw_string_init_from(AkwString *str, int length, char *chars, int *rc)
   int capacity = AKW_MIN_CAPACITY;
   while (capacity < length)
     capacity <<= 1;
-  string_init(str, length, capacity);
+  string_init(str, length, capacity, rc);
+  if (!akw_is_ok(*rc)) return;
   memcpy(str->chars, chars, length);
 }
 
 void akw_string_deinit(AkwString *str)
 {
-  akw_memory_dealloc(str->chars);
+  akw_memory_dealloc_in(str->obj.stats, str->chars, str->capacity);
 }
 
 AkwString *akw_string_new(void)
 {
   AkwString *str = akw_memory_alloc(sizeof(*str));
-  akw_string_init(str);
+  if (!str) return NULL;
+  int rc = AKW_OK;
+  akw_string_init(str, &rc);
+  if (!akw_is_ok(rc))
+  {
+    akw_memory_dealloc(str, sizeof(*str));
+    return NULL;
+  }
+  akw_memory_count_object(str->obj.stats, AKW_TYPE_STRING, 1);
   return str;
 }
 
 AkwString *akw_string_new_with_capacity(int capacity, int *rc)
 {
   AkwString *str = akw_memory_alloc(sizeof(*str));
+  if (!str)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return NULL;
+  }
   akw_string_init_with_capacity(str, capacity, rc);
   if (!akw_is_ok(*rc))
   {
-    akw_memory_dealloc(str);
+    akw_memory_dealloc(str, sizeof(*str));
     return NULL;
   }
+  akw_memory_count_object(str->obj.stats, AKW_TYPE_STRING, 1);
   return str;
 }
 
 AkwString *akw_string_new_from(int length, char *chars, int *rc)
 {
   AkwString *str = akw_memory_alloc(sizeof(*str));
+  if (!str)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return NULL;
+  }
   akw_string_init_from(str, length, chars, rc);
   if (!akw_is_ok(*rc))
   {
-    akw_memory_dealloc(str);
+    akw_memory_dealloc(str, sizeof(*str));
     return NULL;
   }
+  akw_memory_count_object(str->obj.stats, AKW_TYPE_STRING, 1);
   return str;
 }
 
 void akw_string_free(AkwString *str)
 {
+  AkwMemoryStats *stats = str->obj.stats;
   akw_string_deinit(str);
-  akw_memory_dealloc(str);
+  akw_memory_dealloc_in(stats, str, sizeof(*str));
+  akw_memory_count_object(stats, AKW_TYPE_STRING, -1);
 }
 
 void akw_string_release(AkwString *str)
 {
   AkwObject *obj = &str->obj;
-  --obj->refCount;
-  if (obj->refCount) return;
-  akw_string_free(str);
+  if (akw_object_is_immortal(obj)) return;
+  if (!akw_object_decref(obj)) return;
+  akw_value_dispose(akw_string_value(str));
 }
 
 void akw_string_ensure_capacity(AkwString *str, int capacity, int *rc)
@@ -119,12 +146,18 @@ void akw_string_ensure_capacity(AkwString *str, int capacity, int *rc)
   int newCapacity = str->capacity;
   while (newCapacity < capacity)
     newCapacity <<= 1;
-  char *newChars = akw_memory_realloc(str->chars, newCapacity);
+  char *newChars = akw_memory_realloc_in(str->obj.stats, str->chars,
+    str->capacity, newCapacity);
+  if (!newChars)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
   str->capacity = newCapacity;
   str->chars = newChars;
 }
 
 void akw_string_print(AkwString *str, bool quoted)
 {
-  printf(quoted ? "\"%.*s\"" : "%.*s", str->length, str->chars);
+  akw_value_print(akw_string_value(str), quoted);
 }
@@ -0,0 +1,165 @@
+//
+// symbol.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/symbol.h"
+#include <string.h>
+#include "akwan/memory.h"
+
+#define FNV_OFFSET (0x811c9dc5U)
+#define FNV_PRIME  (0x01000193U)
+
+#define MIN_SLOTS (16)
+
+#define BLOCK_SIZE (1 << 12)
+
+static inline uint32_t hash_name(int length, const char *chars);
+static inline int *find_slot(AkwSymbolTable *table, int length, char *chars,
+  uint32_t hash);
+static inline void grow(AkwSymbolTable *table, int *rc);
+static inline char *copy_chars(AkwSymbolTable *table, int length,
+  const char *chars, int *rc);
+
+static inline uint32_t hash_name(int length, const char *chars)
+{
+  uint32_t hash = FNV_OFFSET;
+  for (int i = 0; i < length; ++i)
+  {
+    hash ^= (uint8_t) chars[i];
+    hash *= FNV_PRIME;
+  }
+  return hash;
+}
+
+static inline int *find_slot(AkwSymbolTable *table, int length, char *chars,
+  uint32_t hash)
+{
+  // Slots hold a symbol index plus one, so that zero marks an empty slot.
+  int mask = table->capacity - 1;
+  int i = (int) (hash & (uint32_t) mask);
+  for (;;)
+  {
+    int *slot = &table->slots[i];
+    if (!*slot) return slot;
+    AkwSymbol *sym = akw_symbol_table_get(table, *slot - 1);
+    if (sym->hash == hash && sym->length == length
+     && !memcmp(sym->chars, chars, length))
+      return slot;
+    i = (i + 1) & mask;
+  }
+}
+
+static inline void grow(AkwSymbolTable *table, int *rc)
+{
+  int capacity = table->capacity << 1;
+  if (capacity > AKW_MAX_CAPACITY)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  int *slots = akw_memory_alloc(sizeof(*slots) * capacity);
+  if (!slots)
+  {
+    *rc = AKW_RANGE_ERROR;
+    return;
+  }
+  memset(slots, 0, sizeof(*slots) * capacity);
+  akw_memory_dealloc(table->slots, sizeof(*table->slots) * table->capacity);
+  table->capacity = capacity;
+  table->slots = slots;
+  int n = table->symbols.count;
+  int mask = capacity - 1;
+  for (int i = 0; i < n; ++i)
+  {
+    int j = (int) (akw_symbol_table_get(table, i)->hash & (uint32_t) mask);
+    while (slots[j])
+      j = (j + 1) & mask;
+    slots[j] = i + 1;
+  }
+}
+
+static inline char *copy_chars(AkwSymbolTable *table, int length,
+  const char *chars, int *rc)
+{
+  AkwSymbolBlock *block = table->blocks;
+  if (!block || block->size - block->used < length)
+  {
+    int size = length > BLOCK_SIZE ? length : BLOCK_SIZE;
+    block = akw_memory_alloc(sizeof(*block) + size);
+    if (!block)
+    {
+      *rc = AKW_RANGE_ERROR;
+      return NULL;
+    }
+    block->next = table->blocks;
+    block->size = size;
+    block->used = 0;
+    table->blocks = block;
+  }
+  char *copy = (char *) &block[1] + block->used;
+  memcpy(copy, chars, length);
+  block->used += length;
+  return copy;
+}
+
+void akw_symbol_table_init(AkwSymbolTable *table)
+{
+  int capacity = MIN_SLOTS;
+  int *slots = akw_memory_alloc(sizeof(*slots) * capacity);
+  memset(slots, 0, sizeof(*slots) * capacity);
+  table->capacity = capacity;
+  table->slots = slots;
+  akw_vector_init(&table->symbols);
+  table->blocks = NULL;
+}
+
+void akw_symbol_table_deinit(AkwSymbolTable *table)
+{
+  akw_memory_dealloc(table->slots, sizeof(*table->slots) * table->capacity);
+  akw_vector_deinit(&table->symbols);
+  AkwSymbolBlock *block = table->blocks;
+  while (block)
+  {
+    AkwSymbolBlock *next = block->next;
+    akw_memory_dealloc(block, sizeof(*block) + block->size);
+    block = next;
+  }
+}
+
+int akw_symbol_table_intern(AkwSymbolTable *table, int length, char *chars,
+  int *rc)
+{
+  uint32_t hash = hash_name(length, chars);
+  int *slot = find_slot(table, length, chars, hash);
+  if (*slot) return *slot - 1;
+  // Kept at most half full.
+  if ((table->symbols.count + 1) << 1 > table->capacity)
+  {
+    grow(table, rc);
+    if (!akw_is_ok(*rc)) return -1;
+    slot = find_slot(table, length, chars, hash);
+  }
+  char *copy = copy_chars(table, length, chars, rc);
+  if (!akw_is_ok(*rc)) return -1;
+  AkwSymbol sym = {
+    .length = length,
+    .chars = copy,
+    .hash = hash
+  };
+  akw_vector_append(&table->symbols, sym, rc);
+  if (!akw_is_ok(*rc)) return -1;
+  *slot = table->symbols.count;
+  return *slot - 1;
+}
+
+int akw_symbol_table_find(AkwSymbolTable *table, int length, char *chars)
+{
+  int *slot = find_slot(table, length, chars, hash_name(length, chars));
+  return *slot - 1;
+}
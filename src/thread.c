@@ -0,0 +1,175 @@
+//
+// thread.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/thread.h"
+#include "akwan/atomic.h"
+#include "akwan/common.h"
+
+#ifndef _WIN32
+  #include <sched.h>
+  #include <unistd.h>
+#endif
+
+static int nextThreadId = 1;
+static AKW_THREAD_LOCAL int currentThreadId = 0;
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID arg);
+#else
+static void *thread_main(void *arg);
+#endif
+
+#ifdef _WIN32
+static DWORD WINAPI thread_main(LPVOID arg)
+{
+  AkwThread *thread = arg;
+  thread->fn(thread->arg);
+  return 0;
+}
+#else
+static void *thread_main(void *arg)
+{
+  AkwThread *thread = arg;
+  thread->fn(thread->arg);
+  return NULL;
+}
+#endif
+
+void akw_thread_start(AkwThread *thread, AkwThreadFn fn, void *arg, int *rc)
+{
+  thread->fn = fn;
+  thread->arg = arg;
+#ifdef _WIN32
+  thread->handle = CreateThread(NULL, 0, thread_main, thread, 0, NULL);
+  if (thread->handle) return;
+#else
+  if (!pthread_create(&thread->handle, NULL, thread_main, thread)) return;
+#endif
+  *rc = AKW_SYSTEM_ERROR;
+}
+
+void akw_thread_join(AkwThread *thread)
+{
+#ifdef _WIN32
+  WaitForSingleObject(thread->handle, INFINITE);
+  CloseHandle(thread->handle);
+#else
+  pthread_join(thread->handle, NULL);
+#endif
+}
+
+int akw_thread_count_cores(void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  int n = (int) info.dwNumberOfProcessors;
+#else
+  int n = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+  return (n > 0) ? n : 1;
+}
+
+int akw_thread_id(void)
+{
+  if (!currentThreadId)
+    currentThreadId = akw_atomic_fetch_add(&nextThreadId, 1);
+  return currentThreadId;
+}
+
+void akw_thread_yield(void)
+{
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+void akw_mutex_init(AkwMutex *mutex)
+{
+#ifdef _WIN32
+  InitializeSRWLock(&mutex->lock);
+#else
+  pthread_mutex_init(&mutex->lock, NULL);
+#endif
+}
+
+void akw_mutex_deinit(AkwMutex *mutex)
+{
+#ifdef _WIN32
+  (void) mutex;
+#else
+  pthread_mutex_destroy(&mutex->lock);
+#endif
+}
+
+void akw_mutex_lock(AkwMutex *mutex)
+{
+#ifdef _WIN32
+  AcquireSRWLockExclusive(&mutex->lock);
+#else
+  pthread_mutex_lock(&mutex->lock);
+#endif
+}
+
+void akw_mutex_unlock(AkwMutex *mutex)
+{
+#ifdef _WIN32
+  ReleaseSRWLockExclusive(&mutex->lock);
+#else
+  pthread_mutex_unlock(&mutex->lock);
+#endif
+}
+
+void akw_cond_init(AkwCond *cond)
+{
+#ifdef _WIN32
+  InitializeConditionVariable(&cond->cond);
+#else
+  pthread_cond_init(&cond->cond, NULL);
+#endif
+}
+
+void akw_cond_deinit(AkwCond *cond)
+{
+#ifdef _WIN32
+  (void) cond;
+#else
+  pthread_cond_destroy(&cond->cond);
+#endif
+}
+
+void akw_cond_wait(AkwCond *cond, AkwMutex *mutex)
+{
+#ifdef _WIN32
+  SleepConditionVariableSRW(&cond->cond, &mutex->lock, INFINITE, 0);
+#else
+  pthread_cond_wait(&cond->cond, &mutex->lock);
+#endif
+}
+
+void akw_cond_signal(AkwCond *cond)
+{
+#ifdef _WIN32
+  WakeConditionVariable(&cond->cond);
+#else
+  pthread_cond_signal(&cond->cond);
+#endif
+}
+
+void akw_cond_broadcast(AkwCond *cond)
+{
+#ifdef _WIN32
+  WakeAllConditionVariable(&cond->cond);
+#else
+  pthread_cond_broadcast(&cond->cond);
+#endif
+}
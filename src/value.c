@@ -11,13 +11,159 @@
 #include "akwan/value.h"
 #include <stdio.h>
 #include "akwan/array.h"
+#include "akwan/memory.h"
 #include "akwan/range.h"
 #include "akwan/string.h"
+#include "akwan/writer.h"
 
-const char *akw_value_type_name(AkwValue val)
+// In biased mode the shared count moves in steps of two, and its lowest
+// bit records that the owner has merged its own count into it.
+#define SHARED_MERGED (1)
+#define SHARED_ONE    (2)
+
+typedef AkwVector(AkwValue) ValueVector;
+
+static AKW_THREAD_LOCAL AkwReleaseQueue *currentQueue = NULL;
+
+static inline void enqueue(AkwReleaseQueue *queue, AkwValue val);
+static inline bool push_pending(ValueVector *pending, AkwValue val);
+#ifdef AKW_BIASED_RC
+static inline bool give_up_owner(AkwValue val, int threadId);
+static inline void share_recursive(AkwValue val, int threadId);
+#endif
+static inline size_t footprint(AkwValue val);
+static inline void transfer(AkwValue val, AkwMemoryStats *from,
+  AkwMemoryStats *to, bool isUnshared, int *rc);
+
+static inline void enqueue(AkwReleaseQueue *queue, AkwValue val)
+{
+  // The queue is bookkeeping, not script memory, so it is neither
+  // accounted nor subject to the memory limit.
+  // If it cannot grow, the array is freed right away, recursively.
+  int rc = AKW_OK;
+  akw_vector_append_in(&queue->pending, val, NULL, &rc);
+  if (akw_is_ok(rc)) return;
+  akw_array_free(akw_as_array(val));
+}
+
+static inline bool push_pending(ValueVector *pending, AkwValue val)
+{
+  int rc = AKW_OK;
+  akw_vector_append_in(pending, val, NULL, &rc);
+  return akw_is_ok(rc);
+}
+
+#ifdef AKW_BIASED_RC
+static inline bool give_up_owner(AkwValue val, int threadId)
+{
+  AkwObject *obj = akw_as_object(val);
+  if (akw_object_is_immortal(obj)) return false;
+  if (akw_atomic_load(&obj->ownerId) != threadId) return false;
+  akw_atomic_fetch_add(&obj->sharedCount,
+    obj->refCount * SHARED_ONE + SHARED_MERGED);
+  obj->refCount = 0;
+  akw_atomic_store(&obj->ownerId, 0);
+  return akw_is_array(val);
+}
+
+static inline void share_recursive(AkwValue val, int threadId)
+{
+  // Used only when the pending stack cannot grow.
+  if (!give_up_owner(val, threadId)) return;
+  AkwArray *arr = akw_as_array(val);
+  int n = akw_array_count(arr);
+  for (int i = 0; i < n; ++i)
+  {
+    AkwValue elem = akw_array_get(arr, i);
+    if (akw_is_object(elem))
+      share_recursive(elem, threadId);
+  }
+}
+#endif
+
+static inline size_t footprint(AkwValue val)
+{
+  if (akw_is_string(val))
+    return sizeof(AkwString) + (size_t) akw_as_string(val)->capacity;
+  if (akw_is_range(val))
+    return sizeof(AkwRange);
+  AkwArray *arr = akw_as_array(val);
+  return sizeof(*arr) + sizeof(AkwValue) * (size_t) arr->vec.capacity;
+}
+
+static inline void transfer(AkwValue val, AkwMemoryStats *from,
+  AkwMemoryStats *to, bool isUnshared, int *rc)
+{
+  // Moves the objects charged to from over to to, or every object of an
+  // unshared value whoever it is charged to. Otherwise the walk only
+  // descends into arrays it moves, so an object is visited once however
+  // often it is shared. Objects left behind when the walk runs out of
+  // memory keep their stats, which remains consistent.
+  if (!akw_is_object(val)) return;
+  ValueVector pending;
+  akw_vector_init_in(&pending, NULL);
+  akw_vector_append_in(&pending, val, NULL, rc);
+  while (akw_is_ok(*rc) && !akw_vector_is_empty(&pending))
+  {
+    AkwValue top = akw_vector_get(&pending, --pending.count);
+    AkwObject *obj = akw_as_object(top);
+    if (akw_object_is_immortal(obj)) continue;
+    if (!isUnshared && obj->stats != from) continue;
+    akw_memory_move_object(obj->stats, to, akw_type(top), footprint(top));
+    obj->stats = to;
+    if (!akw_is_array(top)) continue;
+    AkwArray *arr = akw_as_array(top);
+    int n = akw_array_count(arr);
+    for (int i = 0; i < n && akw_is_ok(*rc); ++i)
+    {
+      AkwValue elem = akw_array_get(arr, i);
+      if (akw_is_object(elem))
+        akw_vector_append_in(&pending, elem, NULL, rc);
+    }
+  }
+  akw_vector_deinit_in(&pending, NULL);
+}
+
+#ifdef AKW_BIASED_RC
+void akw_object_biased_incref(AkwObject *obj)
+{
+  if (akw_atomic_load(&obj->ownerId) == akw_thread_id())
+  {
+    ++obj->refCount;
+    return;
+  }
+  akw_atomic_fetch_add(&obj->sharedCount, SHARED_ONE);
+}
+
+bool akw_object_biased_decref(AkwObject *obj)
+{
+  if (akw_atomic_load(&obj->ownerId) == akw_thread_id())
+  {
+    if (--obj->refCount) return false;
+    akw_atomic_store(&obj->ownerId, 0);
+    int shared = akw_atomic_fetch_or(&obj->sharedCount, SHARED_MERGED);
+    return shared < SHARED_ONE;
+  }
+  int shared = akw_atomic_fetch_add(&obj->sharedCount, -SHARED_ONE);
+  return shared - SHARED_ONE == SHARED_MERGED;
+}
+
+int akw_object_biased_ref_count(AkwObject *obj)
+{
+  int count = akw_atomic_load(&obj->sharedCount) / SHARED_ONE;
+  if (akw_atomic_load(&obj->ownerId) == akw_thread_id())
+    count += obj->refCount;
+  return count;
+}
+#endif
+
+_Static_assert(AKW_TYPE_REF < AKW_MEMORY_MAX_OBJECT_TYPES,
+  "AkwMemoryStats cannot count every object type");
+
+const char *akw_type_name(AkwType type)
 {
   char *name = "Nil";
-  switch (akw_type(val))
+  switch (type)
   {
   case AKW_TYPE_NIL:
     break;
@@ -25,7 +171,7 @@ const char *akw_value_type_name(AkwValue val)
     name = "Bool";
     break;
   case AKW_TYPE_NUMBER:
-    name = (akw_as_number(val) == akw_as_int(val)) ? "Int" : "Number";
+    name = "Number";
     break;
   case AKW_TYPE_STRING:
     name = "String";
@@ -43,6 +189,13 @@ const char *akw_value_type_name(AkwValue val)
   return name;
 }
 
+const char *akw_value_type_name(AkwValue val)
+{
+  if (akw_is_int(val))
+    return "Int";
+  return akw_type_name(akw_type(val));
+}
+
 void akw_value_free(AkwValue val)
 {
   switch (akw_type(val))
@@ -85,30 +238,251 @@ void akw_value_release(AkwValue val)
   }
 }
 
+void akw_value_dispose(AkwValue val)
+{
+  AkwReleaseQueue *queue = currentQueue;
+#ifdef AKW_DEFERRED_RC
+  if (queue && queue->isDeferred)
+  {
+    akw_release_queue_track(queue, val);
+    return;
+  }
+#endif
+  if (!akw_is_array(val))
+  {
+    akw_value_free(val);
+    return;
+  }
+  if (queue)
+  {
+    enqueue(queue, val);
+    if (queue->draining) return;
+    akw_release_queue_drain(queue, queue->budget);
+    return;
+  }
+  AkwReleaseQueue tmpQueue;
+  akw_release_queue_init(&tmpQueue, 0);
+  enqueue(&tmpQueue, val);
+  akw_release_queue_deinit(&tmpQueue);
+}
+
+AkwValue akw_value_copy(AkwValue val, int *rc)
+{
+  // Shallow: a copied array shares its elements with the original.
+  if (akw_is_string(val))
+  {
+    AkwString *str = akw_as_string(val);
+    AkwString *result = akw_string_new_from(str->length, str->chars, rc);
+    return akw_is_ok(*rc) ? akw_string_value(result) : val;
+  }
+  if (akw_is_range(val))
+  {
+    AkwRange *range = akw_as_range(val);
+    AkwRange *result = akw_range_new(range->start, range->end);
+    if (!result) *rc = AKW_RANGE_ERROR;
+    return result ? akw_range_value(result) : val;
+  }
+  if (!akw_is_array(val)) return val;
+  AkwArray *arr = akw_as_array(val);
+  int n = akw_array_count(arr);
+  AkwArray *result = akw_array_new_with_capacity(n, rc);
+  if (!akw_is_ok(*rc)) return val;
+  for (int i = 0; i < n; ++i)
+  {
+    AkwValue elem = akw_array_get(arr, i);
+    akw_vector_set(&result->vec, i, elem);
+    akw_value_retain(elem);
+  }
+  result->vec.count = n;
+  return akw_array_value(result);
+}
+
+void akw_value_detach(AkwValue *val, int *rc)
+{
+  // Copy-on-write: before a value is mutated in place, a frozen or shared
+  // value is replaced by a private copy in the local heap.
+  if (!akw_is_object(*val)) return;
+  AkwObject *obj = akw_as_object(*val);
+  if (!akw_object_is_frozen(obj) && akw_object_ref_count(obj) <= 1) return;
+  AkwValue result = akw_value_copy(*val, rc);
+  if (!akw_is_ok(*rc)) return;
+  akw_value_retain(result);
+  akw_value_release(*val);
+  *val = result;
+}
+
+void akw_value_share(AkwValue val)
+{
+  // References counted by the owner cannot be dropped by another thread,
+  // so a value handed to another thread gives up its owner first.
+#ifdef AKW_BIASED_RC
+  if (!akw_is_object(val)) return;
+  int threadId = akw_thread_id();
+  ValueVector pending;
+  akw_vector_init_in(&pending, NULL);
+  if (!push_pending(&pending, val))
+  {
+    share_recursive(val, threadId);
+    return;
+  }
+  while (!akw_vector_is_empty(&pending))
+  {
+    AkwValue top = akw_vector_get(&pending, --pending.count);
+    if (!give_up_owner(top, threadId)) continue;
+    AkwArray *arr = akw_as_array(top);
+    int n = akw_array_count(arr);
+    for (int i = 0; i < n; ++i)
+    {
+      AkwValue elem = akw_array_get(arr, i);
+      if (!akw_is_object(elem)) continue;
+      if (!push_pending(&pending, elem))
+        share_recursive(elem, threadId);
+    }
+  }
+  akw_vector_deinit_in(&pending, NULL);
+#else
+  (void) val;
+#endif
+}
+
+void akw_value_transfer(AkwValue val, AkwMemoryStats *from, AkwMemoryStats *to,
+  int *rc)
+{
+  if (from == to) return;
+  transfer(val, from, to, false, rc);
+}
+
+void akw_value_transfer_unshared(AkwValue val, AkwMemoryStats *to, int *rc)
+{
+  transfer(val, NULL, to, true, rc);
+}
+
 void akw_value_print(AkwValue val, bool quoted)
 {
-  switch (akw_type(val))
+  AkwWriter w;
+  akw_writer_init(&w, stdout);
+  akw_writer_write_value(&w, val, quoted);
+  akw_writer_deinit(&w);
+}
+
+void akw_release_queue_init(AkwReleaseQueue *queue, int budget)
+{
+  queue->budget = budget;
+  queue->draining = false;
+  akw_vector_init_in(&queue->pending, NULL);
+#ifdef AKW_DEFERRED_RC
+  queue->isDeferred = false;
+  queue->reconcileAt = AKW_RELEASE_QUEUE_MIN_RECONCILE;
+  akw_vector_init_in(&queue->zeroCount, NULL);
+#endif
+}
+
+void akw_release_queue_deinit(AkwReleaseQueue *queue)
+{
+#ifdef AKW_DEFERRED_RC
+  akw_release_queue_reconcile(queue, 0, NULL);
+#endif
+  akw_release_queue_drain(queue, 0);
+  akw_vector_deinit_in(&queue->pending, NULL);
+#ifdef AKW_DEFERRED_RC
+  akw_vector_deinit_in(&queue->zeroCount, NULL);
+#endif
+}
+
+AkwReleaseQueue *akw_release_queue_swap(AkwReleaseQueue *queue)
+{
+  AkwReleaseQueue *prevQueue = currentQueue;
+  currentQueue = queue;
+  return prevQueue;
+}
+
+bool akw_release_queue_drain(AkwReleaseQueue *queue, int budget)
+{
+  // Dead arrays are taken apart one element at a time, and the elements
+  // that die with them are pushed onto the queue instead of being freed
+  // recursively. A positive budget caps how many elements are released.
+  AkwReleaseQueue *prevQueue = akw_release_queue_swap(queue);
+  queue->draining = true;
+  int work = 0;
+  while (!akw_vector_is_empty(&queue->pending))
   {
-  case AKW_TYPE_NIL:
-    printf("nil");
-    break;
-  case AKW_TYPE_BOOL:
-    printf("%s", akw_as_bool(val) ? "true" : "false");
-    break;
-  case AKW_TYPE_NUMBER:
-    printf("%g", akw_as_number(val));
-    break;
-  case AKW_TYPE_STRING:
-    akw_string_print(akw_as_string(val), quoted);
-    break;
-  case AKW_TYPE_RANGE:
-    akw_range_print(akw_as_range(val));
-    break;
-  case AKW_TYPE_ARRAY:
-    akw_array_print(akw_as_array(val));
-    break;
-  case AKW_TYPE_REF:
-    printf("<ref %p>", val.asPointer);
-    break;
+    if (budget > 0 && work == budget) break;
+    ++work;
+    AkwValue val = akw_vector_get(&queue->pending, queue->pending.count - 1);
+    AkwArray *arr = akw_as_array(val);
+    if (akw_array_is_empty(arr))
+    {
+      --queue->pending.count;
+      akw_array_free(arr);
+      continue;
+    }
+    --arr->vec.count;
+    AkwValue elem = akw_array_get(arr, arr->vec.count);
+    akw_value_release(elem);
+  }
+  queue->draining = false;
+  akw_release_queue_swap(prevQueue);
+  return akw_vector_is_empty(&queue->pending);
+}
+
+#ifdef AKW_DEFERRED_RC
+void akw_release_queue_track(AkwReleaseQueue *queue, AkwValue val)
+{
+  AkwObject *obj = akw_as_object(val);
+  // An object the table cannot take stays unflagged, and is tracked the
+  // next time its count drops to zero.
+  if (obj->flags & AKW_OBJECT_FLAG_ZERO_COUNT) return;
+  int rc = AKW_OK;
+  akw_vector_append_in(&queue->zeroCount, val, NULL, &rc);
+  if (!akw_is_ok(rc)) return;
+  obj->flags |= AKW_OBJECT_FLAG_ZERO_COUNT;
+}
+
+void akw_release_queue_reconcile(AkwReleaseQueue *queue, int n, AkwValue *roots)
+{
+  // Objects in the zero count table have no counted references, so they
+  // are garbage unless a root (a VM stack slot) still points to them.
+  // Freeing one may drop others to zero; those are appended to the table
+  // and handled by the same pass.
+  AkwReleaseQueue *prevQueue = akw_release_queue_swap(queue);
+  for (int i = 0; i < n; ++i)
+  {
+    AkwValue val = roots[i];
+    if (!akw_is_object(val)) continue;
+    AkwObject *obj = akw_as_object(val);
+    if (akw_object_is_immortal(obj)) continue;
+    obj->flags |= AKW_OBJECT_FLAG_MARKED;
+  }
+  int j = 0;
+  for (int i = 0; i < queue->zeroCount.count; ++i)
+  {
+    AkwValue val = akw_vector_get(&queue->zeroCount, i);
+    AkwObject *obj = akw_as_object(val);
+    if (akw_object_ref_count(obj) || akw_object_is_immortal(obj))
+    {
+      obj->flags &= ~AKW_OBJECT_FLAG_ZERO_COUNT;
+      continue;
+    }
+    if (obj->flags & AKW_OBJECT_FLAG_MARKED)
+    {
+      akw_vector_set(&queue->zeroCount, j, val);
+      ++j;
+      continue;
+    }
+    akw_value_free(val);
+  }
+  queue->zeroCount.count = j;
+  for (int i = 0; i < n; ++i)
+  {
+    AkwValue val = roots[i];
+    if (!akw_is_object(val)) continue;
+    AkwObject *obj = akw_as_object(val);
+    if (akw_object_is_immortal(obj)) continue;
+    obj->flags &= ~AKW_OBJECT_FLAG_MARKED;
   }
+  int reconcileAt = j << 1;
+  queue->reconcileAt = (reconcileAt > AKW_RELEASE_QUEUE_MIN_RECONCILE) ?
+    reconcileAt : AKW_RELEASE_QUEUE_MIN_RECONCILE;
+  akw_release_queue_swap(prevQueue);
 }
+#endif
@@ -21,9 +21,34 @@
     handle((vm), (c), (ip), (s)); \
   } while (0)
 
+// In deferred mode, references held by stack slots are not counted.
+// Objects nobody counts sit in the zero count table of the release queue
+// until a reconciliation against the stack proves them dead.
+#ifdef AKW_DEFERRED_RC
+  #define stack_retain(v)  do { (void) (v); } while (0)
+  #define stack_release(v) do { (void) (v); } while (0)
+  #define heap_retain(v)   akw_value_retain(v)
+#else
+  #define stack_retain(v)  akw_value_retain(v)
+  #define stack_release(v) akw_value_release(v)
+  #define heap_retain(v)   do { (void) (v); } while (0)
+#endif
+
 typedef void (*AkwInstructionHandleFn)(AkwVM *, AkwChunk *, uint8_t *, AkwValue *);
 
+typedef struct
+{
+  AkwMemoryStats  *memStats;
+  AkwReleaseQueue *releaseQueue;
+} Binding;
+
+static inline Binding bind(AkwVM *vm);
+static inline void unbind(Binding binding);
+static inline void clear_stack(AkwVM *vm);
+static inline void stack_overflow_error(AkwVM *vm);
 static inline void push(AkwVM *vm, AkwValue val);
+static inline void stack_adopt(AkwVM *vm, AkwValue val);
+static inline void out_of_memory_error(AkwVM *vm);
 static inline void range_get_element(AkwVM *vm, AkwValue val1, AkwValue val2);
 static inline void array_get_element(AkwVM *vm, AkwValue val1, AkwValue val2);
 static void do_nil(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
@@ -36,6 +61,7 @@ static void do_array(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_local_ref(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_pop(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_get_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
+static void do_move_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_set_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_get_local_by_ref(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_set_local_by_ref(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
@@ -48,31 +74,88 @@ static void do_mod(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_neg(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 static void do_return(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots);
 
-static AkwInstructionHandleFn instructionHandles[] = {
+static const AkwInstructionHandleFn instructionHandles[] = {
   [AKW_OP_NIL]              = do_nil,              [AKW_OP_FALSE]            = do_false,
   [AKW_OP_TRUE]             = do_true,             [AKW_OP_INT]              = do_int,
   [AKW_OP_CONST]            = do_const,            [AKW_OP_RANGE]            = do_range,
   [AKW_OP_ARRAY]            = do_array,            [AKW_OP_LOCAL_REF]        = do_local_ref,
   [AKW_OP_POP]              = do_pop,              [AKW_OP_GET_LOCAL]        = do_get_local,
-  [AKW_OP_SET_LOCAL]        = do_set_local,        [AKW_OP_GET_LOCAL_BY_REF] = do_get_local_by_ref,
-  [AKW_OP_SET_LOCAL_BY_REF] = do_set_local_by_ref, [AKW_OP_GET_ELEMENT]      = do_get_element,
-  [AKW_OP_ADD]              = do_add,              [AKW_OP_SUB]              = do_sub,
-  [AKW_OP_MUL]              = do_mul,              [AKW_OP_DIV]              = do_div,
-  [AKW_OP_MOD]              = do_mod,              [AKW_OP_NEG]              = do_neg,
-  [AKW_OP_RETURN]           = do_return
+  [AKW_OP_MOVE_LOCAL]       = do_move_local,       [AKW_OP_SET_LOCAL]        = do_set_local,
+  [AKW_OP_GET_LOCAL_BY_REF] = do_get_local_by_ref, [AKW_OP_SET_LOCAL_BY_REF] = do_set_local_by_ref,
+  [AKW_OP_GET_ELEMENT]      = do_get_element,      [AKW_OP_ADD]              = do_add,
+  [AKW_OP_SUB]              = do_sub,              [AKW_OP_MUL]              = do_mul,
+  [AKW_OP_DIV]              = do_div,              [AKW_OP_MOD]              = do_mod,
+  [AKW_OP_NEG]              = do_neg,              [AKW_OP_RETURN]           = do_return
 };
 
+static inline Binding bind(AkwVM *vm)
+{
+  return (Binding) {
+    .memStats = akw_memory_swap_stats(&vm->memStats),
+    .releaseQueue = akw_release_queue_swap(&vm->releaseQueue)
+  };
+}
+
+static inline void unbind(Binding binding)
+{
+  akw_memory_swap_stats(binding.memStats);
+  akw_release_queue_swap(binding.releaseQueue);
+}
+
+static inline void clear_stack(AkwVM *vm)
+{
+  while (!akw_stack_is_empty(&vm->stack))
+  {
+    AkwValue val = akw_stack_get(&vm->stack, 0);
+    akw_stack_pop(&vm->stack);
+    stack_release(val);
+  }
+}
+
+static inline void stack_overflow_error(AkwVM *vm)
+{
+  vm->rc = AKW_RANGE_ERROR;
+  akw_error_set(vm->err, "stack overflow");
+}
+
 static inline void push(AkwVM *vm, AkwValue val)
 {
   if (akw_stack_is_full(&vm->stack))
   {
-    vm->rc = AKW_RANGE_ERROR;
-    akw_error_set(vm->err, "stack overflow");
+    stack_overflow_error(vm);
     return;
   }
   akw_stack_push(&vm->stack, val);
 }
 
+static inline void stack_adopt(AkwVM *vm, AkwValue val)
+{
+#ifdef AKW_DEFERRED_RC
+  AkwReleaseQueue *queue = &vm->releaseQueue;
+  AkwObject *obj = akw_as_object(val);
+  if (akw_object_ref_count(obj) || akw_object_is_immortal(obj)) return;
+  akw_release_queue_track(queue, val);
+  if (queue->zeroCount.count < queue->reconcileAt) return;
+  int n = (int) (vm->stack.top - vm->stack.elements) + 1;
+  akw_release_queue_reconcile(queue, n, vm->stack.elements);
+#else
+  (void) vm;
+  akw_value_retain(val);
+#endif
+}
+
+static inline void out_of_memory_error(AkwVM *vm)
+{
+  vm->rc = AKW_RANGE_ERROR;
+  size_t limit = vm->memStats.limit;
+  if (!limit)
+  {
+    akw_error_set(vm->err, "out of memory");
+    return;
+  }
+  akw_error_set(vm->err, "memory limit of %zu byte(s) exceeded", limit);
+}
+
 static inline void range_get_element(AkwVM *vm, AkwValue val1, AkwValue val2)
 {
   if (!akw_is_int(val2))
@@ -91,7 +174,7 @@ static inline void range_get_element(AkwVM *vm, AkwValue val1, AkwValue val2)
   }
   int64_t num = akw_range_get(range, index);
   akw_stack_set(&vm->stack, 1, akw_int_value(num));
-  akw_range_release(range);
+  stack_release(val1);
   akw_stack_pop(&vm->stack);
 }
 
@@ -113,8 +196,8 @@ static inline void array_get_element(AkwVM *vm, AkwValue val1, AkwValue val2)
   }
   AkwValue val = akw_array_get(arr, index);
   akw_stack_set(&vm->stack, 1, val);
-  akw_value_retain(val);
-  akw_array_release(arr);
+  stack_retain(val);
+  stack_release(val1);
   akw_stack_pop(&vm->stack);
 }
 
@@ -159,7 +242,6 @@ static void do_const(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
   AkwValue val = consts[index];
   push(vm, val);
   if (!akw_vm_is_ok(vm)) return;
-  akw_value_retain(val);
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -178,9 +260,15 @@ static void do_range(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
   int64_t start = akw_as_int(val1);
   int64_t end = akw_as_int(val2);
   AkwRange *range = akw_range_new(start, end);
-  akw_stack_set(&vm->stack, 1, akw_range_value(range));
-  akw_object_retain(&range->obj);
+  if (!range)
+  {
+    out_of_memory_error(vm);
+    return;
+  }
+  AkwValue val = akw_range_value(range);
+  akw_stack_set(&vm->stack, 1, val);
   akw_stack_pop(&vm->stack);
+  stack_adopt(vm, val);
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -188,21 +276,31 @@ static void do_array(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
 {
   uint8_t n = ip[1];
   ip += 2;
+  // An empty array takes a new slot.
+  if (!n && akw_stack_is_full(&vm->stack))
+  {
+    stack_overflow_error(vm);
+    return;
+  }
   AkwValue *_slots = &vm->stack.top[1 - n];
   AkwArray *arr = akw_array_new_with_capacity(n, &vm->rc);
   if (!akw_vm_is_ok(vm))
   {
     assert(vm->rc == AKW_RANGE_ERROR);
-    akw_error_set(vm->err, "array too large");
+    out_of_memory_error(vm);
     return;
   }
   arr->vec.count = n;
   for (int i = 0; i < n; ++i)
-    akw_vector_set(&arr->vec, i, _slots[i]);
+  {
+    AkwValue elem = _slots[i];
+    akw_vector_set(&arr->vec, i, elem);
+    heap_retain(elem);
+  }
   AkwValue val = akw_array_value(arr);
   _slots[0] = val;
-  akw_object_retain(&arr->obj);
   vm->stack.top -= n - 1;
+  stack_adopt(vm, val);
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -221,7 +319,7 @@ static void do_pop(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
   ++ip;
   AkwValue val = akw_stack_get(&vm->stack, 0);
   akw_stack_pop(&vm->stack);
-  akw_value_release(val);
+  stack_release(val);
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -232,7 +330,18 @@ static void do_get_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slot
   AkwValue val = slots[index];
   push(vm, val);
   if (!akw_vm_is_ok(vm)) return;
-  akw_value_retain(val);
+  stack_retain(val);
+  dispatch(vm, chunk, ip, slots);
+}
+
+static void do_move_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
+{
+  uint8_t index = ip[1];
+  ip += 2;
+  AkwValue val = slots[index];
+  push(vm, val);
+  if (!akw_vm_is_ok(vm)) return;
+  slots[index] = akw_nil_value();
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -241,8 +350,7 @@ static void do_set_local(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slot
   uint8_t index = ip[1];
   ip += 2;
   AkwValue val = akw_stack_get(&vm->stack, 0);
-  akw_value_retain(val);
-  akw_value_release(slots[index]);
+  stack_release(slots[index]);
   slots[index] = val;
   akw_stack_pop(&vm->stack);
   dispatch(vm, chunk, ip, slots);
@@ -256,7 +364,7 @@ static void do_get_local_by_ref(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValu
   AkwValue val = *ref;
   push(vm, val);
   if (!akw_vm_is_ok(vm)) return;
-  akw_value_retain(val);
+  stack_retain(val);
   dispatch(vm, chunk, ip, slots);
 }
 
@@ -266,8 +374,7 @@ static void do_set_local_by_ref(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValu
   ip += 2;
   AkwValue *ref = akw_as_ref(slots[index]);
   AkwValue val = akw_stack_get(&vm->stack, 0);
-  akw_value_retain(val);
-  akw_value_release(*ref);
+  stack_release(*ref);
   *ref = val;
   akw_stack_pop(&vm->stack);
   dispatch(vm, chunk, ip, slots);
@@ -412,32 +519,90 @@ static void do_return(AkwVM *vm, AkwChunk *chunk, uint8_t *ip, AkwValue *slots)
 void akw_vm_init(AkwVM *vm, int stackSize)
 {
   vm->rc = AKW_OK;
+  vm->err[0] = '\0';
+  akw_memory_stats_init(&vm->memStats);
+  akw_release_queue_init(&vm->releaseQueue, 0);
+#ifdef AKW_DEFERRED_RC
+  vm->releaseQueue.isDeferred = true;
+#endif
+  Binding binding = bind(vm);
   akw_stack_init(&vm->stack, stackSize);
+  unbind(binding);
 }
 
 void akw_vm_deinit(AkwVM *vm)
 {
-  while (!akw_stack_is_empty(&vm->stack))
+  Binding binding = bind(vm);
+  clear_stack(vm);
+  akw_release_queue_deinit(&vm->releaseQueue);
+  akw_stack_deinit(&vm->stack);
+  unbind(binding);
+}
+
+void akw_vm_reset(AkwVM *vm)
+{
+  Binding binding = bind(vm);
+  clear_stack(vm);
+#ifdef AKW_DEFERRED_RC
+  akw_release_queue_reconcile(&vm->releaseQueue, 0, NULL);
+#endif
+  unbind(binding);
+  vm->rc = AKW_OK;
+  vm->err[0] = '\0';
+}
+
+void akw_vm_set_memory_limit(AkwVM *vm, size_t limit, int *rc)
+{
+  // The stack is already charged, so a limit below what is in use could
+  // never be met.
+  if (limit && limit < vm->memStats.bytes)
   {
-    AkwValue val = akw_stack_get(&vm->stack, 0);
-    akw_stack_pop(&vm->stack);
-    akw_value_release(val);
+    *rc = AKW_RANGE_ERROR;
+    return;
   }
-  akw_stack_deinit(&vm->stack);
+  vm->memStats.limit = limit;
+}
+
+void akw_vm_set_release_budget(AkwVM *vm, int budget)
+{
+  vm->releaseQueue.budget = budget;
+}
+
+bool akw_vm_collect(AkwVM *vm, int budget)
+{
+  Binding binding = bind(vm);
+#ifdef AKW_DEFERRED_RC
+  int n = (int) (vm->stack.top - vm->stack.elements) + 1;
+  akw_release_queue_reconcile(&vm->releaseQueue, n, vm->stack.elements);
+#endif
+  bool done = akw_release_queue_drain(&vm->releaseQueue, budget);
+  unbind(binding);
+  return done;
 }
 
 void akw_vm_run(AkwVM *vm, AkwChunk *chunk)
 {
   uint8_t *ip = chunk->code.bytes;
   AkwValue *slots = vm->stack.elements;
+  int used = (int) (vm->stack.top - vm->stack.elements) + 1;
+  if (chunk->maxDepth > vm->stack.size - used)
+  {
+    stack_overflow_error(vm);
+    return;
+  }
+  Binding binding = bind(vm);
   dispatch(vm, chunk, ip, slots);
+  unbind(binding);
 }
 
 void akw_vm_push(AkwVM *vm, AkwValue val)
 {
   push(vm, val);
   if (!akw_vm_is_ok(vm)) return;
-  akw_value_retain(val);
+  if (!akw_is_object(val)) return;
+  Binding binding = bind(vm);
+  stack_adopt(vm, val);
+  unbind(binding);
 }
 
 AkwValue akw_vm_peek(AkwVM *vm)
@@ -449,5 +614,7 @@ void akw_vm_pop(AkwVM *vm)
 {
   AkwValue val = akw_stack_get(&vm->stack, 0);
   akw_stack_pop(&vm->stack);
-  akw_value_release(val);
+  Binding binding = bind(vm);
+  stack_release(val);
+  unbind(binding);
 }
@@ -0,0 +1,545 @@
+//
+// writer.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan/writer.h"
+#include <math.h>
+#include <string.h>
+#include "akwan/array.h"
+#include "akwan/memory.h"
+#include "akwan/range.h"
+#include "akwan/string.h"
+#include "akwan/vector.h"
+
+#define SIGNIFICAND_MASK (0x000fffffffffffffULL)
+#define EXPONENT_MASK    (0x7ff0000000000000ULL)
+#define HIDDEN_BIT       (0x0010000000000000ULL)
+#define EXPONENT_BIAS    (1075)
+
+#define MAX_NUMBER_LENGTH (32)
+
+// A floating-point number with a 64-bit significand, f * 2^e.
+typedef struct
+{
+  uint64_t f;
+  int      e;
+} Fp;
+
+typedef struct
+{
+  AkwArray *arr;
+  int      index;
+} Frame;
+
+typedef AkwVector(Frame) FrameVector;
+
+static const char digitPairs[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const uint64_t cachedPowersF[] = {
+  0xfa8fd5a0081c0288ULL, 0xbaaee17fa23ebf76ULL, 0x8b16fb203055ac76ULL,
+  0xcf42894a5dce35eaULL, 0x9a6bb0aa55653b2dULL, 0xe61acf033d1a45dfULL,
+  0xab70fe17c79ac6caULL, 0xff77b1fcbebcdc4fULL, 0xbe5691ef416bd60cULL,
+  0x8dd01fad907ffc3cULL, 0xd3515c2831559a83ULL, 0x9d71ac8fada6c9b5ULL,
+  0xea9c227723ee8bcbULL, 0xaecc49914078536dULL, 0x823c12795db6ce57ULL,
+  0xc21094364dfb5637ULL, 0x9096ea6f3848984fULL, 0xd77485cb25823ac7ULL,
+  0xa086cfcd97bf97f4ULL, 0xef340a98172aace5ULL, 0xb23867fb2a35b28eULL,
+  0x84c8d4dfd2c63f3bULL, 0xc5dd44271ad3cdbaULL, 0x936b9fcebb25c996ULL,
+  0xdbac6c247d62a584ULL, 0xa3ab66580d5fdaf6ULL, 0xf3e2f893dec3f126ULL,
+  0xb5b5ada8aaff80b8ULL, 0x87625f056c7c4a8bULL, 0xc9bcff6034c13053ULL,
+  0x964e858c91ba2655ULL, 0xdff9772470297ebdULL, 0xa6dfbd9fb8e5b88fULL,
+  0xf8a95fcf88747d94ULL, 0xb94470938fa89bcfULL, 0x8a08f0f8bf0f156bULL,
+  0xcdb02555653131b6ULL, 0x993fe2c6d07b7facULL, 0xe45c10c42a2b3b06ULL,
+  0xaa242499697392d3ULL, 0xfd87b5f28300ca0eULL, 0xbce5086492111aebULL,
+  0x8cbccc096f5088ccULL, 0xd1b71758e219652cULL, 0x9c40000000000000ULL,
+  0xe8d4a51000000000ULL, 0xad78ebc5ac620000ULL, 0x813f3978f8940984ULL,
+  0xc097ce7bc90715b3ULL, 0x8f7e32ce7bea5c70ULL, 0xd5d238a4abe98068ULL,
+  0x9f4f2726179a2245ULL, 0xed63a231d4c4fb27ULL, 0xb0de65388cc8ada8ULL,
+  0x83c7088e1aab65dbULL, 0xc45d1df942711d9aULL, 0x924d692ca61be758ULL,
+  0xda01ee641a708deaULL, 0xa26da3999aef774aULL, 0xf209787bb47d6b85ULL,
+  0xb454e4a179dd1877ULL, 0x865b86925b9bc5c2ULL, 0xc83553c5c8965d3dULL,
+  0x952ab45cfa97a0b3ULL, 0xde469fbd99a05fe3ULL, 0xa59bc234db398c25ULL,
+  0xf6c69a72a3989f5cULL, 0xb7dcbf5354e9beceULL, 0x88fcf317f22241e2ULL,
+  0xcc20ce9bd35c78a5ULL, 0x98165af37b2153dfULL, 0xe2a0b5dc971f303aULL,
+  0xa8d9d1535ce3b396ULL, 0xfb9b7cd9a4a7443cULL, 0xbb764c4ca7a44410ULL,
+  0x8bab8eefb6409c1aULL, 0xd01fef10a657842cULL, 0x9b10a4e5e9913129ULL,
+  0xe7109bfba19c0c9dULL, 0xac2820d9623bf429ULL, 0x80444b5e7aa7cf85ULL,
+  0xbf21e44003acdd2dULL, 0x8e679c2f5e44ff8fULL, 0xd433179d9c8cb841ULL,
+  0x9e19db92b4e31ba9ULL, 0xeb96bf6ebadf77d9ULL, 0xaf87023b9bf0ee6bULL
+};
+
+static const int16_t cachedPowersE[] = {
+  -1220, -1193, -1166, -1140, -1113, -1087, -1060, -1034, -1007, -980,
+  -954, -927, -901, -874, -847, -821, -794, -768, -741, -715,
+  -688, -661, -635, -608, -582, -555, -529, -502, -475, -449,
+  -422, -396, -369, -343, -316, -289, -263, -236, -210, -183,
+  -157, -130, -103, -77, -50, -24, 3, 30, 56, 83,
+  109, 136, 162, 189, 216, 242, 269, 295, 322, 348,
+  375, 402, 428, 455, 481, 508, 534, 561, 588, 614,
+  641, 667, 694, 720, 747, 774, 800, 827, 853, 880,
+  907, 933, 960, 986, 1013, 1039, 1066
+};
+
+static const uint64_t powersOf10[] = {
+  1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL,
+  100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL,
+  1000000000000ULL, 10000000000000ULL, 100000000000000ULL,
+  1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+  1000000000000000000ULL, 10000000000000000000ULL
+};
+
+static inline void write_stream(AkwWriter *w, int length, const char *chars);
+static inline bool grow(AkwWriter *w, int capacity);
+static inline int format_uint(uint64_t num, char *end);
+static inline Fp fp_from_double(double num);
+static inline Fp fp_normalize(Fp x);
+static inline Fp fp_mul(Fp x, Fp y);
+static inline void fp_boundaries(Fp v, Fp *minus, Fp *plus);
+static inline Fp cached_power(int e, int *k);
+static inline int count_digits(uint32_t num);
+static inline void grisu_round(char *digits, int len, uint64_t delta,
+  uint64_t rest, uint64_t tenKappa, uint64_t distance);
+static inline void digit_gen(Fp w, Fp mp, uint64_t delta, char *digits,
+  int *len, int *k);
+static inline void grisu2(double num, char *digits, int *len, int *k);
+static inline int format_exponent(int exp, char *chars);
+static inline int format_double(double num, char *chars);
+static inline void write_scalar(AkwWriter *w, AkwValue val, bool quoted);
+
+static inline void write_stream(AkwWriter *w, int length, const char *chars)
+{
+  if (fwrite(chars, 1, (size_t) length, w->stream) != (size_t) length)
+    w->rc = AKW_SYSTEM_ERROR;
+}
+
+static inline bool grow(AkwWriter *w, int capacity)
+{
+  int rc = AKW_OK;
+  akw_buffer_ensure_capacity_in(&w->buf, capacity, w->memStats, &rc);
+  return akw_is_ok(rc);
+}
+
+static inline int format_uint(uint64_t num, char *end)
+{
+  // Digits are written backwards, two at a time, ending at end.
+  char *chars = end;
+  while (num >= 100)
+  {
+    int i = (int) (num % 100) << 1;
+    num /= 100;
+    chars -= 2;
+    memcpy(chars, &digitPairs[i], 2);
+  }
+  if (num < 10)
+  {
+    *--chars = (char) ('0' + num);
+    return (int) (end - chars);
+  }
+  chars -= 2;
+  memcpy(chars, &digitPairs[num << 1], 2);
+  return (int) (end - chars);
+}
+
+static inline Fp fp_from_double(double num)
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  int biasedExp = (int) ((bits & EXPONENT_MASK) >> 52);
+  uint64_t significand = bits & SIGNIFICAND_MASK;
+  if (!biasedExp)
+    return (Fp) { significand, 1 - EXPONENT_BIAS };
+  return (Fp) { significand + HIDDEN_BIT, biasedExp - EXPONENT_BIAS };
+}
+
+static inline Fp fp_normalize(Fp x)
+{
+  while (!(x.f & (1ULL << 63)))
+  {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+static inline Fp fp_mul(Fp x, Fp y)
+{
+  // The upper half of the 128-bit product, rounded.
+  uint64_t a = x.f >> 32;
+  uint64_t b = x.f & 0xffffffffULL;
+  uint64_t c = y.f >> 32;
+  uint64_t d = y.f & 0xffffffffULL;
+  uint64_t ac = a * c;
+  uint64_t bc = b * c;
+  uint64_t ad = a * d;
+  uint64_t bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & 0xffffffffULL) + (bc & 0xffffffffULL);
+  mid += 1ULL << 31;
+  return (Fp) { ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64 };
+}
+
+static inline void fp_boundaries(Fp v, Fp *minus, Fp *plus)
+{
+  // The midpoints between v and its neighbours, sharing one exponent.
+  Fp p = { (v.f << 1) + 1, v.e - 1 };
+  while (!(p.f & (HIDDEN_BIT << 1)))
+  {
+    p.f <<= 1;
+    --p.e;
+  }
+  p.f <<= 10;
+  p.e -= 10;
+  Fp m = (v.f == HIDDEN_BIT) ? (Fp) { (v.f << 2) - 1, v.e - 2 }
+    : (Fp) { (v.f << 1) - 1, v.e - 1 };
+  m.f <<= m.e - p.e;
+  m.e = p.e;
+  *minus = m;
+  *plus = p;
+}
+
+static inline Fp cached_power(int e, int *k)
+{
+  // A power of ten that brings the exponent of the product into [-60, -32].
+  double dk = (-61 - e) * 0.30102999566398114 + 347;
+  int i = (int) dk;
+  if (dk - i > 0.0) ++i;
+  int index = (i >> 3) + 1;
+  *k = -(-348 + (index << 3));
+  return (Fp) { cachedPowersF[index], cachedPowersE[index] };
+}
+
+static inline int count_digits(uint32_t num)
+{
+  int count = 1;
+  while (num >= 10)
+  {
+    num /= 10;
+    ++count;
+  }
+  return count;
+}
+
+static inline void grisu_round(char *digits, int len, uint64_t delta,
+  uint64_t rest, uint64_t tenKappa, uint64_t distance)
+{
+  while (rest < distance && delta - rest >= tenKappa
+   && (rest + tenKappa < distance
+    || distance - rest > rest + tenKappa - distance))
+  {
+    --digits[len - 1];
+    rest += tenKappa;
+  }
+}
+
+static inline void digit_gen(Fp w, Fp mp, uint64_t delta, char *digits,
+  int *len, int *k)
+{
+  int shift = -mp.e;
+  uint64_t one = 1ULL << shift;
+  uint64_t distance = mp.f - w.f;
+  uint32_t p1 = (uint32_t) (mp.f >> shift);
+  uint64_t p2 = mp.f & (one - 1);
+  int kappa = count_digits(p1);
+  *len = 0;
+  while (kappa > 0)
+  {
+    uint32_t divisor = (uint32_t) powersOf10[kappa - 1];
+    uint32_t d = p1 / divisor;
+    p1 %= divisor;
+    if (d || *len) digits[(*len)++] = (char) ('0' + d);
+    --kappa;
+    uint64_t rest = ((uint64_t) p1 << shift) + p2;
+    if (rest <= delta)
+    {
+      *k += kappa;
+      grisu_round(digits, *len, delta, rest, powersOf10[kappa] << shift, distance);
+      return;
+    }
+  }
+  for (;;)
+  {
+    p2 *= 10;
+    delta *= 10;
+    char d = (char) (p2 >> shift);
+    if (d || *len) digits[(*len)++] = (char) ('0' + d);
+    p2 &= one - 1;
+    --kappa;
+    if (p2 < delta)
+    {
+      *k += kappa;
+      int index = -kappa;
+      grisu_round(digits, *len, delta, p2, one,
+        distance * (index < 20 ? powersOf10[index] : 0));
+      return;
+    }
+  }
+}
+
+static inline void grisu2(double num, char *digits, int *len, int *k)
+{
+  // Produces the digits of a positive finite number, num = digits * 10^k.
+  // They always read back as num, and are the shortest such digits for
+  // nearly every input.
+  Fp v = fp_from_double(num);
+  Fp minus, plus;
+  fp_boundaries(v, &minus, &plus);
+  Fp c = cached_power(plus.e, k);
+  Fp w = fp_mul(fp_normalize(v), c);
+  Fp wp = fp_mul(plus, c);
+  Fp wm = fp_mul(minus, c);
+  ++wm.f;
+  --wp.f;
+  digit_gen(w, wp, wp.f - wm.f, digits, len, k);
+}
+
+static inline int format_exponent(int exp, char *chars)
+{
+  int n = 0;
+  chars[n++] = 'e';
+  chars[n++] = exp < 0 ? '-' : '+';
+  char tmp[4];
+  char *end = &tmp[sizeof(tmp)];
+  int length = format_uint((uint64_t) (exp < 0 ? -exp : exp), end);
+  memcpy(&chars[n], end - length, (size_t) length);
+  return n + length;
+}
+
+static inline int format_double(double num, char *chars)
+{
+  // Fixed notation from 1e-6 up to 1e21, scientific otherwise.
+  int n = 0;
+  if (signbit(num))
+  {
+    chars[n++] = '-';
+    num = -num;
+  }
+  if (num == 0.0)
+  {
+    chars[n++] = '0';
+    return n;
+  }
+  char digits[MAX_NUMBER_LENGTH];
+  int len;
+  int k;
+  grisu2(num, digits, &len, &k);
+  int exp = len + k;
+  if (k >= 0 && exp <= 21)
+  {
+    memcpy(&chars[n], digits, (size_t) len);
+    memset(&chars[n + len], '0', (size_t) k);
+    return n + exp;
+  }
+  if (exp > 0 && exp <= 21)
+  {
+    memcpy(&chars[n], digits, (size_t) exp);
+    chars[n + exp] = '.';
+    memcpy(&chars[n + exp + 1], &digits[exp], (size_t) (len - exp));
+    return n + len + 1;
+  }
+  if (exp > -6 && exp <= 0)
+  {
+    chars[n++] = '0';
+    chars[n++] = '.';
+    memset(&chars[n], '0', (size_t) -exp);
+    n -= exp;
+    memcpy(&chars[n], digits, (size_t) len);
+    return n + len;
+  }
+  chars[n++] = digits[0];
+  if (len > 1)
+  {
+    chars[n++] = '.';
+    memcpy(&chars[n], &digits[1], (size_t) (len - 1));
+    n += len - 1;
+  }
+  return n + format_exponent(exp - 1, &chars[n]);
+}
+
+static inline void write_scalar(AkwWriter *w, AkwValue val, bool quoted)
+{
+  switch (akw_type(val))
+  {
+  case AKW_TYPE_NIL:
+    akw_writer_write(w, 3, "nil");
+    break;
+  case AKW_TYPE_BOOL:
+    if (akw_as_bool(val))
+      akw_writer_write(w, 4, "true");
+    else
+      akw_writer_write(w, 5, "false");
+    break;
+  case AKW_TYPE_NUMBER:
+    akw_writer_write_number(w, akw_as_number(val));
+    break;
+  case AKW_TYPE_STRING:
+    {
+      AkwString *str = akw_as_string(val);
+      if (quoted) akw_writer_write(w, 1, "\"");
+      akw_writer_write(w, str->length, str->chars);
+      if (quoted) akw_writer_write(w, 1, "\"");
+    }
+    break;
+  case AKW_TYPE_RANGE:
+    {
+      AkwRange *range = akw_as_range(val);
+      akw_writer_write_int(w, range->start);
+      akw_writer_write(w, 2, "..");
+      akw_writer_write_int(w, range->end);
+    }
+    break;
+  case AKW_TYPE_ARRAY:
+    break;
+  case AKW_TYPE_REF:
+    {
+      char chars[MAX_NUMBER_LENGTH];
+      int length = snprintf(chars, sizeof(chars), "<ref %p>", val.asPointer);
+      akw_writer_write(w, length, chars);
+    }
+    break;
+  }
+}
+
+void akw_writer_init(AkwWriter *w, FILE *stream)
+{
+  akw_writer_init_in(w, stream, NULL);
+}
+
+void akw_writer_init_in(AkwWriter *w, FILE *stream, AkwMemoryStats *stats)
+{
+  w->rc = AKW_OK;
+  w->stream = stream;
+  w->memStats = stats;
+  akw_buffer_init_in(&w->buf, stats);
+}
+
+void akw_writer_deinit(AkwWriter *w)
+{
+  akw_writer_flush(w);
+  akw_buffer_deinit_in(&w->buf, w->memStats);
+}
+
+void akw_writer_flush(AkwWriter *w)
+{
+  AkwBuffer *buf = &w->buf;
+  if (buf->count)
+    write_stream(w, buf->count, (char *) buf->bytes);
+  akw_buffer_clear(buf);
+  if (fflush(w->stream))
+    w->rc = AKW_SYSTEM_ERROR;
+}
+
+void akw_writer_write(AkwWriter *w, int length, const char *chars)
+{
+  AkwBuffer *buf = &w->buf;
+  int count = buf->count + length;
+  if (count > buf->capacity)
+  {
+    if (count > AKW_WRITER_FLUSH_SIZE)
+    {
+      write_stream(w, buf->count, (char *) buf->bytes);
+      akw_buffer_clear(buf);
+      count = length;
+    }
+    if (length >= AKW_WRITER_FLUSH_SIZE || !grow(w, count))
+    {
+      // What is buffered goes out first, to keep the output in order.
+      if (buf->count)
+      {
+        write_stream(w, buf->count, (char *) buf->bytes);
+        akw_buffer_clear(buf);
+      }
+      write_stream(w, length, chars);
+      return;
+    }
+  }
+  memcpy(&buf->bytes[buf->count], chars, (size_t) length);
+  buf->count = count;
+}
+
+void akw_writer_write_int(AkwWriter *w, int64_t num)
+{
+  char chars[MAX_NUMBER_LENGTH];
+  char *end = &chars[MAX_NUMBER_LENGTH];
+  uint64_t mag = num < 0 ? 0 - (uint64_t) num : (uint64_t) num;
+  int length = format_uint(mag, end);
+  if (num < 0)
+    end[-++length] = '-';
+  akw_writer_write(w, length, end - length);
+}
+
+void akw_writer_write_number(AkwWriter *w, double num)
+{
+  if (num >= AKW_INT_MIN && num <= AKW_INT_MAX && num == (int64_t) num
+   && (num || !signbit(num)))
+  {
+    akw_writer_write_int(w, (int64_t) num);
+    return;
+  }
+  if (isnan(num))
+  {
+    akw_writer_write(w, 3, "nan");
+    return;
+  }
+  if (isinf(num))
+  {
+    if (num < 0)
+      akw_writer_write(w, 4, "-inf");
+    else
+      akw_writer_write(w, 3, "inf");
+    return;
+  }
+  char chars[MAX_NUMBER_LENGTH];
+  int length = format_double(num, chars);
+  akw_writer_write(w, length, chars);
+}
+
+void akw_writer_write_value(AkwWriter *w, AkwValue val, bool quoted)
+{
+  if (!akw_is_array(val))
+  {
+    write_scalar(w, val, quoted);
+    return;
+  }
+  // Nested arrays are walked with an explicit stack, so deep nesting cannot
+  // overflow the C stack.
+  FrameVector frames;
+  akw_vector_init_in(&frames, NULL);
+  int rc = AKW_OK;
+  akw_vector_append_in(&frames, ((Frame) { akw_as_array(val), 0 }), NULL, &rc);
+  akw_writer_write(w, 1, "[");
+  while (akw_is_ok(rc) && !akw_vector_is_empty(&frames))
+  {
+    Frame *frame = &frames.elements[frames.count - 1];
+    AkwArray *arr = frame->arr;
+    if (frame->index == akw_array_count(arr))
+    {
+      akw_writer_write(w, 1, "]");
+      --frames.count;
+      continue;
+    }
+    if (frame->index)
+      akw_writer_write(w, 2, ", ");
+    AkwValue elem = akw_array_get(arr, frame->index);
+    ++frame->index;
+    if (!akw_is_array(elem))
+    {
+      write_scalar(w, elem, true);
+      continue;
+    }
+    akw_writer_write(w, 1, "[");
+    akw_vector_append_in(&frames, ((Frame) { akw_as_array(elem), 0 }), NULL,
+      &rc);
+  }
+  akw_vector_deinit_in(&frames, NULL);
+  if (!akw_is_ok(rc))
+    w->rc = rc;
+}
@@ -1,3 +1,6 @@
 @echo off
 
 build\Debug\akwan.exe < examples\hello.akw
+pushd build
+ctest -C Debug --output-on-failure
+popd
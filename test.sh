@@ -1,3 +1,4 @@
 #!/usr/bin/env bash
 
 build/akwan < examples/hello.akw
+(cd build && ctest --output-on-failure)
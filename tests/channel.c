@@ -0,0 +1,104 @@
+//
+// channel.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <string.h>
+#include "akwan.h"
+#include "test.h"
+
+static char constantSource[] = "return \"abc\";";
+static char elementSource[] = "return [\"abc\"];";
+
+static inline bool is_abc(AkwValue val);
+static inline AkwValue run(char *source);
+static inline void test_constant(void);
+static inline void test_constant_element(void);
+static inline void test_frozen(void);
+
+static inline bool is_abc(AkwValue val)
+{
+  if (!akw_is_string(val)) return false;
+  AkwString *str = akw_as_string(val);
+  return str->length == 3 && !memcmp(str->chars, "abc", 3);
+}
+
+static inline AkwValue run(char *source)
+{
+  // The value outlives the VM, so it is moved off the VM's stats.
+  AkwCompiler comp;
+  akw_compiler_init(&comp, 0, source);
+  akw_compiler_compile(&comp);
+  check(akw_compiler_is_ok(&comp));
+  AkwVM vm;
+  akw_vm_init(&vm, AKW_VM_DEFAULT_STACK_SIZE);
+  akw_vm_run(&vm, &comp.chunk);
+  check(akw_vm_is_ok(&vm));
+  AkwValue val = akw_vm_peek(&vm);
+  akw_value_retain(val);
+  int rc = AKW_OK;
+  akw_value_transfer(val, &vm.memStats, NULL, &rc);
+  check(akw_is_ok(rc));
+  AkwChannel chan;
+  akw_channel_init(&chan, 4, &rc);
+  akw_channel_send(&chan, val, &rc);
+  check(akw_is_ok(rc));
+  akw_vm_deinit(&vm);
+  akw_compiler_deinit(&comp);
+  AkwValue result = akw_channel_receive(&chan);
+  akw_channel_deinit(&chan);
+  return result;
+}
+
+static inline void test_constant(void)
+{
+  AkwValue val = run(constantSource);
+  check(is_abc(val));
+  check(!akw_object_is_immortal(akw_as_object(val)));
+  akw_value_release(val);
+}
+
+static inline void test_constant_element(void)
+{
+  // The array is the receiver's, but its element was a constant of the
+  // sender's chunk, which is gone.
+  AkwValue val = run(elementSource);
+  check(akw_is_array(val));
+  AkwValue elem = akw_array_get(akw_as_array(val), 0);
+  check(is_abc(elem));
+  check(!akw_object_is_immortal(akw_as_object(elem)));
+  akw_value_release(val);
+}
+
+static inline void test_frozen(void)
+{
+  // Frozen values are passed as they are.
+  AkwArray *arr = akw_array_new();
+  int rc = AKW_OK;
+  akw_array_inplace_append(arr, akw_string_value(akw_string_new()), &rc);
+  AkwValue val = akw_array_value(arr);
+  akw_value_retain(val);
+  val = akw_value_freeze(val, &rc);
+  check(akw_is_ok(rc));
+  AkwChannel chan;
+  akw_channel_init(&chan, 4, &rc);
+  akw_channel_send(&chan, val, &rc);
+  check(akw_is_ok(rc));
+  AkwValue received = akw_channel_receive(&chan);
+  check(received.asPointer == val.asPointer);
+  akw_channel_deinit(&chan);
+  akw_value_free_frozen(val);
+}
+
+int main(void)
+{
+  test_constant();
+  test_constant_element();
+  test_frozen();
+  return test_status();
+}
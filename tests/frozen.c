@@ -0,0 +1,90 @@
+//
+// frozen.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <string.h>
+#include "akwan.h"
+#include "test.h"
+
+static char constantSource[] = "return \"abc\";";
+
+static inline bool is_abc(AkwValue val);
+static inline void test_free_element(void);
+static inline void test_free_image_constant(void);
+
+static inline bool is_abc(AkwValue val)
+{
+  if (!akw_is_string(val)) return false;
+  AkwString *str = akw_as_string(val);
+  return str->length == 3 && !memcmp(str->chars, "abc", 3);
+}
+
+static inline void test_free_element(void)
+{
+  // Elements do not own the region, so the root is still readable after
+  // they are passed in, and is the one that frees it.
+  int rc = AKW_OK;
+  AkwArray *arr = akw_array_new();
+  AkwArray *inner = akw_array_new();
+  akw_array_inplace_append(inner, akw_int_value(1), &rc);
+  akw_array_inplace_append(arr, akw_array_value(inner), &rc);
+  akw_array_inplace_append(arr, akw_string_value(akw_string_new_from(3, "abc",
+    &rc)), &rc);
+  check(akw_is_ok(rc));
+  AkwValue val = akw_array_value(arr);
+  akw_value_retain(val);
+  val = akw_value_freeze(val, &rc);
+  check(akw_is_ok(rc));
+  AkwArray *frozen = akw_as_array(val);
+  akw_value_free_frozen(akw_array_get(frozen, 0));
+  akw_value_free_frozen(akw_array_get(frozen, 1));
+  check(akw_array_count(frozen) == 2);
+  AkwValue first = akw_array_get(frozen, 0);
+  check(akw_is_array(first));
+  check(akw_as_number(akw_array_get(akw_as_array(first), 0)) == 1);
+  check(is_abc(akw_array_get(frozen, 1)));
+  akw_value_free_frozen(val);
+}
+
+static inline void test_free_image_constant(void)
+{
+  // Image constants live in the image, and stay there until it is
+  // deinitialized.
+  AkwCompiler comp;
+  akw_compiler_init(&comp, 0, constantSource);
+  akw_compiler_compile(&comp);
+  check(akw_compiler_is_ok(&comp));
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  int rc = AKW_OK;
+  akw_image_write(&comp.chunk, &buf, &rc);
+  check(akw_is_ok(rc));
+  akw_compiler_deinit(&comp);
+  AkwImage img;
+  akw_image_init_from_bytes(&img, (size_t) buf.count, buf.bytes);
+  check(akw_image_is_ok(&img));
+  AkwValue constant = akw_vector_get(&img.chunk.consts, 0);
+  check(is_abc(constant));
+  akw_value_free_frozen(constant);
+  AkwVM vm;
+  akw_vm_init(&vm, AKW_VM_DEFAULT_STACK_SIZE);
+  akw_vm_run(&vm, &img.chunk);
+  check(akw_vm_is_ok(&vm));
+  check(is_abc(akw_vm_peek(&vm)));
+  akw_vm_deinit(&vm);
+  akw_image_deinit(&img);
+  akw_buffer_deinit(&buf);
+}
+
+int main(void)
+{
+  test_free_element();
+  test_free_image_constant();
+  return test_status();
+}
@@ -0,0 +1,156 @@
+//
+// image.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <string.h>
+#include "akwan.h"
+#include "test.h"
+
+#define STACK_SIZE (64)
+
+// Where the header of an image keeps the depth of its code.
+#define MAX_DEPTH_OFFSET (28)
+
+static inline void emit_empty_arrays(AkwChunk *chunk, int n);
+static inline void run_image(AkwBuffer *buf, int *imageRc, int *vmRc);
+static inline void test_depth_fits(void);
+static inline void test_too_deep(void);
+static inline void test_wrong_depth(void);
+static inline void test_empty_array_on_full_stack(void);
+
+static inline void emit_empty_arrays(AkwChunk *chunk, int n)
+{
+  int rc = AKW_OK;
+  for (int i = 0; i < n; ++i)
+  {
+    akw_chunk_emit_opcode(chunk, AKW_OP_ARRAY, &rc);
+    akw_chunk_emit_byte(chunk, 0, &rc);
+  }
+  akw_chunk_emit_opcode(chunk, AKW_OP_RETURN, &rc);
+  check(akw_is_ok(rc));
+}
+
+static inline void run_image(AkwBuffer *buf, int *imageRc, int *vmRc)
+{
+  AkwImage img;
+  akw_image_init_from_bytes(&img, (size_t) buf->count, buf->bytes);
+  *imageRc = img.rc;
+  *vmRc = AKW_OK;
+  if (!akw_image_is_ok(&img)) return;
+  AkwVM vm;
+  akw_vm_init(&vm, STACK_SIZE);
+  akw_vm_run(&vm, &img.chunk);
+  *vmRc = vm.rc;
+  if (akw_vm_is_ok(&vm))
+    check(!strcmp(vm.err, ""));
+  else
+    check(!strcmp(vm.err, "stack overflow"));
+  akw_vm_deinit(&vm);
+  akw_image_deinit(&img);
+}
+
+static inline void test_depth_fits(void)
+{
+  AkwChunk chunk;
+  akw_chunk_init(&chunk);
+  emit_empty_arrays(&chunk, STACK_SIZE);
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  int rc = AKW_OK;
+  akw_image_write(&chunk, &buf, &rc);
+  check(akw_is_ok(rc));
+  int imageRc;
+  int vmRc;
+  run_image(&buf, &imageRc, &vmRc);
+  check(akw_is_ok(imageRc));
+  check(akw_is_ok(vmRc));
+  akw_buffer_deinit(&buf);
+  akw_chunk_deinit(&chunk);
+}
+
+static inline void test_too_deep(void)
+{
+  // Code one slot deeper than the stack is refused before it runs.
+  AkwChunk chunk;
+  akw_chunk_init(&chunk);
+  emit_empty_arrays(&chunk, STACK_SIZE + 1);
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  int rc = AKW_OK;
+  akw_image_write(&chunk, &buf, &rc);
+  check(akw_is_ok(rc));
+  int imageRc;
+  int vmRc;
+  run_image(&buf, &imageRc, &vmRc);
+  check(akw_is_ok(imageRc));
+  check(vmRc == AKW_RANGE_ERROR);
+  akw_buffer_deinit(&buf);
+  akw_chunk_deinit(&chunk);
+}
+
+static inline void test_wrong_depth(void)
+{
+  // A header claiming a shallower stack than the code reaches is rejected
+  // on load.
+  AkwChunk chunk;
+  akw_chunk_init(&chunk);
+  emit_empty_arrays(&chunk, STACK_SIZE * 2);
+  AkwBuffer buf;
+  akw_buffer_init(&buf);
+  int rc = AKW_OK;
+  akw_image_write(&chunk, &buf, &rc);
+  check(akw_is_ok(rc));
+  uint32_t maxDepth = 1;
+  memcpy(&buf.bytes[MAX_DEPTH_OFFSET], &maxDepth, sizeof(maxDepth));
+  int imageRc;
+  int vmRc;
+  run_image(&buf, &imageRc, &vmRc);
+  check(imageRc == AKW_SYNTAX_ERROR);
+  akw_buffer_deinit(&buf);
+  akw_chunk_deinit(&chunk);
+}
+
+static inline void test_empty_array_on_full_stack(void)
+{
+  // An empty array innermost in a nest of non-empty ones is created when
+  // every slot of the stack already holds an element.
+  AkwBuffer src;
+  akw_buffer_init(&src);
+  int rc = AKW_OK;
+  akw_buffer_write(&src, 7, "return ", &rc);
+  for (int i = 0; i < STACK_SIZE; ++i)
+    akw_buffer_write(&src, 4, "[1, ", &rc);
+  akw_buffer_write(&src, 2, "[]", &rc);
+  for (int i = 0; i < STACK_SIZE; ++i)
+    akw_buffer_write(&src, 1, "]", &rc);
+  akw_buffer_write(&src, 2, ";", &rc);
+  check(akw_is_ok(rc));
+  AkwCompiler comp;
+  akw_compiler_init(&comp, 0, (char *) src.bytes);
+  if (akw_compiler_is_ok(&comp))
+    akw_compiler_compile(&comp);
+  check(akw_compiler_is_ok(&comp));
+  AkwVM vm;
+  akw_vm_init(&vm, STACK_SIZE);
+  akw_vm_run(&vm, &comp.chunk);
+  check(vm.rc == AKW_RANGE_ERROR);
+  check(!strcmp(vm.err, "stack overflow"));
+  akw_vm_deinit(&vm);
+  akw_compiler_deinit(&comp);
+  akw_buffer_deinit(&src);
+}
+
+int main(void)
+{
+  test_depth_fits();
+  test_too_deep();
+  test_wrong_depth();
+  test_empty_array_on_full_stack();
+  return test_status();
+}
@@ -0,0 +1,346 @@
+//
+// lexer.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "akwan/common.h"
+#include "akwan/lexer.h"
+
+#define NUM_INPUTS    (400)
+#define NUM_OFFSETS   (4)
+#define MAX_ALIGNMENT (64)
+
+typedef struct
+{
+  const char *name;
+  void       (*init_source)(AkwLexer *, char *);
+  void       (*init_stream)(AkwLexer *, AkwReadFn, void *, int *, AkwError);
+  void       (*next)(AkwLexer *, int *, AkwError);
+  void       (*deinit)(AkwLexer *);
+} Variant;
+
+typedef struct
+{
+  int      capacity;
+  int      count;
+  AkwToken *tokens;
+  int      rc;
+  AkwError err;
+} Result;
+
+typedef struct
+{
+  const char *chars;
+  int        length;
+  int        pos;
+  uint64_t   seed;
+} Stream;
+
+void simd_lexer_init_source(AkwLexer *lex, char *source);
+void simd_lexer_init_stream(AkwLexer *lex, AkwReadFn read, void *userData,
+  int *rc, AkwError err);
+void simd_lexer_next(AkwLexer *lex, int *rc, AkwError err);
+void simd_lexer_deinit(AkwLexer *lex);
+void scalar_lexer_init_source(AkwLexer *lex, char *source);
+void scalar_lexer_init_stream(AkwLexer *lex, AkwReadFn read, void *userData,
+  int *rc, AkwError err);
+void scalar_lexer_next(AkwLexer *lex, int *rc, AkwError err);
+void scalar_lexer_deinit(AkwLexer *lex);
+
+static const Variant variants[] = {
+  { "simd", simd_lexer_init_source, simd_lexer_init_stream, simd_lexer_next,
+    simd_lexer_deinit },
+  { "scalar", scalar_lexer_init_source, scalar_lexer_init_stream,
+    scalar_lexer_next, scalar_lexer_deinit }
+};
+
+static const char *keywords[] = {
+  "false", "inout", "let", "nil", "return", "true"
+};
+
+static const char blanks[] = " \t\r\v\f";
+static const char puncts[] = ",;()[]{}&=+-*/%";
+static const char nameChars[] =
+  "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_";
+
+static uint64_t state = 0x9e3779b97f4a7c15ULL;
+
+static inline uint32_t random_below(uint64_t *seed, uint32_t n);
+static inline void append(char **chars, int *length, int *capacity, char c);
+static inline void append_run(char **chars, int *length, int *capacity,
+  const char *set, int n);
+static inline char *generate(int *length);
+static inline int read_stream(void *userData, int size, char *chars);
+static inline void add_token(Result *result, AkwToken token);
+static inline void lex_source(const Variant *variant, char *source,
+  Result *result);
+static inline void lex_stream(const Variant *variant, Stream *stream,
+  Result *result);
+static inline bool same_result(const Result *expected, const Result *actual,
+  const char *what, int input, int offset);
+static inline void result_reset(Result *result);
+
+static inline uint32_t random_below(uint64_t *seed, uint32_t n)
+{
+  uint64_t x = *seed;
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  *seed = x;
+  return (uint32_t) ((x >> 32) % n);
+}
+
+static inline void append(char **chars, int *length, int *capacity, char c)
+{
+  if (*length + 1 >= *capacity)
+  {
+    *capacity <<= 1;
+    *chars = realloc(*chars, (size_t) *capacity);
+    if (!*chars) abort();
+  }
+  (*chars)[(*length)++] = c;
+}
+
+static inline void append_run(char **chars, int *length, int *capacity,
+  const char *set, int n)
+{
+  int setLength = (int) strlen(set);
+  for (int i = 0; i < n; ++i)
+    append(chars, length, capacity, set[random_below(&state, setLength)]);
+}
+
+static inline char *generate(int *length)
+{
+  // Runs straddle the short run limit of the lexer and the block sizes of
+  // the scanners. Some inputs are larger than the window of a stream, and
+  // some end with an error.
+  int capacity = 256;
+  char *chars = malloc((size_t) capacity);
+  if (!chars) abort();
+  *length = 0;
+  int size = random_below(&state, 10) ? (int) random_below(&state, 4096)
+    : (int) random_below(&state, 1 << 18);
+  while (*length < size)
+  {
+    switch (random_below(&state, 8))
+    {
+    case 0:
+      append_run(&chars, length, &capacity, blanks,
+        1 + (int) random_below(&state, random_below(&state, 4) ? 20 : 200));
+      break;
+    case 1:
+      append_run(&chars, length, &capacity, "\n",
+        1 + (int) random_below(&state, 3));
+      break;
+    case 2:
+      if (!random_below(&state, 4))
+      {
+        const char *kw = keywords[random_below(&state, 6)];
+        for (const char *p = kw; *p; ++p)
+          append(&chars, length, &capacity, *p);
+        break;
+      }
+      append_run(&chars, length, &capacity, "_abcXYZ", 1);
+      append_run(&chars, length, &capacity, nameChars,
+        (int) random_below(&state, random_below(&state, 4) ? 20 : 100));
+      break;
+    case 3:
+      append_run(&chars, length, &capacity, "123456789", 1);
+      append_run(&chars, length, &capacity, "0123456789",
+        (int) random_below(&state, 24));
+      if (random_below(&state, 2))
+      {
+        append(&chars, length, &capacity, '.');
+        append_run(&chars, length, &capacity, "0123456789",
+          1 + (int) random_below(&state, 24));
+      }
+      if (!random_below(&state, 4))
+      {
+        append_run(&chars, length, &capacity, "eE", 1);
+        append_run(&chars, length, &capacity, "+-0123456789", 1);
+        append_run(&chars, length, &capacity, "0123456789",
+          1 + (int) random_below(&state, 3));
+      }
+      break;
+    case 4:
+      {
+        append(&chars, length, &capacity, '"');
+        int n = (int) random_below(&state,
+          random_below(&state, 4) ? 20 : 300);
+        for (int i = 0; i < n; ++i)
+        {
+          char c = (char) (1 + random_below(&state, 255));
+          append(&chars, length, &capacity, c == '"' ? '\n' : c);
+        }
+        append(&chars, length, &capacity, '"');
+      }
+      break;
+    case 5:
+      append_run(&chars, length, &capacity, puncts, 1);
+      break;
+    case 6:
+      append(&chars, length, &capacity, '.');
+      append(&chars, length, &capacity, '.');
+      break;
+    case 7:
+      if (!random_below(&state, 500))
+        append_run(&chars, length, &capacity, "@#$\x80\xff", 1);
+      else
+        append(&chars, length, &capacity, ' ');
+      break;
+    }
+  }
+  if (!random_below(&state, 20))
+  {
+    append(&chars, length, &capacity, '"');
+    append_run(&chars, length, &capacity, nameChars,
+      (int) random_below(&state, 100));
+  }
+  chars[*length] = '\0';
+  return chars;
+}
+
+static inline int read_stream(void *userData, int size, char *chars)
+{
+  Stream *stream = userData;
+  int n = 1 + (int) random_below(&stream->seed, 1 << 14);
+  if (n > size) n = size;
+  if (n > stream->length - stream->pos) n = stream->length - stream->pos;
+  memcpy(chars, &stream->chars[stream->pos], (size_t) n);
+  stream->pos += n;
+  return n;
+}
+
+static inline void add_token(Result *result, AkwToken token)
+{
+  if (result->count == result->capacity)
+  {
+    result->capacity = result->capacity ? result->capacity << 1 : 256;
+    result->tokens = realloc(result->tokens,
+      sizeof(*result->tokens) * (size_t) result->capacity);
+    if (!result->tokens) abort();
+  }
+  result->tokens[result->count++] = token;
+}
+
+static inline void lex_source(const Variant *variant, char *source,
+  Result *result)
+{
+  AkwLexer lex;
+  variant->init_source(&lex, source);
+  for (;;)
+  {
+    variant->next(&lex, &result->rc, result->err);
+    if (!akw_is_ok(result->rc)) break;
+    add_token(result, lex.token);
+    if (lex.token.kind == AKW_TOKEN_KIND_EOF) break;
+  }
+  variant->deinit(&lex);
+}
+
+static inline void lex_stream(const Variant *variant, Stream *stream,
+  Result *result)
+{
+  AkwLexer lex;
+  variant->init_stream(&lex, read_stream, stream, &result->rc, result->err);
+  while (akw_is_ok(result->rc))
+  {
+    add_token(result, lex.token);
+    if (lex.token.kind == AKW_TOKEN_KIND_EOF) break;
+    variant->next(&lex, &result->rc, result->err);
+  }
+  variant->deinit(&lex);
+}
+
+static inline bool same_result(const Result *expected, const Result *actual,
+  const char *what, int input, int offset)
+{
+  int n = expected->count < actual->count ? expected->count : actual->count;
+  for (int i = 0; i < n; ++i)
+  {
+    AkwToken *a = &expected->tokens[i];
+    AkwToken *b = &actual->tokens[i];
+    if (a->kind == b->kind && a->offset == b->offset && a->length == b->length)
+      continue;
+    fprintf(stderr, "input %d, offset %d, %s: token %d is %d at %d (%d) "
+      "instead of %d at %d (%d)\n", input, offset, what, i, b->kind,
+      b->offset, b->length, a->kind, a->offset, a->length);
+    return false;
+  }
+  if (expected->count != actual->count)
+  {
+    fprintf(stderr, "input %d, offset %d, %s: %d token(s) instead of %d\n",
+      input, offset, what, actual->count, expected->count);
+    return false;
+  }
+  if (expected->rc != actual->rc || strcmp(expected->err, actual->err))
+  {
+    fprintf(stderr, "input %d, offset %d, %s: error %d '%s' instead of "
+      "%d '%s'\n", input, offset, what, actual->rc, actual->err,
+      expected->rc, expected->err);
+    return false;
+  }
+  return true;
+}
+
+static inline void result_reset(Result *result)
+{
+  result->count = 0;
+  result->rc = AKW_OK;
+  result->err[0] = '\0';
+}
+
+int main(void)
+{
+  // The scalar lexer reading the whole source is the reference. The SIMD
+  // one must agree with it at any alignment, and both must agree with
+  // themselves reading a stream in chunks of random sizes.
+  Result expected = { 0 };
+  Result actual = { 0 };
+  bool passed = true;
+  for (int input = 0; input < NUM_INPUTS && passed; ++input)
+  {
+    int length;
+    char *chars = generate(&length);
+    char *block = malloc((size_t) length + MAX_ALIGNMENT * 2);
+    if (!block) abort();
+    result_reset(&expected);
+    lex_source(&variants[1], chars, &expected);
+    for (int i = 0; i < NUM_OFFSETS && passed; ++i)
+    {
+      int offset = (int) random_below(&state, MAX_ALIGNMENT);
+      uintptr_t base = ((uintptr_t) block + MAX_ALIGNMENT - 1)
+        & ~(uintptr_t) (MAX_ALIGNMENT - 1);
+      char *source = (char *) base + offset;
+      memcpy(source, chars, (size_t) length + 1);
+      result_reset(&actual);
+      lex_source(&variants[0], source, &actual);
+      passed = same_result(&expected, &actual, "simd", input, offset);
+    }
+    uint64_t seed = state | 1;
+    for (int i = 0; i < 2 && passed; ++i)
+    {
+      Stream stream = { chars, length, 0, seed };
+      result_reset(&actual);
+      lex_stream(&variants[i], &stream, &actual);
+      char what[32];
+      snprintf(what, sizeof(what), "%s stream", variants[i].name);
+      passed = same_result(&expected, &actual, what, input, 0);
+    }
+    free(block);
+    free(chars);
+  }
+  free(expected.tokens);
+  free(actual.tokens);
+  return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+//
+// memory.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan.h"
+#include "test.h"
+
+#define COUNT (10000)
+
+static char wrapSource[] = "return [x];";
+static char foldSource[] = "return [a[0] + b];";
+static char combineSource[] = "return [a[0] + b[0]];";
+
+static inline void compile(AkwCompiler *comp, char *source, const char *param1,
+  const char *param2);
+static inline void test_map_result_in_vm(AkwChunk *wrap);
+static inline void test_reduce_result(AkwChunk *fold, AkwChunk *combine);
+static inline void test_channel(void);
+
+static inline void compile(AkwCompiler *comp, char *source, const char *param1,
+  const char *param2)
+{
+  akw_compiler_init(comp, 0, source);
+  akw_compiler_define_param(comp, param1);
+  if (param2)
+    akw_compiler_define_param(comp, param2);
+  if (akw_compiler_is_ok(comp))
+    akw_compiler_compile(comp);
+  check(akw_compiler_is_ok(comp));
+}
+
+static inline void test_map_result_in_vm(AkwChunk *wrap)
+{
+  // The elements are created by worker VMs that are gone by the time the
+  // result is freed by a VM that created none of it.
+  AkwMemoryStats stats;
+  akw_memory_stats_init(&stats);
+  AkwMemoryStats *prevStats = akw_memory_swap_stats(&stats);
+  AkwParallel par;
+  akw_parallel_init(&par);
+  par.numWorkers = 3;
+  AkwValue input = akw_range_value(akw_range_new(0, COUNT));
+  akw_value_retain(input);
+  AkwValue result = akw_parallel_map(&par, wrap, input);
+  check(akw_parallel_is_ok(&par));
+  akw_value_release(input);
+  akw_parallel_deinit(&par);
+  akw_memory_swap_stats(prevStats);
+  check(stats.objects[AKW_TYPE_ARRAY] == COUNT + 1);
+  check(stats.objects[AKW_TYPE_RANGE] == 0);
+  check(stats.bytes > 0);
+  AkwVM vm;
+  akw_vm_init(&vm, AKW_VM_DEFAULT_STACK_SIZE);
+  size_t bytes = vm.memStats.bytes;
+  akw_vm_push(&vm, result);
+  akw_value_release(result);
+  akw_vm_reset(&vm);
+  check(vm.memStats.bytes == bytes);
+  check(vm.memStats.objects[AKW_TYPE_ARRAY] == 0);
+  check(stats.objects[AKW_TYPE_ARRAY] == 0);
+  check(stats.bytes == 0);
+  akw_vm_deinit(&vm);
+}
+
+static inline void test_reduce_result(AkwChunk *fold, AkwChunk *combine)
+{
+  // The combining VM is gone too, so the result is charged to the caller.
+  AkwMemoryStats stats;
+  akw_memory_stats_init(&stats);
+  AkwMemoryStats *prevStats = akw_memory_swap_stats(&stats);
+  AkwParallel par;
+  akw_parallel_init(&par);
+  par.numWorkers = 3;
+  AkwValue input = akw_range_value(akw_range_new(0, COUNT));
+  akw_value_retain(input);
+  AkwArray *arr = akw_array_new();
+  int rc = AKW_OK;
+  akw_array_inplace_append(arr, akw_int_value(0), &rc);
+  AkwValue init = akw_array_value(arr);
+  akw_value_retain(init);
+  init = akw_value_freeze(init, &rc);
+  check(akw_is_ok(rc));
+  AkwValue result = akw_parallel_reduce(&par, fold, combine, init, input);
+  check(akw_parallel_is_ok(&par));
+  akw_value_release(input);
+  akw_value_free_frozen(init);
+  akw_parallel_deinit(&par);
+  check(akw_is_array(result));
+  check(akw_as_number(akw_array_get(akw_as_array(result), 0))
+    == (double) COUNT * (COUNT - 1) / 2);
+  check(stats.objects[AKW_TYPE_ARRAY] == 1);
+  akw_value_release(result);
+  akw_memory_swap_stats(prevStats);
+  check(stats.objects[AKW_TYPE_ARRAY] == 0);
+  check(stats.bytes == 0);
+}
+
+static inline void test_channel(void)
+{
+  // A received value is charged to the receiver, and no longer to the
+  // stats it was created with, even if those are not current when it is
+  // sent.
+  AkwMemoryStats sender;
+  AkwMemoryStats receiver;
+  akw_memory_stats_init(&sender);
+  akw_memory_stats_init(&receiver);
+  AkwChannel chan;
+  int rc = AKW_OK;
+  akw_channel_init(&chan, 4, &rc);
+  check(akw_is_ok(rc));
+  AkwMemoryStats *prevStats = akw_memory_swap_stats(&sender);
+  AkwArray *arr = akw_array_new();
+  AkwArray *inner = akw_array_new();
+  akw_array_inplace_append(arr, akw_array_value(inner), &rc);
+  akw_array_inplace_append(arr, akw_string_value(akw_string_new()), &rc);
+  check(akw_is_ok(rc));
+  AkwValue val = akw_array_value(arr);
+  akw_value_retain(val);
+  check(sender.objects[AKW_TYPE_ARRAY] == 2);
+  akw_memory_swap_stats(prevStats);
+  akw_channel_send(&chan, val, &rc);
+  check(akw_is_ok(rc));
+  check(sender.objects[AKW_TYPE_ARRAY] == 0);
+  check(sender.objects[AKW_TYPE_STRING] == 0);
+  check(sender.bytes == 0);
+  akw_memory_swap_stats(&receiver);
+  AkwValue received = akw_channel_receive(&chan);
+  check(received.asPointer == val.asPointer);
+  check(receiver.objects[AKW_TYPE_ARRAY] == 2);
+  check(receiver.objects[AKW_TYPE_STRING] == 1);
+  akw_memory_swap_stats(prevStats);
+  akw_value_release(received);
+  check(receiver.objects[AKW_TYPE_ARRAY] == 0);
+  check(receiver.objects[AKW_TYPE_STRING] == 0);
+  check(receiver.bytes == 0);
+  akw_channel_deinit(&chan);
+}
+
+int main(void)
+{
+  AkwCompiler wrap;
+  AkwCompiler fold;
+  AkwCompiler combine;
+  compile(&wrap, wrapSource, "x", NULL);
+  compile(&fold, foldSource, "a", "b");
+  compile(&combine, combineSource, "a", "b");
+  test_map_result_in_vm(&wrap.chunk);
+  test_reduce_result(&fold.chunk, &combine.chunk);
+  test_channel();
+  akw_compiler_deinit(&combine);
+  akw_compiler_deinit(&fold);
+  akw_compiler_deinit(&wrap);
+  return test_status();
+}
@@ -0,0 +1,124 @@
+//
+// number.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <stdint.h>
+#include <string.h>
+#include "akwan.h"
+#include "test.h"
+
+typedef struct
+{
+  const char *chars;
+  uint64_t   bits;
+} Case;
+
+// Expected bits come from a correctly rounded conversion.
+static const Case cases[] = {
+  // Halfway between 1 and the next double, so it rounds to even.
+  { "1.00000000000000011102230246251565404236316680908203125", 0x3ff0000000000000ULL },
+  { "1.00000000000000011102230246251565404236316680908203124", 0x3ff0000000000000ULL },
+  { "1.000000000000000111022302462515654042363166809082031251", 0x3ff0000000000001ULL },
+  { "9007199254740993", 0x4340000000000000ULL },
+  { "9007199254740993.0000000000000000000000", 0x4340000000000000ULL },
+  { "9007199254740993.0000000000000000000001", 0x4340000000000001ULL },
+  { "123456789012345678901234567890", 0x45f8ee90ff6c373eULL },
+  // Around the smallest subnormal and the largest finite double.
+  { "2.4703282292062327e-324", 0x0000000000000000ULL },
+  { "2.4703282292062328e-324", 0x0000000000000001ULL },
+  { "4.9406564584124654e-324", 0x0000000000000001ULL },
+  { "2.2250738585072011e-308", 0x000fffffffffffffULL },
+  { "2.2250738585072012e-308", 0x0010000000000000ULL },
+  { "1.7976931348623158e308", 0x7fefffffffffffffULL },
+  { "1.7976931348623159e308", 0x7ff0000000000000ULL },
+  // Short ones, taken by the fast path.
+  { "0.1", 0x3fb999999999999aULL },
+  { "1e5", 0x40f86a0000000000ULL },
+  { "1e23", 0x44b52d02c7e14af6ULL },
+  { "7.2057594037927933e16", 0x4370000000000000ULL }
+};
+
+// Exactly half of the smallest subnormal, written out in full.
+static const char halfOfTiny[] =
+  "2.47032822920623272088284396434110686182529901307162382212792841"
+  "2503377536351043759326499181808179961898982823477228588654633283"
+  "5517796989819938739800539093906315035659515570226392290858392449"
+  "1051844359318028499365361525003193704576782492193656236698636584"
+  "8075700158576926990370631192827955855133292783433840935197801553"
+  "1246597263579574622766465272827220056374006485499977096599470454"
+  "0208281662262378573934507363390079677619305775067401763246736009"
+  "6895134053553745851666113422376667860416215968046191446729184030"
+  "0530057530849048765391711386591646239524912623653881879636239373"
+  "2804238910186723484976682350898633885879256283027559956575244555"
+  "0725518931369083625477918694866799496832404970582102851318545139"
+  "6213837722826145437693412532098591327667236328125";
+
+static inline uint64_t bits_of(double num);
+static inline void test_cases(void);
+static inline void test_half_of_tiny(void);
+static inline void test_exponent_kind(void);
+
+static inline uint64_t bits_of(double num)
+{
+  uint64_t bits;
+  memcpy(&bits, &num, sizeof(bits));
+  return bits;
+}
+
+static inline void test_cases(void)
+{
+  int n = (int) (sizeof(cases) / sizeof(*cases));
+  for (int i = 0; i < n; ++i)
+  {
+    const Case *c = &cases[i];
+    uint64_t bits = bits_of(akw_parse_number((int) strlen(c->chars), c->chars));
+    if (bits == c->bits) continue;
+    fprintf(stderr, "%s: 0x%016llx instead of 0x%016llx\n", c->chars,
+      (unsigned long long) bits, (unsigned long long) c->bits);
+    ++numFailures;
+  }
+}
+
+static inline void test_half_of_tiny(void)
+{
+  // A tie rounds to the even zero, and anything past it to the smallest
+  // subnormal.
+  char chars[sizeof(halfOfTiny) + 8];
+  int length = (int) strlen(halfOfTiny);
+  memcpy(chars, halfOfTiny, (size_t) length);
+  memcpy(&chars[length], "e-324", 6);
+  check(bits_of(akw_parse_number(length + 5, chars)) == 0x0000000000000000ULL);
+  memcpy(&chars[length], "1e-324", 7);
+  check(bits_of(akw_parse_number(length + 6, chars)) == 0x0000000000000001ULL);
+}
+
+static inline void test_exponent_kind(void)
+{
+  // An exponent makes a Number, even when the value is integral.
+  char source[] = "1e5 100000";
+  AkwLexer lex;
+  akw_lexer_init_source(&lex, source);
+  int rc = AKW_OK;
+  AkwError err;
+  akw_lexer_next(&lex, &rc, err);
+  check(akw_is_ok(rc));
+  check(lex.token.kind == AKW_TOKEN_KIND_NUMBER);
+  akw_lexer_next(&lex, &rc, err);
+  check(akw_is_ok(rc));
+  check(lex.token.kind == AKW_TOKEN_KIND_INT);
+  akw_lexer_deinit(&lex);
+}
+
+int main(void)
+{
+  test_cases();
+  test_half_of_tiny();
+  test_exponent_kind();
+  return test_status();
+}
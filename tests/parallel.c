@@ -0,0 +1,126 @@
+//
+// parallel.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include "akwan.h"
+#include "test.h"
+
+#define COUNT (10000)
+
+static char squareSource[] = "return x * x;";
+static char foldSource[] = "return acc + x * x;";
+static char addSource[] = "return a + b;";
+
+static inline void compile(AkwCompiler *comp, char *source, const char *param1,
+  const char *param2);
+static inline double sum_of_squares(int n);
+static inline void test_reduce(AkwParallel *par, AkwChunk *fold,
+  AkwChunk *add);
+static inline void test_map_then_reduce(AkwParallel *par, AkwChunk *square,
+  AkwChunk *add);
+static inline void test_init_not_identity(AkwParallel *par, AkwChunk *fold,
+  AkwChunk *add);
+
+static inline void compile(AkwCompiler *comp, char *source, const char *param1,
+  const char *param2)
+{
+  akw_compiler_init(comp, 0, source);
+  akw_compiler_define_param(comp, param1);
+  if (param2)
+    akw_compiler_define_param(comp, param2);
+  if (akw_compiler_is_ok(comp))
+    akw_compiler_compile(comp);
+  check(akw_compiler_is_ok(comp));
+}
+
+static inline double sum_of_squares(int n)
+{
+  double sum = 0;
+  for (int i = 0; i < n; ++i)
+    sum += (double) i * i;
+  return sum;
+}
+
+static inline void test_reduce(AkwParallel *par, AkwChunk *fold,
+  AkwChunk *add)
+{
+  // The fold is not the join, so blocks must not be joined with it.
+  AkwValue input = akw_range_value(akw_range_new(0, COUNT));
+  akw_value_retain(input);
+  AkwValue result = akw_parallel_reduce(par, fold, add, akw_int_value(0),
+    input);
+  check(akw_parallel_is_ok(par));
+  check(akw_is_number(result));
+  check(akw_as_number(result) == sum_of_squares(COUNT));
+  akw_value_release(input);
+}
+
+static inline void test_map_then_reduce(AkwParallel *par, AkwChunk *square,
+  AkwChunk *add)
+{
+  AkwValue input = akw_range_value(akw_range_new(0, COUNT));
+  akw_value_retain(input);
+  AkwValue squares = akw_parallel_map(par, square, input);
+  check(akw_parallel_is_ok(par));
+  check(akw_is_array(squares));
+  check(akw_array_count(akw_as_array(squares)) == COUNT);
+  int rc = AKW_OK;
+  squares = akw_value_freeze(squares, &rc);
+  check(akw_is_ok(rc));
+  AkwValue result = akw_parallel_reduce(par, add, add, akw_int_value(0),
+    squares);
+  check(akw_parallel_is_ok(par));
+  check(akw_as_number(result) == sum_of_squares(COUNT));
+  akw_value_free_frozen(squares);
+  akw_value_release(input);
+}
+
+static inline void test_init_not_identity(AkwParallel *par, AkwChunk *fold,
+  AkwChunk *add)
+{
+  // Every block would start from 1, so the result would depend on the
+  // number of blocks.
+  AkwValue input = akw_range_value(akw_range_new(0, COUNT));
+  akw_value_retain(input);
+  AkwValue result = akw_parallel_reduce(par, fold, add, akw_int_value(1),
+    input);
+  check(par->rc == AKW_TYPE_ERROR);
+  check(akw_is_nil(result));
+  akw_value_release(input);
+}
+
+int main(void)
+{
+  AkwCompiler square;
+  AkwCompiler fold;
+  AkwCompiler add;
+  compile(&square, squareSource, "x", NULL);
+  compile(&fold, foldSource, "acc", "x");
+  compile(&add, addSource, "a", "b");
+  // Each pool runs several jobs, so that later ones go to threads left
+  // waiting by earlier ones.
+  int numWorkers[] = { 1, 3, akw_thread_count_cores() };
+  for (int i = 0; i < 3; ++i)
+  {
+    AkwParallel par;
+    akw_parallel_init(&par);
+    par.numWorkers = numWorkers[i];
+    for (int j = 0; j < 3; ++j)
+    {
+      test_reduce(&par, &fold.chunk, &add.chunk);
+      test_map_then_reduce(&par, &square.chunk, &add.chunk);
+      test_init_not_identity(&par, &fold.chunk, &add.chunk);
+    }
+    akw_parallel_deinit(&par);
+  }
+  akw_compiler_deinit(&add);
+  akw_compiler_deinit(&fold);
+  akw_compiler_deinit(&square);
+  return test_status();
+}
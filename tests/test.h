@@ -0,0 +1,30 @@
+//
+// test.h
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Reports a failed condition and goes on, so that one run shows every
+// failure; main returns test_status() at the end.
+#define check(c) \
+  do { \
+    if (c) break; \
+    fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #c); \
+    ++numFailures; \
+  } while (0)
+
+#define test_status() (numFailures ? EXIT_FAILURE : EXIT_SUCCESS)
+
+static int numFailures = 0;
+
+#endif // TEST_H
@@ -0,0 +1,101 @@
+//
+// writer.c
+// 
+// Copyright 2024 Fábio de Souza Villaça Medeiros
+// 
+// This file is part of the Akwan Project.
+// For detailed license information, please refer to the LICENSE file
+// located in the root directory of this project.
+//
+
+#include <string.h>
+#include "akwan.h"
+#include "test.h"
+
+// Small enough that the buffer stops growing early on.
+#define BUFFER_LIMIT (64)
+#define COUNT        (200)
+
+static inline int read_all(FILE *stream, int size, char *chars);
+static inline void test_capped_buffer(void);
+static inline void test_capped_buffer_value(void);
+
+static inline int read_all(FILE *stream, int size, char *chars)
+{
+  rewind(stream);
+  int length = (int) fread(chars, 1, (size_t) size - 1, stream);
+  chars[length] = '\0';
+  return length;
+}
+
+static inline void test_capped_buffer(void)
+{
+  // Writes that do not fit go straight to the stream, after what is
+  // buffered.
+  FILE *stream = tmpfile();
+  check(stream != NULL);
+  if (!stream) return;
+  AkwMemoryStats stats;
+  akw_memory_stats_init(&stats);
+  stats.limit = BUFFER_LIMIT;
+  AkwWriter w;
+  akw_writer_init_in(&w, stream, &stats);
+  char expected[COUNT * 8];
+  int length = 0;
+  for (int i = 0; i < COUNT; ++i)
+  {
+    akw_writer_write_int(&w, i);
+    akw_writer_write(&w, 2, ", ");
+    length += snprintf(&expected[length], sizeof(expected) - (size_t) length,
+      "%d, ", i);
+  }
+  check(w.buf.capacity <= BUFFER_LIMIT);
+  akw_writer_deinit(&w);
+  check(akw_writer_is_ok(&w));
+  check(stats.bytes == 0);
+  char actual[COUNT * 8];
+  check(read_all(stream, sizeof(actual), actual) == length);
+  check(!strcmp(actual, expected));
+  fclose(stream);
+}
+
+static inline void test_capped_buffer_value(void)
+{
+  FILE *stream = tmpfile();
+  check(stream != NULL);
+  if (!stream) return;
+  AkwMemoryStats stats;
+  akw_memory_stats_init(&stats);
+  stats.limit = BUFFER_LIMIT;
+  int rc = AKW_OK;
+  AkwArray *arr = akw_array_new();
+  for (int i = 0; i < COUNT; ++i)
+    akw_array_inplace_append(arr, akw_number_value(i + 0.25), &rc);
+  check(akw_is_ok(rc));
+  AkwValue val = akw_array_value(arr);
+  akw_value_retain(val);
+  AkwWriter w;
+  akw_writer_init_in(&w, stream, &stats);
+  akw_writer_write_value(&w, val, false);
+  akw_writer_deinit(&w);
+  check(akw_writer_is_ok(&w));
+  char expected[COUNT * 16];
+  int length = snprintf(expected, sizeof(expected), "[");
+  for (int i = 0; i < COUNT; ++i)
+    length += snprintf(&expected[length], sizeof(expected) - (size_t) length,
+      i ? ", %d.25" : "%d.25", i);
+  length += snprintf(&expected[length], sizeof(expected) - (size_t) length,
+    "]");
+  char actual[COUNT * 16];
+  check(read_all(stream, sizeof(actual), actual) == length);
+  check(!strcmp(actual, expected));
+  fclose(stream);
+  akw_value_release(val);
+}
+
+int main(void)
+{
+  test_capped_buffer();
+  test_capped_buffer_value();
+  return test_status();
+}